@@ -8,44 +8,55 @@
 #include <dirent.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdarg.h>
+
+#include "a1.h"
+#include "dir_walker.h"
+#include "out_writer.h"
+#include "section_scan.h"
+#include "sf_cache.h"
+#include "findall_batch.h"
+#include "findall_pipeline.h"
+#include "findall_layout.h"
+#include "line_index.h"
+#include "file_table.h"
+#include "query_server.h"
+#include "findall_watch.h"
+#include "suffix_trie.h"
+#include "filter_expr.h"
+#include "visited_set.h"
+#include "run_stats.h"
+#include "sf_v2.h"
+#include "line_scan.h"
+#include "../common/sf_format.h"
 
 #define OP_VARIANT "variant"
 #define OP_LIST "list"
 #define OP_PARSE "parse"
 #define OP_EXTRACT "extract"
 #define OP_FILTER "findall"
+#define OP_MULTI "multi"
+#define OP_SERVE "serve"
+#define OP_QUERY "query"
+#define OP_CONVERT "convert"
 
-const char magic_field[] = "1A4P";
-const int sect_types[] = {19, 10, 58, 57, 11, 53};
+// files kept open by the query server
+#define FILE_TABLE_SIZE 256
 
-#define MAX_PATH_SIZE 300
-#define MAX_NAME_SIZE 50
-#define MAX_NR_ELEMENTS 1000
-#define MAX_LINE_LENGTH 1024
-
-#define SUCCESS 0
-#define ERR_INVALID_PATH -1
-#define ERR_INVALID_ARGUMENTS -2
-#define ERR_MISSING_PATH -3
-#define ERR_READING_FILE -4
-#define ERR_INVALID_LINE_ENDING -5
-#define ERR_INVALID_FILE_FORMAT -6
-#define ERR_ALLOCATING_MEMORY -7
-#define ERR_MISSING_ARGUMENTS -9
-
-struct section_header{
-    char sect_name[20];
-    int sect_type;
-    int sect_offset;
-    int sect_size;
-};
+const int sect_types[] = {19, 10, 58, 57, 11, 53};
+// limits of a valid sf header for this assignment
+const sf_rules_t sf_rules = {.min_version = 47, .max_version = 128, .min_nr_sections = 3, .max_nr_sections = 17,
+                             .sect_types = sect_types, .nr_sect_types = sizeof(sect_types) / sizeof(sect_types[0])};
+// options naming a file or a directory, the server only takes them as absolute paths since its working directory is not the client's
+const char * path_options[] = {"path", "queries", "index", "cache", "out"};
 
-struct header{
-    char magic[5];
-    int header_size;
-    int version;
-    int no_of_sections;
-    struct section_header * section_headers;
+// where an operation writes its answer, and the state it may reuse from earlier requests
+struct op_env{
+    out_writer_t * output;
+    // open files with their parsed headers, only kept by the query server (NULL otherwise)
+    file_table_t * files;
+    // findall result of a tree kept current by the query server (NULL otherwise)
+    findall_watch_t * watch;
 };
 
 struct list_op_parameters{
@@ -53,6 +64,52 @@ struct list_op_parameters{
     bool recursive;
     bool suffix;
     bool permission;
+    bool threads;
+    bool cache;
+    bool uring;
+    bool pipeline;
+    bool layout;
+};
+
+struct list_op_context{
+    // the matching elements are written here as soon as they are found
+    out_writer_t * output;
+    // every name_ends_with option, matched in a single backward pass over the name
+    suffix_trie_t * suffixes;
+    char * permission;
+    // compiled where= expression, NULL if none was given
+    filter_expr_t * expr;
+    struct list_op_parameters detected;
+    bool filter;
+    // parsed headers and line counts from previous runs, NULL if not used
+    sf_cache_t * cache;
+    // findall candidates validated in io_uring batches, NULL if the files are validated one by one
+    findall_batch_t * batch;
+    // findall candidates handed to the header and scan stages, NULL if the walking threads validate them
+    findall_pipeline_t * pipeline;
+    // findall candidates collected to be read in the order of the disk, NULL if they are read as they are found
+    findall_layout_t * layout;
+    // findall results of the hard-linked files met so far, NULL if not used
+    visited_set_t * seen_files;
+};
+
+// one list or findall query of a multi traversal
+struct multi_query{
+    bool recursive;
+    // everything the query asks for, the findall condition included (NULL matches every element)
+    filter_expr_t * expr;
+    // the query's own result file, identified by its device and inode numbers so no two queries share it
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    out_writer_t output;
+};
+
+struct multi_context{
+    struct multi_query * queries;
+    size_t nr_queries;
+    // length of the root path, to tell the elements of the root from the deeper ones
+    size_t root_length;
 };
 
 struct extract_op_parameters{
@@ -60,54 +117,272 @@ struct extract_op_parameters{
     bool file;
     bool section;
     bool line;
+    bool index;
+    bool queries;
 };
 
-enum invalid_sf_field {NONE,MAGIC,VERSION,SECT_NR,SECT_TYPE};
 enum invalid_sf_extract_param {NONE_P,FILE_FORMAT,SECTION,LINE};
 
+// one (path, section, line) query of a batch extract, with its answer
+struct extract_query{
+    char * path;
+    int section_nr;
+    long line_nr;
+    int return_value;
+    enum invalid_sf_extract_param failure_src;
+    char * line;
+    int line_size;
+};
+
 // list the directory's content
-int list_directory_tree(char * dir_path, char ** dir_elements, int * max_nr_elements, int * elem_count, char * suffix, char * permission, struct list_op_parameters detected, bool filter);
-void perform_op_list(int nr_parameters, char ** parameters,bool filter);
+int list_directory_tree(char * dir_path, out_writer_t * output, suffix_trie_t * suffixes, char * permission, filter_expr_t * expr, struct list_op_parameters detected, bool filter, int nr_threads, int pipeline_threads[2], sf_cache_t * cache);
+int list_visit_entry(walk_entry_t * entry, void * arg);
+void perform_op_list(int nr_parameters, char ** parameters,bool filter, struct op_env * env);
 // translate the permission rights
 unsigned convert_permission_format(const char * permission);
 // apply filter on files
-bool validate_file_with_suffix(struct dirent entry, char * suffix);
+bool validate_file_with_suffix(const char * name, const suffix_trie_t * suffixes);
 bool validate_file_with_permission(struct stat inode, char * permission);
 // parse files
-int parse_file_header(int fd, struct header * sf_header, enum invalid_sf_field * failure_src);
-void perform_op_parse(int nr_parameters, char ** parameters);
+int parse_file_header(int fd, sf_file_header_t * sf_header, sf_invalid_field_t * failure_src);
+int parse_file_header_with_cache(int fd, sf_cache_t * cache, sf_file_header_t * sf_header, sf_invalid_field_t * failure_src);
+int open_sf_file(struct op_env * env, const char * path, sf_cache_t * cache, int * fd, sf_file_header_t * sf_header, sf_invalid_field_t * failure_src, file_table_entry_t ** entry);
+void close_sf_file(struct op_env * env, int fd, file_table_entry_t * entry);
+void perform_op_parse(int nr_parameters, char ** parameters, struct op_env * env);
 // extract lines
-int extract_line(int fd, struct header * sf_header, int section_nr, int line_nr, char ** line,int * buf_size,enum invalid_sf_extract_param * failure_src);
-void perform_op_extract(int nr_parameters, char ** parameters);
+int locate_line(int fd, sf_file_header_t * sf_header, int section_nr, int line_nr, const char * index_dir, off_t * line_start, size_t * line_length, enum invalid_sf_extract_param * failure_src);
+int extract_line(int fd, sf_file_header_t * sf_header, int section_nr, int line_nr, const char * index_dir, char ** line,int * buf_size,enum invalid_sf_extract_param * failure_src);
+void perform_op_extract(int nr_parameters, char ** parameters, struct op_env * env);
+const char * extract_error_message(int return_value, enum invalid_sf_extract_param failure_src);
+int read_extract_queries(FILE * input, struct extract_query ** queries, size_t * nr_queries);
+int compare_extract_queries(const void * a, const void * b);
+void answer_extract_queries(struct extract_query ** sorted, size_t nr_queries, const char * index_dir, struct op_env * env);
+void perform_op_extract_batch(const char * queries_path, const char * index_dir, struct op_env * env);
+// rewrite a file in the SFv2 layout
+void perform_op_convert(int nr_parameters, char ** parameters, struct op_env * env);
 // filter lines
-int validate_file_with_filter(char * file_path, bool *valid);
-int count_lines(int fd, struct header * sf_header, int section_nr,long * line_count);
+int validate_file_with_filter(int dir_fd, const char * file_name, const struct stat * inode, sf_cache_t * cache, visited_set_t * seen, bool *valid);
+// answer several list/findall queries with a single walk
+int read_multi_query(char * text, bool absolute_paths, struct multi_query * query);
+bool append_expr_text(char * text, size_t size, const char * format, ...);
+int read_multi_queries(const char * queries_path, bool absolute_paths, struct multi_query ** queries, size_t * nr_queries);
+int multi_visit_entry(walk_entry_t * entry, void * arg);
+void perform_op_multi(int nr_parameters, char ** parameters, struct op_env * env);
+// serve the operations over a unix socket
+void run_op(int nr_parameters, char ** parameters, struct op_env * env);
+void answer_query(int nr_parameters, char ** parameters, out_writer_t * output, void * arg);
+bool is_relative_path_option(const char * parameter);
+int validate_watched_file(const char * path, bool * valid, void * arg);
+void perform_op_serve(int nr_parameters, char ** parameters, struct op_env * env);
+void perform_op_query(int nr_parameters, char ** parameters, struct op_env * env);
 
 int main(int argc, char **argv){
-    if(argc >= 2){
-        if(strcmp(argv[1], OP_VARIANT) == 0)
-            printf("41938\n");
-        else if(strcmp(argv[1],OP_LIST) == 0)
-            perform_op_list(argc,argv,false);
-        else if(strcmp(argv[1],OP_PARSE) == 0)
-            perform_op_parse(argc,argv);
-        else if(strcmp(argv[1],OP_EXTRACT) == 0)
-            perform_op_extract(argc,argv);
-        else if(strcmp(argv[1],OP_FILTER) == 0)
-            perform_op_list(argc,argv,true);
+    out_writer_t output;
+    if(writer_init(&output,STDOUT_FILENO) != SUCCESS)
+        return 1;
+    struct op_env env = {.output = &output,.files = NULL,.watch = NULL};
+    if(argc >= 2 && strcmp(argv[1],OP_SERVE) == 0)
+        perform_op_serve(argc,argv,&env);
+    else if(argc >= 2 && strcmp(argv[1],OP_QUERY) == 0)
+        perform_op_query(argc,argv,&env);
+    else {
+        // --stats[=text|json] may appear among the options, it is taken out before the operation parses them
+        bool stats = false;
+        bool stats_json = false;
+        for(int i=2;i<argc;i++) {
+            if(strcmp(argv[i],"--stats") == 0 || strncmp(argv[i],"--stats=",strlen("--stats=")) == 0) {
+                stats = true;
+                stats_json = strcmp(argv[i],"--stats=json") == 0;
+                // the terminating NULL moves along
+                memmove(argv + i,argv + i + 1,sizeof(char*) * (argc - i));
+                argc--;
+                i--;
+            }
+        }
+        if(stats)
+            stats_enable();
+        run_op(argc,argv,&env);
+        if(stats) {
+            // the report goes to stderr, after the whole result, so the output stays the same
+            writer_flush(&output);
+            stats_report(stderr,argv[1],stats_json);
+        }
     }
+    writer_close(&output);
     return 0;
 }
 
+void run_op(int nr_parameters, char ** parameters, struct op_env * env) {
+    if(nr_parameters >= 2){
+        if(strcmp(parameters[1], OP_VARIANT) == 0)
+            writer_printf(env->output,"41938\n");
+        else if(strcmp(parameters[1],OP_LIST) == 0)
+            perform_op_list(nr_parameters,parameters,false,env);
+        else if(strcmp(parameters[1],OP_PARSE) == 0)
+            perform_op_parse(nr_parameters,parameters,env);
+        else if(strcmp(parameters[1],OP_EXTRACT) == 0)
+            perform_op_extract(nr_parameters,parameters,env);
+        else if(strcmp(parameters[1],OP_FILTER) == 0)
+            perform_op_list(nr_parameters,parameters,true,env);
+        else if(strcmp(parameters[1],OP_MULTI) == 0)
+            perform_op_multi(nr_parameters,parameters,env);
+        else if(strcmp(parameters[1],OP_CONVERT) == 0)
+            perform_op_convert(nr_parameters,parameters,env);
+    }
+}
+
+void answer_query(int nr_parameters, char ** parameters, out_writer_t * output, void * arg) {
+    // each request gets its own output, the rest of the state is shared by all of them
+    struct op_env env = *(struct op_env*)arg;
+    env.output = output;
+    for(int i=2;i<nr_parameters;i++) {
+        if(is_relative_path_option(parameters[i])) {
+            writer_printf(output,"ERROR\nThe server only accepts absolute paths.\n");
+            return;
+        }
+    }
+    run_op(nr_parameters,parameters,&env);
+}
 
-void perform_op_list(int nr_parameters, char ** parameters, bool filter) {
-    char ** dir_elements;
-    int elem_count = 0;
-    int max_nr_elements = 0;
+bool is_relative_path_option(const char * parameter) {
+    const char * value = strchr(parameter,'=');
+    if(value == NULL || value[1] == '/' || strcmp(value + 1,"-") == 0)
+        return false;
+    for(size_t i=0;i<sizeof(path_options) / sizeof(path_options[0]);i++) {
+        if(strlen(path_options[i]) == (size_t)(value - parameter) && strncmp(parameter,path_options[i],value - parameter) == 0)
+            return true;
+    }
+    return false;
+}
+
+int validate_watched_file(const char * path, bool * valid, void * arg) {
+    (void)arg;
+    return validate_file_with_filter(AT_FDCWD,path,NULL,NULL,NULL,valid);
+}
+
+void perform_op_serve(int nr_parameters, char ** parameters, struct op_env * env) {
     int return_value = SUCCESS;
-    struct list_op_parameters detected = {.path=false,.permission=false,.recursive=false,.suffix=false};
+    char socket_path[MAX_PATH_SIZE+1];
+    bool path = false;
+    int nr_threads = 4;
+    file_table_t files;
+    char watch_path[MAX_PATH_SIZE+1];
+    bool watch = false;
+    struct op_env shared = {.output = NULL,.files = &files,.watch = NULL};
+
+    for(int i=2;i<nr_parameters;i++) {
+        char * saveptr;
+        char * filter_option = strtok_r(parameters[i],"=",&saveptr);
+        char * filter_value = parameters[i] + strlen(filter_option) + 1;
+        if(strcmp(filter_option,"socket") == 0) {
+            // detected the path of the unix socket
+            strncpy(socket_path,filter_value,MAX_PATH_SIZE);
+            socket_path[MAX_PATH_SIZE] = '\0';
+            path = true;
+        }else if(strcmp(filter_option,"threads") == 0) {
+            // detected the number of requests answered at the same time
+            nr_threads = strtol(filter_value,NULL,10);
+        }else if(strcmp(filter_option,"watch") == 0) {
+            // detected the tree whose findall result is kept current; the requests name it by an absolute path,
+            // so a relative one is completed the way the query operation completes the paths of its client
+            char cwd[MAX_PATH_SIZE+1];
+            int length = filter_value[0] == '/' ? snprintf(watch_path,sizeof(watch_path),"%s",filter_value)
+                       : getcwd(cwd,sizeof(cwd)) == NULL ? -1 : snprintf(watch_path,sizeof(watch_path),"%s/%s",cwd,filter_value);
+            if(length < 0 || (size_t)length >= sizeof(watch_path)) {
+                return_value = ERR_INVALID_PATH;
+                goto display_error_messages;
+            }
+            watch = true;
+        }
+    }
+    if(!path || nr_threads < 1 || nr_threads > MAX_NR_THREADS) {
+        return_value = ERR_INVALID_ARGUMENTS;
+        goto display_error_messages;
+    }
+    return_value = file_table_init(&files,FILE_TABLE_SIZE,&sf_rules);
+    if(return_value != SUCCESS)
+        goto display_error_messages;
+    if(watch) {
+        return_value = findall_watch_start(&shared.watch,watch_path,validate_watched_file,NULL);
+        if(return_value != SUCCESS) {
+            file_table_destroy(&files);
+            goto display_error_messages;
+        }
+    }
+    return_value = serve_queries(socket_path,nr_threads,answer_query,&shared);
+    findall_watch_stop(shared.watch);
+    file_table_destroy(&files);
+
+    display_error_messages:
+    if(return_value != SUCCESS) {
+        writer_printf(env->output,"ERROR\n");
+        if (return_value == ERR_INVALID_ARGUMENTS)
+            writer_printf(env->output," USAGE: serve socket=<socket_path> [threads=<nr_threads>] [watch=<dir_path>]\nThe order of the options is not relevant.\n");
+        if (return_value == ERR_INVALID_PATH)
+            writer_printf(env->output,"Invalid socket or watched directory path\n");
+        if (return_value == ERR_ALLOCATING_MEMORY)
+            writer_printf(env->output,"Error allocating memory for the open files.\n");
+    }
+}
+
+void perform_op_query(int nr_parameters, char ** parameters, struct op_env * env) {
+    int return_value = SUCCESS;
+    char * request[MAX_REQUEST_PARAMETERS];
+    char rewritten[MAX_REQUEST_SIZE];
+    size_t size = 0;
+    char cwd[MAX_PATH_SIZE+1];
+
+    // query socket=<socket_path> <operation> <options>: everything after the socket is the request
+    if(nr_parameters < 4 || strncmp(parameters[2],"socket=",strlen("socket=")) != 0 || nr_parameters - 3 > MAX_REQUEST_PARAMETERS) {
+        return_value = ERR_INVALID_ARGUMENTS;
+        goto display_error_messages;
+    }
+    // the relative paths are completed here, they are relative to the client's working directory and not to the server's
+    for(int i=3;i<nr_parameters;i++) {
+        request[i-3] = parameters[i];
+        if(!is_relative_path_option(parameters[i]))
+            continue;
+        if(size == 0 && getcwd(cwd,sizeof(cwd)) == NULL) {
+            return_value = ERR_MISSING_PATH;
+            goto display_error_messages;
+        }
+        size_t key_length = strchr(parameters[i],'=') - parameters[i];
+        int length = snprintf(rewritten + size,sizeof(rewritten) - size,"%.*s=%s/%s",(int)key_length,parameters[i],cwd,parameters[i] + key_length + 1);
+        if(length < 0 || (size_t)length >= sizeof(rewritten) - size || (size_t)length - key_length - 1 > MAX_PATH_SIZE) {
+            return_value = ERR_MISSING_PATH;
+            goto display_error_messages;
+        }
+        request[i-3] = rewritten + size;
+        size += length + 1;
+    }
+    writer_flush(env->output);
+    return_value = send_query(parameters[2] + strlen("socket="),nr_parameters - 3,request,env->output->fd);
+
+    display_error_messages:
+    if(return_value != SUCCESS) {
+        writer_printf(env->output,"ERROR\n");
+        if (return_value == ERR_INVALID_ARGUMENTS)
+            writer_printf(env->output," USAGE: query socket=<socket_path> <operation> <options>\n");
+        if (return_value == ERR_INVALID_PATH)
+            writer_printf(env->output,"No server is listening on the socket\n");
+        if (return_value == ERR_MISSING_PATH)
+            writer_printf(env->output,"A relative path is too long once made absolute\n");
+        if (return_value == ERR_READING_FILE || return_value == ERR_WRITING_OUTPUT)
+            writer_printf(env->output,"The connection to the server was lost.\n");
+    }
+}
+
+void perform_op_list(int nr_parameters, char ** parameters, bool filter, struct op_env * env) {
+    int nr_threads = 1;
+    int pipeline_threads[2] = {1, 1};
+    int return_value = SUCCESS;
+    struct list_op_parameters detected = {.path=false,.permission=false,.recursive=false,.suffix=false,.threads=false,.cache=false,.uring=false,.pipeline=false,.layout=false};
     char dir_path[MAX_PATH_SIZE+1];
-    char suffix[MAX_NAME_SIZE+1];
+    char cache_path[MAX_PATH_SIZE+1];
+    sf_cache_t * cache = NULL;
+    suffix_trie_t * suffixes = NULL;
+    filter_expr_t * expr = NULL;
+    char expr_text[MAX_LINE_LENGTH] = "";
     char permission[10];
 
     if(nr_parameters < 3) {
@@ -118,57 +393,117 @@ void perform_op_list(int nr_parameters, char ** parameters, bool filter) {
         if (strcmp(parameters[i], "recursive") == 0)
             detected.recursive = true;
         else {
-            char * filter_option = strtok(parameters[i],"=");
+            char * saveptr;
+            char * filter_option = strtok_r(parameters[i],"=",&saveptr);
             char * filter_value = parameters[i] + strlen(filter_option) + 1;
             if(strcmp(filter_option,"path") == 0) {
                 // detected path argument
                 strcpy(dir_path,filter_value);
                 detected.path = true;
             }else if(strcmp(filter_option,"name_ends_with") == 0) {
-                // detected filter option for suffix
-                strcpy(suffix,filter_value);
+                // detected filter option for suffix, repeated options match any of the suffixes
+                if(suffixes == NULL && suffix_trie_init(&suffixes) != SUCCESS) {
+                    return_value = ERR_ALLOCATING_MEMORY;
+                    goto display_error_messages;
+                }
+                if(suffix_trie_add(suffixes,filter_value) != SUCCESS) {
+                    return_value = ERR_ALLOCATING_MEMORY;
+                    goto display_error_messages;
+                }
                 detected.suffix = true;
             }else if(strcmp(filter_option,"permissions") == 0) {
                 // detected filter option for permission
                 strcpy(permission,filter_value);
                 detected.permission = true;
+            }else if(strcmp(filter_option,"threads") == 0) {
+                // detected the number of threads walking the tree
+                nr_threads = strtol(filter_value,NULL,10);
+                detected.threads = true;
+            }else if(strcmp(filter_option,"cache") == 0) {
+                // detected the file caching the sf metadata between runs
+                strncpy(cache_path,filter_value,MAX_PATH_SIZE);
+                cache_path[MAX_PATH_SIZE] = '\0';
+                detected.cache = true;
+            }else if(strcmp(filter_option,"io") == 0) {
+                // detected the way findall reads the files: "uring" or "sync"
+                detected.uring = strcmp(filter_value,"uring") == 0;
+            }else if(strcmp(filter_option,"pipeline") == 0) {
+                // detected the number of header and scan threads of a pipelined findall: "<header>,<scan>"
+                char * end;
+                pipeline_threads[0] = strtol(filter_value,&end,10);
+                pipeline_threads[1] = *end == ',' ? strtol(end + 1,NULL,10) : 0;
+                detected.pipeline = true;
+            }else if(strcmp(filter_option,"order") == 0) {
+                // detected the order findall reads the files in: "physical" (as stored on the disk) or "walk"
+                detected.layout = strcmp(filter_value,"physical") == 0;
+            }else if(strcmp(filter_option,"where") == 0) {
+                // detected a filter expression, all the repeated ones must hold; findall adds its own condition first
+                size_t length = strlen(expr_text);
+                int written = snprintf(expr_text + length,sizeof(expr_text) - length,"%s(%s)",length ? "&" : filter ? "type:f&lines=16&" : "",filter_value);
+                if(written < 0 || (size_t)written >= sizeof(expr_text) - length) {
+                    return_value = ERR_INVALID_ARGUMENTS;
+                    goto display_error_messages;
+                }
             }
         }
     }
+    if(expr_text[0]) {
+        return_value = filter_expr_compile(expr_text,&expr);
+        if(return_value != SUCCESS)
+            goto display_error_messages;
+    }
     if(!detected.path) {
         return_value = ERR_MISSING_PATH;
         goto display_error_messages;
     }
-    dir_elements = (char**)calloc(sizeof(char*),MAX_NR_ELEMENTS);
-
-    return_value = list_directory_tree(dir_path, dir_elements, &max_nr_elements,&elem_count,suffix,permission,detected,filter);
-    if(return_value == SUCCESS) {
-        printf("SUCCESS\n");
-        if(elem_count > 0) {
-            for(int i=0;i<elem_count;i++) {
-                printf("%s\n",dir_elements[i]);
-            }
-        }
+    if(detected.threads && (nr_threads < 1 || nr_threads > MAX_NR_THREADS)) {
+        return_value = ERR_INVALID_ARGUMENTS;
+        goto display_error_messages;
     }
-
-    // deallocate memory
-    for(int i=0;i<elem_count;i++) {
-        if(dir_elements[i] != NULL) {
-            free(dir_elements[i]);
+    for(int i=0;i<2 && detected.pipeline;i++) {
+        if(pipeline_threads[i] < 1 || pipeline_threads[i] > MAX_NR_THREADS) {
+            return_value = ERR_INVALID_ARGUMENTS;
+            goto display_error_messages;
         }
     }
-    free(dir_elements);
+    if(filter && expr == NULL && env->watch != NULL && findall_watch_covers(env->watch,dir_path)) {
+        // the server keeps the result of this tree current, nothing has to be read
+        writer_write_line(env->output, "SUCCESS");
+        findall_watch_write(env->watch,env->output);
+        goto clean_up;
+    }
+    // the cache only helps findall; a busy or unusable cache file is not an error, the files are just read again
+    if(detected.cache && filter && sf_cache_open(&cache, cache_path, &sf_rules) != SUCCESS)
+        cache = NULL;
+    // the elements are streamed after the status line, which is taken back if the walk fails before anything was flushed
+    writer_write_line(env->output, "SUCCESS");
+    return_value = list_directory_tree(dir_path, env->output,suffixes,permission,expr,detected,filter,nr_threads,pipeline_threads,cache);
+    sf_cache_close(cache);
+    if(return_value != SUCCESS && env->output->flushed > 0) {
+        // part of the result is already out, the error can only be reported on stderr
+        writer_flush(env->output);
+        fprintf(stderr, "ERROR\nThe listing stopped early (error %d).\n", return_value);
+        goto clean_up;
+    }
+    if(return_value != SUCCESS)
+        writer_discard(env->output);
 
     display_error_messages:
     if(return_value != SUCCESS) {
-        printf("ERROR\n");
+        writer_printf(env->output,"ERROR\n");
         if (return_value == ERR_INVALID_ARGUMENTS)
-            printf(" USAGE: list [recursive] <filtering_options> path=<dir_path> \nThe order of the options is not relevant.\n");
+            writer_printf(env->output," USAGE: list [recursive] <filtering_options> [threads=<nr_threads>] [cache=<cache_file>] [io=uring|sync] [pipeline=<header_threads>,<scan_threads>] [order=physical|walk] [where=<expression>] path=<dir_path> \nThe order of the options is not relevant.\n");
         if (return_value == ERR_MISSING_PATH)
-            printf("No directory path was specified.\n");
+            writer_printf(env->output,"No directory path was specified.\n");
         if (return_value == ERR_INVALID_PATH)
-            printf("Invalid directory path\n");
+            writer_printf(env->output,"Invalid directory path\n");
+        if (return_value == ERR_ALLOCATING_MEMORY)
+            writer_printf(env->output,"Error allocating memory for the filters.\n");
     }
+
+    clean_up:
+    suffix_trie_destroy(suffixes);
+    filter_expr_free(expr);
 }
 
 unsigned convert_permission_format(const char * permission) {
@@ -184,9 +519,9 @@ unsigned convert_permission_format(const char * permission) {
     return p_rights;
 }
 
-bool validate_file_with_suffix(struct dirent entry, char * suffix) {
-    // check suffix
-    return strstr(entry.d_name,suffix) && (strstr(entry.d_name,suffix) + strlen(suffix) == entry.d_name + strlen(entry.d_name));
+bool validate_file_with_suffix(const char * name, const suffix_trie_t * suffixes) {
+    // check suffix, comparing only the last characters of the name
+    return suffix_trie_match(suffixes,name,strlen(name));
 }
 bool validate_file_with_permission(struct stat inode, char * permission) {
     // check permission rights
@@ -194,154 +529,189 @@ bool validate_file_with_permission(struct stat inode, char * permission) {
     return (inode.st_mode & permission_binary_format) == permission_binary_format;
 }
 
-int list_directory_tree(char * dir_path, char ** dir_elements, int * max_nr_elements, int * elem_count, char * suffix, char * permission,struct list_op_parameters detected, bool filter){
-    DIR* dir;
-    struct dirent *entry;
-    struct stat inode;
-    char abs_entry_path[MAX_PATH_SIZE+1];
+int list_visit_entry(walk_entry_t * entry, void * arg) {
+    struct list_op_context * context = (struct list_op_context*)arg;
     int return_value = SUCCESS;
-    // open the directory
-    dir = opendir(dir_path);
-    if(dir == 0) {
-        return_value = ERR_INVALID_PATH;
-        goto clean_up;
+    bool condition;
+    if(context->filter && context->expr != NULL) {
+        // the findall condition is part of the expression, evaluated in the order of its plan
+        return_value = filter_expr_eval(context->expr, entry, &sf_rules, &condition);
+        if(return_value != SUCCESS)
+            return return_value;
+    }else if(context->filter) {
+        // filter the files with valid sf format and at least 1 section having exactly 16 lines
+        if(walk_entry_type(entry) != S_IFREG) {
+            // apply filter only to files
+            return SUCCESS;
+        }
+        condition = false;
+        if(context->layout != NULL) {
+            // the file is only collected, its inode number orders it if the file system can't map its blocks
+            return findall_layout_add(context->layout, entry->path, walk_entry_inode(entry));
+        }
+        // the cache is keyed by the inode, without it the file is not even stat-ed
+        const struct stat * inode = context->cache != NULL ? walk_entry_inode(entry) : NULL;
+        if(context->batch != NULL) {
+            // the batch outputs the file itself once it is validated
+            return findall_batch_add(context->batch, entry->path, inode);
+        }
+        if(context->pipeline != NULL) {
+            // the walk only queues the candidate, the stages validate and output it
+            return findall_pipeline_add(context->pipeline, entry->path, inode);
+        }
+        return_value = validate_file_with_filter(entry->dir_fd, entry->name, inode, context->cache, context->seen_files, &condition);
+        if (return_value != SUCCESS) {
+            return return_value;
+        }
+    }else {
+        // apply the suffix and permission filters on the elements if they are asserted,
+        // the name first: an element rejected by its name costs no system call at all
+        if (context->detected.suffix && !validate_file_with_suffix(entry->name, context->suffixes))
+            return SUCCESS;
+        condition = true;
+        // check permission rights
+        if (context->detected.permission) {
+            // the inode is only needed by this filter
+            const struct stat * inode = walk_entry_inode(entry);
+            if(inode == NULL)
+                return SUCCESS;
+            condition = validate_file_with_permission(*inode, context->permission);
+        }
+        // then the expression, which reads the file only if its cheaper predicates didn't decide
+        if (condition && context->expr != NULL) {
+            return_value = filter_expr_eval(context->expr, entry, &sf_rules, &condition);
+            if(return_value != SUCCESS)
+                return return_value;
+        }
     }
-    // iterate through the directory's content
-    while ((entry=readdir(dir)) != 0) {
-        // exclude the parent and current directory
-        if(strcmp(entry->d_name,"..") != 0 && strcmp(entry->d_name,".") != 0) {
-            // get the absolute path
-            snprintf(abs_entry_path, MAX_PATH_SIZE, "%s/%s", dir_path, entry->d_name);
-            abs_entry_path[MAX_PATH_SIZE]='\0';
-            // get details about the entry
-            lstat(abs_entry_path, &inode);
-            bool condition;
-            if(filter) {
-                // filter the files with valid sf format and at least 1 section having exactly 16 lines
-                if(S_ISREG(inode.st_mode)) {
-                    // apply filter only to files
-                    condition = false;
-                    return_value = validate_file_with_filter(abs_entry_path, &condition);
-                    if (return_value != SUCCESS) {
-                        goto clean_up;
-                    }
-                    // add element to the list if the required conditions are met
-                    if(condition) {
-                        dir_elements[*elem_count] = (char *) malloc(sizeof(char) * (MAX_PATH_SIZE + 1));
-                        strncpy(dir_elements[*elem_count], abs_entry_path, MAX_PATH_SIZE);
-                        (*elem_count)++;
-                    }
-                }
-            }else {
-                // apply the suffix or permission filters on the elements if they are asserted
-                condition = true;
-                // check suffix
-                if (detected.suffix)
-                    condition = validate_file_with_suffix(*entry, suffix);
-                // check permission rights
-                else if (detected.permission) {
-                    condition = validate_file_with_permission(inode, permission);
-                }
-                // add element to the list if the required conditions are met
-                if(condition) {
-                    dir_elements[*elem_count] = (char *) malloc(sizeof(char) * (MAX_PATH_SIZE + 1));
-                    strncpy(dir_elements[*elem_count], abs_entry_path, MAX_PATH_SIZE);
-                    (*elem_count)++;
-                }
-            }
+    // output the element if the required conditions are met
+    if(condition) {
+        return_value = writer_write_line(context->output, entry->path);
+    }
+    return return_value;
+}
 
-            if((detected.recursive || filter) && S_ISDIR(inode.st_mode)) {
-                // if it is a directory, then lists its contents too
-                int return_value_sub_fct = list_directory_tree(abs_entry_path, dir_elements, max_nr_elements,elem_count, suffix,
-                                                               permission, detected,filter);
-                if (return_value_sub_fct != SUCCESS) {
-                    return_value = return_value_sub_fct;
-                    goto clean_up;
-                }
-            }
+int list_directory_tree(char * dir_path, out_writer_t * output, suffix_trie_t * suffixes, char * permission, filter_expr_t * expr, struct list_op_parameters detected, bool filter, int nr_threads, int pipeline_threads[2], sf_cache_t * cache){
+    struct list_op_context context = {.output = output, .suffixes = suffixes,
+                                      .permission = permission, .expr = expr, .detected = detected, .filter = filter, .cache = cache, .batch = NULL, .pipeline = NULL, .layout = NULL, .seen_files = NULL};
+    // however findall validates the files, it skips the hard links to a file already validated
+    if(filter && expr == NULL && visited_set_init(&context.seen_files) != SUCCESS)
+        context.seen_files = NULL;
+    if(filter && detected.layout && expr == NULL) {
+        int return_value = findall_layout_init(&context.layout, &sf_rules, cache, context.seen_files);
+        if(return_value != SUCCESS) {
+            visited_set_destroy(context.seen_files);
+            return return_value;
         }
     }
-    clean_up:
-    // close the directory
-    if(dir > 0) {
-        closedir(dir);
+    if(filter && detected.pipeline && expr == NULL && context.layout == NULL) {
+        int return_value = findall_pipeline_init(&context.pipeline, &sf_rules, cache, context.seen_files, output, pipeline_threads[0], pipeline_threads[1]);
+        if(return_value != SUCCESS) {
+            visited_set_destroy(context.seen_files);
+            return return_value;
+        }
+    }
+    // without io_uring support the files are validated one by one
+    if(filter && detected.uring && expr == NULL && context.pipeline == NULL && context.layout == NULL
+       && findall_batch_init(&context.batch, &sf_rules, cache, context.seen_files, output) != SUCCESS)
+        context.batch = NULL;
+    // findall always looks into the subdirectories
+    int return_value = walk_directory_tree(dir_path, detected.recursive || filter, nr_threads, list_visit_entry, &context);
+    if(context.batch != NULL) {
+        if(return_value == SUCCESS)
+            return_value = findall_batch_flush(context.batch);
+        findall_batch_destroy(context.batch);
+    }
+    if(context.pipeline != NULL) {
+        // wait for the stages to drain the candidates already queued, even after a failed walk
+        int pipeline_status = findall_pipeline_finish(context.pipeline);
+        if(return_value == SUCCESS)
+            return_value = pipeline_status;
+        findall_pipeline_destroy(context.pipeline);
+    }
+    if(context.layout != NULL) {
+        if(return_value == SUCCESS)
+            return_value = findall_layout_run(context.layout, output);
+        findall_layout_destroy(context.layout);
     }
+    visited_set_destroy(context.seen_files);
     return return_value;
 }
 
-int parse_file_header(int fd, struct header * sf_header, enum invalid_sf_field * failure_src) {
-    int return_value = SUCCESS;
-    //initialize fields
-    sf_header->section_headers = NULL;
-    sf_header->no_of_sections=0;
-    sf_header->header_size=0;
-    sf_header->version=0;
-
-    lseek(fd,0,SEEK_SET);
-
-    int read_magic_nr_bytes = read(fd,sf_header->magic,4);
-    sf_header->magic[4] = '\0';
-    int read_header_size_nr_bytes = read(fd,&sf_header->header_size,2);
-    int read_version_nr_bytes = read(fd,&sf_header->version,2);
-    int read_no_of_sections_nr_bytes = read(fd,&sf_header->no_of_sections,1);
-
-    if(read_magic_nr_bytes < 0 || read_header_size_nr_bytes < 0 || read_version_nr_bytes < 0 || read_no_of_sections_nr_bytes < 0) {
-        return_value = ERR_READING_FILE;
-        goto finish;
-    }
+int parse_file_header(int fd, sf_file_header_t * sf_header, sf_invalid_field_t * failure_src) {
+    // the fixed header and the section headers are fetched with a single read
+    int return_value = scan_read_header(fd, &sf_rules, sf_header, failure_src);
+    if(return_value == SF_ERR_READING_FILE)
+        return ERR_READING_FILE;
+    if(return_value == SF_ERR_INVALID_FORMAT)
+        return ERR_INVALID_FILE_FORMAT;
+    return SUCCESS;
+}
 
-    *failure_src = NONE;
-    if (strcmp(sf_header->magic, magic_field) != 0) // check if magic field is invalid
-        *failure_src = MAGIC;
-    else if (sf_header->version < 47 || sf_header->version > 128) // check if version is invalid
-            *failure_src = VERSION;
-    else if (sf_header->no_of_sections < 3 || sf_header->no_of_sections > 17) // check if the number of sections is not in a valid range
-            *failure_src = SECT_NR;
+int parse_file_header_with_cache(int fd, sf_cache_t * cache, sf_file_header_t * sf_header, sf_invalid_field_t * failure_src) {
+    struct stat inode;
+    sf_cache_key_t key;
+    sf_cache_record_t record;
 
-    if(*failure_src != NONE) {
-        return_value = ERR_INVALID_FILE_FORMAT;
-        goto finish;
+    if(cache == NULL)
+        return parse_file_header(fd,sf_header,failure_src);
+    stats_add(STATS_CALLS_STAT,1);
+    if(fstat(fd,&inode) != 0)
+        return parse_file_header(fd,sf_header,failure_src);
+    sf_cache_key_from_stat(&inode,&key);
+    if(sf_cache_lookup(cache,&key,&record)) {
+        // the file didn't change since its header was parsed
+        *sf_header = record.sf_header;
+        *failure_src = record.failure_src;
+        return record.parse_status;
     }
-    sf_header->section_headers = (struct section_header*)malloc(sizeof(struct section_header)*sf_header->no_of_sections);
-    if(sf_header->section_headers == NULL) {
-        return_value = ERR_ALLOCATING_MEMORY;
-        goto finish;
+    int return_value = parse_file_header(fd,sf_header,failure_src);
+    if(return_value != ERR_READING_FILE) {
+        record.parse_status = return_value;
+        record.failure_src = *failure_src;
+        record.sf_header = *sf_header;
+        sf_cache_clear_line_counts(&record);
+        sf_cache_store(cache,&key,&record);
     }
+    return return_value;
+}
 
-    for(int i=0;i<sf_header->no_of_sections;i++) {
-        int read_sect_name_nr_bytes = read(fd,&sf_header->section_headers[i].sect_name,19);
-        sf_header->section_headers[i].sect_name[19] = '\0';
-        int read_sect_type_nr_bytes = read(fd,&sf_header->section_headers[i].sect_type,4);
-        int read_sect_offset_nr_bytes = read(fd,&sf_header->section_headers[i].sect_offset,4);
-        int read_sect_size_nr_bytes = read(fd,&sf_header->section_headers[i].sect_size,4);
-
-        if(read_sect_size_nr_bytes < 0 || read_sect_offset_nr_bytes < 0 || read_sect_type_nr_bytes < 0 || read_sect_name_nr_bytes < 0) {
-            return_value = ERR_READING_FILE;
-            goto finish;
-        }
-        // check if the section type is valid
-        bool valid_type = false;
-        for(int j=0;j<sizeof(sect_types);j++) {
-            if(sf_header->section_headers[i].sect_type == sect_types[j]) {
-                valid_type = true;
-            }
-        }
-        if(!valid_type) {
-            *failure_src = SECT_TYPE;
-            return_value = ERR_INVALID_FILE_FORMAT;
-            break;
+int open_sf_file(struct op_env * env, const char * path, sf_cache_t * cache, int * fd, sf_file_header_t * sf_header, sf_invalid_field_t * failure_src, file_table_entry_t ** entry) {
+    *entry = NULL;
+    if(env->files != NULL) {
+        // the server keeps the descriptor and the header while the file doesn't change
+        int return_value = file_table_acquire(env->files,path,entry);
+        if(return_value != SUCCESS) {
+            *fd = -1;
+            return return_value;
         }
+        *fd = (*entry)->fd;
+        *sf_header = (*entry)->sf_header;
+        *failure_src = (*entry)->failure_src;
+        return (*entry)->parse_status;
     }
-    finish:
-    return return_value;
+    *fd = open(path,O_RDONLY);
+    stats_add(STATS_CALLS_OPEN,1);
+    if(*fd < 0)
+        return ERR_INVALID_PATH;
+    // parse file's header, or take it from the cache if the file didn't change
+    return parse_file_header_with_cache(*fd,cache,sf_header,failure_src);
 }
 
+void close_sf_file(struct op_env * env, int fd, file_table_entry_t * entry) {
+    if(entry != NULL)
+        file_table_release(env->files,entry);
+    else if(fd >= 0)
+        close(fd);
+}
 
-void perform_op_parse(int nr_parameters, char ** parameters){
+void perform_op_parse(int nr_parameters, char ** parameters, struct op_env * env){
     int return_value = SUCCESS;
-    struct header sf_header;
+    sf_file_header_t sf_header;
     int fd;
     char file_path[MAX_PATH_SIZE+1];
+    char cache_path[MAX_PATH_SIZE+1];
+    sf_cache_t * cache = NULL;
     bool path = false;
 
     if(nr_parameters < 3) {
@@ -349,153 +719,142 @@ void perform_op_parse(int nr_parameters, char ** parameters){
         goto display_error_messages;
     }
     for(int i=2;i<nr_parameters;i++) {
-            char * filter_option = strtok(parameters[i],"=");
+            char * saveptr;
+            char * filter_option = strtok_r(parameters[i],"=",&saveptr);
             char * filter_value = parameters[i] + strlen(filter_option) + 1;
             if(strcmp(filter_option,"path") == 0) {
                 // detected path argument
                 strcpy(file_path,filter_value);
                 path = true;
+            }else if(strcmp(filter_option,"cache") == 0) {
+                // detected the file caching the sf metadata between runs
+                strncpy(cache_path,filter_value,MAX_PATH_SIZE);
+                cache_path[MAX_PATH_SIZE] = '\0';
+                if(cache == NULL && sf_cache_open(&cache,cache_path,&sf_rules) != SUCCESS)
+                    cache = NULL;
             }
         }
     if(!path) {
         return_value = ERR_MISSING_PATH;
         goto display_error_messages;
     }
-    fd = open(file_path,O_RDONLY);
-    if(fd < 0) {
-        return_value = ERR_INVALID_PATH;
+    file_table_entry_t * entry;
+    sf_invalid_field_t failure_src;
+    return_value = open_sf_file(env,file_path,cache,&fd,&sf_header,&failure_src,&entry);
+    if(fd < 0)
         goto display_error_messages;
-    }
-
-    enum invalid_sf_field failure_src;
-    // parse file's header
-    return_value = parse_file_header(fd,&sf_header,&failure_src);
 
     if(return_value == SUCCESS) {
-        printf("SUCCESS\n");
-        printf("version=%d\n",sf_header.version);
-        printf("nr_sections=%d\n",sf_header.no_of_sections);
-        for(int i=0;i<sf_header.no_of_sections;i++) {
-            printf("section%d: %s %d %d\n",i+1,
-                   sf_header.section_headers[i].sect_name,
-                   sf_header.section_headers[i].sect_type,
-                   sf_header.section_headers[i].sect_size);
+        writer_printf(env->output,"SUCCESS\n");
+        writer_printf(env->output,"version=%d\n",sf_header.header.version);
+        writer_printf(env->output,"nr_sections=%d\n",sf_header.header.no_of_sections);
+        for(int i=0;i<sf_header.header.no_of_sections;i++) {
+            writer_printf(env->output,"section%d: %.*s %d %d\n",i+1,
+                   (int)sizeof(sf_header.sections[i].sect_name),sf_header.sections[i].sect_name,
+                   sf_header.sections[i].sect_type,
+                   sf_header.sections[i].sect_size);
         }
     }
 
-    if (sf_header.section_headers != NULL) {
-        free(sf_header.section_headers);
-    }
-
-    if(fd > 0)
-        close(fd);
+    close_sf_file(env,fd,entry);
 
     display_error_messages:
+    sf_cache_close(cache);
 
     if(return_value != SUCCESS) {
-        printf("ERROR\n");
+        writer_printf(env->output,"ERROR\n");
         if (return_value == ERR_MISSING_ARGUMENTS)
-            printf("USAGE: parse  path=<file_path> \nThe order of the options is not relevant.\n");
+            writer_printf(env->output,"USAGE: parse  path=<file_path> [cache=<cache_file>] \nThe order of the options is not relevant.\n");
         if (return_value == ERR_MISSING_PATH)
-            printf("No file path was specified.\n");
+            writer_printf(env->output,"No file path was specified.\n");
         if (return_value == ERR_INVALID_PATH)
-            printf("Invalid file path\n");
+            writer_printf(env->output,"Invalid file path\n");
         if (return_value == ERR_READING_FILE)
-            printf("Error reading from file.\n");
+            writer_printf(env->output,"Error reading from file.\n");
         if (return_value == ERR_INVALID_LINE_ENDING)
-            printf("Invalid line ending.\n");
+            writer_printf(env->output,"Invalid line ending.\n");
         if (return_value == ERR_INVALID_FILE_FORMAT) {
-            printf("wrong ");
-            if(failure_src == MAGIC)
-                printf("magic");
-            else if(failure_src == VERSION)
-                printf("version");
-            else if(failure_src == SECT_NR)
-                printf("sect_nr");
-            else if(failure_src == SECT_TYPE)
-                printf("sect_types");
-            printf("\n");
+            writer_printf(env->output,"wrong ");
+            if(failure_src == SF_WRONG_MAGIC)
+                writer_printf(env->output,"magic");
+            else if(failure_src == SF_WRONG_VERSION)
+                writer_printf(env->output,"version");
+            else if(failure_src == SF_WRONG_SECT_NR)
+                writer_printf(env->output,"sect_nr");
+            else if(failure_src == SF_WRONG_SECT_TYPE)
+                writer_printf(env->output,"sect_types");
+            writer_printf(env->output,"\n");
         }
     }
 }
 
-int extract_line(int fd, struct header * sf_header, int section_nr, int line_nr, char ** line, int * buf_size,enum invalid_sf_extract_param * failure_src){
+int locate_line(int fd, sf_file_header_t * sf_header, int section_nr, int line_nr, const char * index_dir, off_t * line_start, size_t * line_length, enum invalid_sf_extract_param * failure_src){
     int return_value = SUCCESS;
     *failure_src = NONE_P;
 
-    if(section_nr > sf_header->no_of_sections) {
+    if(section_nr < 1 || section_nr > sf_header->header.no_of_sections) {
         *failure_src = SECTION;
-        return_value = ERR_INVALID_ARGUMENTS;
-        goto finish;
+        return ERR_INVALID_ARGUMENTS;
     }
-    if(lseek(fd,sf_header->section_headers[section_nr-1].sect_offset,SEEK_SET) < 0) {
-        return_value = ERR_READING_FILE;
-        goto finish;
+    sect_header_t * section = &sf_header->sections[section_nr-1];
+    bool found;
+    struct stat inode;
+    long line_nrs[1] = {line_nr};
+    // an SFv2 file has the line starts of its sections in its own line tables
+    bool indexed = sf_v2_find_lines(fd,sf_header,section_nr-1,line_nrs,1,line_start,line_length,&found) == SUCCESS;
+    if(!indexed && index_dir != NULL && fstat(fd,&inode) == 0) {
+        // jump straight to the line through the section's line-offset index (built on the first use)
+        indexed = line_index_locate(index_dir,fd,&inode,section_nr,section,line_nr,line_start,line_length,&found) == SUCCESS;
     }
-
-    int max_buf_size = sf_header->section_headers[section_nr-1].sect_size;
-    char * buf = (char*)malloc(sizeof(char)*(max_buf_size+1));
-    if(buf == NULL) {
-        return_value = ERR_ALLOCATING_MEMORY;
-        goto clean_up;
+    if(!indexed) {
+        // no (usable) index: stream the section until the end of the requested line
+        return_value = scan_find_line(fd,section->sect_offset,section->sect_size,line_nr,line_start,line_length,&found);
     }
-    int ch_read;
-    if(lseek(fd,sf_header->section_headers[section_nr-1].sect_offset,SEEK_SET) < 0) {
-        return_value = ERR_READING_FILE;
-        goto clean_up;
+    if(return_value != SUCCESS)
+        return return_value;
+    if(!found) {
+        *failure_src = LINE;
+        return ERR_INVALID_ARGUMENTS;
     }
-    // read the whole section
-    if((ch_read = read(fd,buf,max_buf_size)) == -1) {
-        return_value = ERR_READING_FILE;
-        goto clean_up;
-    }
-    buf[ch_read] = '\0';
+    return SUCCESS;
+}
 
-    int line_count = 1;
-    char * p = strtok(buf,"\n");
-    while(p != NULL && line_count < line_nr) {
-        p = strtok(NULL,"\n");
-        line_count++;
-    }
-    if(line_count == line_nr) {
-        if(p != NULL) {
-            *buf_size = strlen(p);
-            *line = (char*)realloc(*line,(*buf_size)*sizeof(char));
-            if(*line == NULL) {
-                return_value = ERR_ALLOCATING_MEMORY;
-                goto clean_up;
-            }
-            strncpy(*line,p,*buf_size);
-        }
-    }else if(line_count < line_nr){
-        return_value = ERR_INVALID_ARGUMENTS;
+int extract_line(int fd, sf_file_header_t * sf_header, int section_nr, int line_nr, const char * index_dir, char ** line, int * buf_size,enum invalid_sf_extract_param * failure_src){
+    off_t line_start;
+    size_t line_length;
+    int return_value = locate_line(fd,sf_header,section_nr,line_nr,index_dir,&line_start,&line_length,failure_src);
+    if(return_value != SUCCESS)
+        goto finish;
+    // only the line itself is kept in memory
+    *line = (char*)realloc(*line,(line_length + 1)*sizeof(char));
+    if(*line == NULL) {
+        return_value = ERR_ALLOCATING_MEMORY;
+        goto finish;
     }
-    clean_up:
-    if(buf != NULL) {
-        free(buf);
+    if(scan_read_fully(fd,*line,line_length,line_start) != (ssize_t)line_length) {
+        return_value = ERR_READING_FILE;
+        goto finish;
     }
+    *buf_size = line_length;
     finish:
     return return_value;
 }
-void perform_op_extract(int nr_parameters, char ** parameters) {
+void perform_op_extract(int nr_parameters, char ** parameters, struct op_env * env) {
     int return_value = SUCCESS;
-    struct header sf_header;
+    sf_file_header_t sf_header;
     int fd;
     char file_path[MAX_PATH_SIZE+1];
     int section_nr;
     int line_nr;
-    char * line;
+    char index_dir[MAX_PATH_SIZE+1];
+    char queries_path[MAX_PATH_SIZE+1];
 
-    struct extract_op_parameters detected = {.path = false,.file = false,.section = false,.line=false};
+    struct extract_op_parameters detected = {.path = false,.file = false,.section = false,.line=false,.index=false,.queries=false};
     enum invalid_sf_extract_param failure_src = NONE_P;
 
-    if(nr_parameters < 5) {
-        return_value = ERR_MISSING_ARGUMENTS;
-        goto display_error_messages;
-    }
-
     for(int i=2;i<nr_parameters;i++) {
-        char * filter_option = strtok(parameters[i],"=");
+        char * saveptr;
+        char * filter_option = strtok_r(parameters[i],"=",&saveptr);
         char * filter_value = parameters[i] + strlen(filter_option) + 1;
         if(strcmp(filter_option,"path") == 0) {
             // present path argument
@@ -509,143 +868,720 @@ void perform_op_extract(int nr_parameters, char ** parameters) {
             // present line nr argument
             line_nr = strtoul(filter_value,NULL,10);
             detected.line = true;
+        }else if(strcmp(filter_option,"index") == 0) {
+            // directory keeping the line-offset indexes of the sections
+            strcpy(index_dir,filter_value);
+            detected.index = true;
+        }else if(strcmp(filter_option,"queries") == 0) {
+            // file with one query per line ("-" for the standard input)
+            strcpy(queries_path,filter_value);
+            detected.queries = true;
         }
     }
+    if(detected.queries) {
+        perform_op_extract_batch(queries_path,detected.index ? index_dir : NULL,env);
+        return;
+    }
     if(!detected.path || !detected.section || !detected.line) {
         return_value = ERR_MISSING_ARGUMENTS;
         goto display_error_messages;
     }
 
-    fd = open(file_path,O_RDONLY);
-    if(fd < 0) {
-        return_value = ERR_INVALID_PATH;
+    file_table_entry_t * entry;
+    sf_invalid_field_t failure_src_sf_fields;
+    return_value = open_sf_file(env,file_path,NULL,&fd,&sf_header,&failure_src_sf_fields,&entry);
+    if(fd < 0)
         goto display_error_messages;
-    }
 
-    enum invalid_sf_field failure_src_sf_fields;
-    // parse file's header
-    return_value = parse_file_header(fd,&sf_header,&failure_src_sf_fields);
-
-    if(return_value == ERR_INVALID_FILE_FORMAT && failure_src_sf_fields > NONE) {
+    if(return_value == ERR_INVALID_FILE_FORMAT && failure_src_sf_fields > SF_VALID) {
             failure_src = FILE_FORMAT;
             goto clean_up;
     }
 
     // get size of file
     int file_size = lseek(fd,0,SEEK_END);
-    if(file_size > 0 && sf_header.section_headers[section_nr-1].sect_offset > file_size) {
+    if(file_size > 0 && section_nr >= 1 && section_nr <= sf_header.header.no_of_sections
+       && sf_header.sections[section_nr-1].sect_offset > file_size) {
         failure_src = FILE_FORMAT;
         return_value = ERR_INVALID_FILE_FORMAT;
         goto clean_up;
     }
 
-    int buf_size = 0;
-    line = (char*)malloc(sizeof(char));
-    return_value = extract_line(fd,&sf_header,section_nr,line_nr,&line,&buf_size,&failure_src);
+    off_t line_start;
+    size_t line_length;
+    return_value = locate_line(fd,&sf_header,section_nr,line_nr,detected.index ? index_dir : NULL,&line_start,&line_length,&failure_src);
 
-    if(return_value == SUCCESS && line != NULL) {
-        printf("SUCCESS\n");
-        for(int i=buf_size-1;i>=0;i--) {
-            printf("%c",line[i]);
+    if(return_value == SUCCESS) {
+        // the line is read straight into the output buffer, after SUCCESS, and reversed there in place
+        size_t header_length = strlen("SUCCESS\n");
+        char * out = writer_reserve(env->output,header_length + line_length + 1);
+        if(out == NULL) {
+            return_value = ERR_ALLOCATING_MEMORY;
+        }else if(scan_read_fully(fd,out + header_length,line_length,line_start) != (ssize_t)line_length) {
+            writer_commit(env->output,0);
+            return_value = ERR_READING_FILE;
+        }else {
+            memcpy(out,"SUCCESS\n",header_length);
+            reverse_bytes(out + header_length,out + header_length,line_length);
+            out[header_length + line_length] = '\n';
+            writer_commit(env->output,header_length + line_length + 1);
         }
-        printf("\n");
     }
-    if(line != NULL)
-        free(line);
 
     clean_up:
-    if(fd > 0)
-        close(fd);
-    if(sf_header.section_headers != NULL)
-        free(sf_header.section_headers);
+    close_sf_file(env,fd,entry);
 
     display_error_messages:
     if(return_value != SUCCESS) {
-        printf("ERROR\n");
+        writer_printf(env->output,"ERROR\n");
         if (return_value == ERR_MISSING_ARGUMENTS)
-            printf(" USAGE: extract  path=<file_path> section=<section_nr> line=<line_nr>\nThe order of the options is not relevant.\n");
-        if (return_value == ERR_INVALID_PATH)
-            printf("Invalid file path\n");
-        if (return_value == ERR_READING_FILE)
-            printf("Error reading from file.\n");
-        if (return_value == ERR_ALLOCATING_MEMORY)
-            printf("Error allocating memory for line buffer.\n");
-        if (return_value == ERR_INVALID_LINE_ENDING)
-            printf("Invalid line ending.\n");
-        if (return_value == ERR_INVALID_FILE_FORMAT || return_value == ERR_INVALID_ARGUMENTS) {
-            printf("invalid ");
-            if (failure_src == FILE_FORMAT)
-                printf("file");
-            else if (failure_src == SECTION)
-                printf("section");
-            else if (failure_src == LINE)
-                printf("line");
-            printf("\n");
+            writer_printf(env->output," USAGE: extract  path=<file_path> section=<section_nr> line=<line_nr> [index=<index_dir>]\n        extract  queries=<queries_file|-> [index=<index_dir>]\nThe order of the options is not relevant.\n");
+        else
+            writer_printf(env->output,"%s\n",extract_error_message(return_value,failure_src));
+    }
+}
+
+const char * extract_error_message(int return_value, enum invalid_sf_extract_param failure_src) {
+    if (return_value == ERR_INVALID_PATH)
+        return "Invalid file path";
+    if (return_value == ERR_READING_FILE)
+        return "Error reading from file.";
+    if (return_value == ERR_ALLOCATING_MEMORY)
+        return "Error allocating memory for line buffer.";
+    if (return_value == ERR_INVALID_LINE_ENDING)
+        return "Invalid line ending.";
+    if (return_value == ERR_MISSING_ARGUMENTS)
+        return "invalid query";
+    if (failure_src == FILE_FORMAT)
+        return "invalid file";
+    if (failure_src == SECTION)
+        return "invalid section";
+    if (failure_src == LINE)
+        return "invalid line";
+    return "invalid ";
+}
+
+int read_extract_queries(FILE * input, struct extract_query ** queries, size_t * nr_queries) {
+    size_t capacity = 64;
+    char * text = NULL;
+    size_t text_size = 0;
+
+    *nr_queries = 0;
+    *queries = (struct extract_query*)malloc(capacity * sizeof(struct extract_query));
+    if(*queries == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    while(getline(&text,&text_size,input) >= 0) {
+        text[strcspn(text,"\r\n")] = 0;
+        if(text[0] == 0)
+            continue;
+        if(*nr_queries == capacity) {
+            struct extract_query * grown = (struct extract_query*)realloc(*queries, 2 * capacity * sizeof(struct extract_query));
+            if(grown == NULL) {
+                free(text);
+                return ERR_ALLOCATING_MEMORY;
+            }
+            *queries = grown;
+            capacity *= 2;
+        }
+        // same options as a single extract: path=<file_path> section=<section_nr> line=<line_nr>
+        struct extract_query * query = &(*queries)[(*nr_queries)++];
+        bool has_section = false, has_line = false;
+        query->path = NULL;
+        query->line = NULL;
+        query->line_size = 0;
+        query->failure_src = NONE_P;
+        char * saveptr;
+        for(char * token = strtok_r(text," \t",&saveptr); token != NULL; token = strtok_r(NULL," \t",&saveptr)) {
+            char * value = strchr(token,'=');
+            if(value == NULL)
+                continue;
+            *value++ = 0;
+            if(strcmp(token,"path") == 0 && query->path == NULL) {
+                query->path = strdup(value);
+            }else if(strcmp(token,"section") == 0) {
+                query->section_nr = strtoul(value,NULL,10);
+                has_section = true;
+            }else if(strcmp(token,"line") == 0) {
+                query->line_nr = strtoul(value,NULL,10);
+                has_line = true;
+            }
+        }
+        query->return_value = query->path != NULL && has_section && has_line ? SUCCESS : ERR_MISSING_ARGUMENTS;
+    }
+    free(text);
+    return SUCCESS;
+}
+
+int compare_extract_queries(const void * a, const void * b) {
+    const struct extract_query * first = *(const struct extract_query * const *)a;
+    const struct extract_query * second = *(const struct extract_query * const *)b;
+    int result = strcmp(first->path,second->path);
+    if(result == 0)
+        result = first->section_nr - second->section_nr;
+    if(result == 0)
+        result = (first->line_nr > second->line_nr) - (first->line_nr < second->line_nr);
+    return result;
+}
+
+void answer_extract_queries(struct extract_query ** sorted, size_t nr_queries, const char * index_dir, struct op_env * env) {
+    size_t file_first = 0;
+    long * line_nrs = NULL;
+    off_t * line_starts = NULL;
+    size_t * line_lengths = NULL;
+    bool * found = NULL;
+
+    while(file_first < nr_queries) {
+        // the queries on the same file share its descriptor and its header
+        size_t file_last = file_first + 1;
+        while(file_last < nr_queries && strcmp(sorted[file_last]->path,sorted[file_first]->path) == 0)
+            file_last++;
+        int return_value = SUCCESS;
+        enum invalid_sf_extract_param failure_src = NONE_P;
+        sf_file_header_t sf_header;
+        sf_invalid_field_t failure_src_sf_fields;
+        int file_size = 0;
+        int fd;
+        file_table_entry_t * entry;
+        return_value = open_sf_file(env,sorted[file_first]->path,NULL,&fd,&sf_header,&failure_src_sf_fields,&entry);
+        if(fd >= 0) {
+            if(return_value == ERR_INVALID_FILE_FORMAT && failure_src_sf_fields > SF_VALID)
+                failure_src = FILE_FORMAT;
+            file_size = lseek(fd,0,SEEK_END);
         }
+        size_t section_first = file_first;
+        while(section_first < file_last) {
+            // the queries on the same section are answered from a single pass over it
+            size_t section_last = section_first + 1;
+            while(section_last < file_last && sorted[section_last]->section_nr == sorted[section_first]->section_nr)
+                section_last++;
+            size_t nr_lines = section_last - section_first;
+            int section_nr = sorted[section_first]->section_nr;
+            int section_value = return_value;
+            enum invalid_sf_extract_param section_failure = failure_src;
+            if(section_value == SUCCESS && (section_nr < 1 || section_nr > sf_header.header.no_of_sections)) {
+                section_value = ERR_INVALID_ARGUMENTS;
+                section_failure = SECTION;
+            }else if(section_value == SUCCESS && file_size > 0 && sf_header.sections[section_nr-1].sect_offset > file_size) {
+                section_value = ERR_INVALID_FILE_FORMAT;
+                section_failure = FILE_FORMAT;
+            }
+            if(section_value == SUCCESS && nr_lines == 1) {
+                // a lone query may still be answered through the line-offset index
+                struct extract_query * query = sorted[section_first];
+                section_value = extract_line(fd,&sf_header,section_nr,query->line_nr,index_dir,&query->line,&query->line_size,&section_failure);
+            }else if(section_value == SUCCESS) {
+                // a buffer which can't grow is kept, it is freed with the others at the end
+                long * grown_nrs = (long*)realloc(line_nrs,nr_lines * sizeof(long));
+                if(grown_nrs != NULL)
+                    line_nrs = grown_nrs;
+                off_t * grown_starts = (off_t*)realloc(line_starts,nr_lines * sizeof(off_t));
+                if(grown_starts != NULL)
+                    line_starts = grown_starts;
+                size_t * grown_lengths = (size_t*)realloc(line_lengths,nr_lines * sizeof(size_t));
+                if(grown_lengths != NULL)
+                    line_lengths = grown_lengths;
+                bool * grown_found = (bool*)realloc(found,nr_lines * sizeof(bool));
+                if(grown_found != NULL)
+                    found = grown_found;
+                if(grown_nrs == NULL || grown_starts == NULL || grown_lengths == NULL || grown_found == NULL) {
+                    section_value = ERR_ALLOCATING_MEMORY;
+                }else {
+                    sect_header_t * section = &sf_header.sections[section_nr-1];
+                    for(size_t i=0;i<nr_lines;i++)
+                        line_nrs[i] = sorted[section_first+i]->line_nr;
+                    if(sf_v2_find_lines(fd,&sf_header,section_nr-1,line_nrs,nr_lines,line_starts,line_lengths,found) != SUCCESS)
+                        section_value = scan_find_lines(fd,section->sect_offset,section->sect_size,line_nrs,nr_lines,line_starts,line_lengths,found);
+                }
+                for(size_t i=0;i<nr_lines && section_value == SUCCESS;i++) {
+                    // only the lines themselves are kept in memory
+                    struct extract_query * query = sorted[section_first+i];
+                    if(!found[i]) {
+                        query->return_value = ERR_INVALID_ARGUMENTS;
+                        query->failure_src = LINE;
+                        continue;
+                    }
+                    query->line = (char*)malloc(line_lengths[i] + 1);
+                    if(query->line == NULL) {
+                        query->return_value = ERR_ALLOCATING_MEMORY;
+                    }else if(scan_read_fully(fd,query->line,line_lengths[i],line_starts[i]) != (ssize_t)line_lengths[i]) {
+                        query->return_value = ERR_READING_FILE;
+                    }
+                    query->line_size = line_lengths[i];
+                }
+            }
+            if(section_value != SUCCESS) {
+                for(size_t i=section_first;i<section_last;i++) {
+                    sorted[i]->return_value = section_value;
+                    sorted[i]->failure_src = section_failure;
+                }
+            }
+            section_first = section_last;
+        }
+        close_sf_file(env,fd,entry);
+        file_first = file_last;
     }
+    free(line_nrs);
+    free(line_starts);
+    free(line_lengths);
+    free(found);
 }
 
-int count_lines(int fd, struct header * sf_header, int section_nr,long * line_count){
+void perform_op_extract_batch(const char * queries_path, const char * index_dir, struct op_env * env) {
     int return_value = SUCCESS;
-    int buf_size = sf_header->section_headers[section_nr-1].sect_size;
-    char * buf = (char*)malloc(sizeof(char)*(buf_size+1));
-    if(buf == NULL) {
+    struct extract_query * queries = NULL;
+    struct extract_query ** sorted = NULL;
+    size_t nr_queries = 0;
+    size_t nr_valid = 0;
+    out_writer_t * output = env->output;
+
+    // a request answered by the server has no standard input of its own, it would read the server's
+    if(strcmp(queries_path,"-") == 0 && env->files != NULL) {
+        return_value = ERR_INVALID_PATH;
+        goto display_error_messages;
+    }
+    FILE * input = strcmp(queries_path,"-") == 0 ? stdin : fopen(queries_path,"r");
+    if(input == NULL) {
+        return_value = ERR_INVALID_PATH;
+        goto display_error_messages;
+    }
+    return_value = read_extract_queries(input,&queries,&nr_queries);
+    if(input != stdin)
+        fclose(input);
+    if(return_value != SUCCESS)
+        goto clean_up;
+    // like the options, the paths of a request answered by the server have to be absolute
+    for(size_t i=0;i<nr_queries && env->files != NULL;i++) {
+        if(queries[i].return_value == SUCCESS && queries[i].path[0] != '/')
+            queries[i].return_value = ERR_INVALID_PATH;
+    }
+
+    // group the well-formed queries by file and section
+    sorted = (struct extract_query**)malloc((nr_queries + 1) * sizeof(struct extract_query*));
+    if(sorted == NULL) {
         return_value = ERR_ALLOCATING_MEMORY;
-        goto finish;
+        goto clean_up;
     }
-    int ch_read;
-    if(lseek(fd,sf_header->section_headers[section_nr-1].sect_offset,SEEK_SET) < 0) {
-        return_value = ERR_READING_FILE;
-        goto finish;
+    for(size_t i=0;i<nr_queries;i++) {
+        if(queries[i].return_value == SUCCESS)
+            sorted[nr_valid++] = &queries[i];
     }
-    if((ch_read = read(fd,buf,buf_size)) == -1) {
-        return_value = ERR_READING_FILE;
-        goto finish;
+    qsort(sorted,nr_valid,sizeof(struct extract_query*),compare_extract_queries);
+    answer_extract_queries(sorted,nr_valid,index_dir,env);
+
+    // the answers are written in the order of the queries, each one as a single extract would print it
+    for(size_t i=0;i<nr_queries;i++) {
+        struct extract_query * query = &queries[i];
+        if(query->return_value != SUCCESS) {
+            writer_write_line(output,"ERROR");
+            writer_write_line(output,extract_error_message(query->return_value,query->failure_src));
+            continue;
+        }
+        // the line is reversed straight into the output buffer
+        size_t header_length = strlen("SUCCESS\n");
+        char * out = writer_reserve(output,header_length + query->line_size + 1);
+        if(out == NULL) {
+            writer_write_line(output,"ERROR");
+            writer_write_line(output,extract_error_message(ERR_ALLOCATING_MEMORY,NONE_P));
+            continue;
+        }
+        memcpy(out,"SUCCESS\n",header_length);
+        reverse_bytes(out + header_length,query->line,query->line_size);
+        out[header_length + query->line_size] = '\n';
+        writer_commit(output,header_length + query->line_size + 1);
     }
-    buf[ch_read] = '\0';
-    char * p = strtok(buf,"\n");
-    while(p != NULL) {
-        p = strtok(NULL,"\n");
-        (*line_count)++;
+
+    clean_up:
+    for(size_t i=0;i<nr_queries;i++) {
+        free(queries[i].path);
+        free(queries[i].line);
     }
+    free(queries);
+    free(sorted);
 
-    finish:
-    if(buf != NULL) {
-        free(buf);
+    display_error_messages:
+    if(return_value != SUCCESS) {
+        writer_printf(env->output,"ERROR\n");
+        writer_printf(env->output,"%s\n",extract_error_message(return_value,NONE_P));
     }
+}
+
+void perform_op_convert(int nr_parameters, char ** parameters, struct op_env * env) {
+    int return_value = SUCCESS;
+    sf_file_header_t sf_header;
+    sf_invalid_field_t failure_src = SF_VALID;
+    int fd;
+    char file_path[MAX_PATH_SIZE+1];
+    char out_path[MAX_PATH_SIZE+1];
+    bool path = false;
+    bool out = false;
+
+    for(int i=2;i<nr_parameters;i++) {
+        char * saveptr;
+        char * option = strtok_r(parameters[i],"=",&saveptr);
+        char * value = parameters[i] + strlen(option) + 1;
+        if(strcmp(option,"path") == 0 && strlen(value) <= MAX_PATH_SIZE) {
+            // the sf file to convert
+            strcpy(file_path,value);
+            path = true;
+        }else if(strcmp(option,"out") == 0 && strlen(value) <= MAX_PATH_SIZE) {
+            // where the SFv2 file is written, it may be the same file
+            strcpy(out_path,value);
+            out = true;
+        }
+    }
+    if(!path || !out) {
+        return_value = ERR_MISSING_ARGUMENTS;
+        goto display_error_messages;
+    }
+
+    file_table_entry_t * entry;
+    return_value = open_sf_file(env,file_path,NULL,&fd,&sf_header,&failure_src,&entry);
+    if(fd < 0)
+        goto display_error_messages;
+    if(return_value == SUCCESS)
+        return_value = sf_v2_convert(fd,&sf_header,out_path);
+    close_sf_file(env,fd,entry);
+    if(return_value == SUCCESS)
+        writer_printf(env->output,"SUCCESS\n");
+
+    display_error_messages:
+    if(return_value != SUCCESS) {
+        writer_printf(env->output,"ERROR\n");
+        if (return_value == ERR_MISSING_ARGUMENTS)
+            writer_printf(env->output," USAGE: convert path=<file_path> out=<file_path>\nThe order of the options is not relevant.\n");
+        if (return_value == ERR_INVALID_PATH)
+            writer_printf(env->output,"Invalid file path\n");
+        if (return_value == ERR_READING_FILE)
+            writer_printf(env->output,"Error reading from file.\n");
+        if (return_value == ERR_WRITING_OUTPUT)
+            writer_printf(env->output,"Error writing the converted file.\n");
+        if (return_value == ERR_ALLOCATING_MEMORY)
+            writer_printf(env->output,"Error allocating memory for the line tables.\n");
+        if (return_value == ERR_INVALID_FILE_FORMAT && failure_src == SF_VALID)
+            writer_printf(env->output,"a section ends past the end of the file\n");
+        else if (return_value == ERR_INVALID_FILE_FORMAT)
+            writer_printf(env->output,"wrong %s\n",failure_src == SF_WRONG_MAGIC ? "magic" : failure_src == SF_WRONG_VERSION ? "version"
+                                                 : failure_src == SF_WRONG_SECT_NR ? "sect_nr" : "sect_types");
+    }
+}
+
+int read_multi_query(char * text, bool absolute_paths, struct multi_query * query) {
+    char expr_text[MAX_LINE_LENGTH] = "";
+    char suffixes[MAX_LINE_LENGTH] = "";
+    char * out_path = NULL;
+    char * saveptr;
+    bool findall;
+
+    // <list|findall> [recursive] [name_ends_with=<suffix>]... [permissions=<rights>] [where=<expression>] out=<result_file>
+    char * op = strtok_r(text," \t",&saveptr);
+    if(op == NULL || (strcmp(op,OP_LIST) != 0 && strcmp(op,OP_FILTER) != 0))
+        return ERR_INVALID_ARGUMENTS;
+    findall = strcmp(op,OP_FILTER) == 0;
+    // findall always looks into the subdirectories
+    query->recursive = findall;
+    if(findall)
+        strcpy(expr_text,"type:f&lines=16");
+    for(char * token = strtok_r(NULL," \t",&saveptr); token != NULL; token = strtok_r(NULL," \t",&saveptr)) {
+        char * value = strchr(token,'=');
+        if(strcmp(token,"recursive") == 0) {
+            query->recursive = true;
+            continue;
+        }
+        if(value == NULL)
+            return ERR_INVALID_ARGUMENTS;
+        *value++ = 0;
+        // every filter becomes a part of the query's expression, which must fit whole
+        bool fits = true;
+        if(strcmp(token,"out") == 0) {
+            out_path = value;
+        }else if(strcmp(token,"name_ends_with") == 0 && !findall) {
+            // an empty suffix matches no name, as in list; "name:" with no text never does either
+            fits = append_expr_text(suffixes,sizeof(suffixes),"%s%s:%s",suffixes[0] ? "|" : "",value[0] ? "suffix" : "name",value);
+        }else if(strcmp(token,"permissions") == 0 && !findall) {
+            fits = append_expr_text(expr_text,sizeof(expr_text),"%sperm:%s",expr_text[0] ? "&" : "",value);
+        }else if(strcmp(token,"where") == 0) {
+            fits = append_expr_text(expr_text,sizeof(expr_text),"%s(%s)",expr_text[0] ? "&" : "",value);
+        }else if(strcmp(token,"path") != 0) {
+            return ERR_INVALID_ARGUMENTS;
+        }
+        if(!fits)
+            return ERR_INVALID_ARGUMENTS;
+    }
+    if(suffixes[0] && !append_expr_text(expr_text,sizeof(expr_text),"%s(%s)",expr_text[0] ? "&" : "",suffixes))
+        return ERR_INVALID_ARGUMENTS;
+    if(out_path == NULL)
+        return ERR_INVALID_ARGUMENTS;
+    // a result file of a request answered by the server would otherwise be relative to the server's directory
+    if(absolute_paths && out_path[0] != '/')
+        return ERR_INVALID_PATH;
+    query->expr = NULL;
+    if(expr_text[0] && filter_expr_compile(expr_text,&query->expr) != SUCCESS)
+        return ERR_INVALID_ARGUMENTS;
+    query->fd = open(out_path,O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,0644);
+    if(query->fd < 0) {
+        filter_expr_free(query->expr);
+        return ERR_INVALID_PATH;
+    }
+    struct stat inode;
+    if(fstat(query->fd,&inode) != 0) {
+        filter_expr_free(query->expr);
+        close(query->fd);
+        return ERR_INVALID_PATH;
+    }
+    query->dev = inode.st_dev;
+    query->ino = inode.st_ino;
+    if(writer_init(&query->output,query->fd) != SUCCESS) {
+        filter_expr_free(query->expr);
+        close(query->fd);
+        return ERR_ALLOCATING_MEMORY;
+    }
+    return SUCCESS;
+}
+
+bool append_expr_text(char * text, size_t size, const char * format, ...) {
+    size_t length = strlen(text);
+    va_list args;
+    va_start(args,format);
+    int written = vsnprintf(text + length,size - length,format,args);
+    va_end(args);
+    return written >= 0 && (size_t)written < size - length;
+}
+
+int read_multi_queries(const char * queries_path, bool absolute_paths, struct multi_query ** queries, size_t * nr_queries) {
+    int return_value = SUCCESS;
+    char * text = NULL;
+    size_t text_size = 0;
+    size_t capacity = 16;
+
+    *nr_queries = 0;
+    FILE * input = fopen(queries_path,"r");
+    if(input == NULL)
+        return ERR_INVALID_PATH;
+    *queries = (struct multi_query*)malloc(capacity * sizeof(struct multi_query));
+    if(*queries == NULL) {
+        fclose(input);
+        return ERR_ALLOCATING_MEMORY;
+    }
+    while(return_value == SUCCESS && getline(&text,&text_size,input) >= 0) {
+        text[strcspn(text,"\r\n")] = 0;
+        if(text[0] == 0)
+            continue;
+        if(*nr_queries == capacity) {
+            struct multi_query * grown = (struct multi_query*)realloc(*queries,2 * capacity * sizeof(struct multi_query));
+            if(grown == NULL) {
+                return_value = ERR_ALLOCATING_MEMORY;
+                break;
+            }
+            *queries = grown;
+            capacity *= 2;
+        }
+        return_value = read_multi_query(text,absolute_paths,&(*queries)[*nr_queries]);
+        if(return_value != SUCCESS)
+            break;
+        // two queries writing the same result file would mix their lines, whatever names the file was given
+        struct multi_query * query = &(*queries)[(*nr_queries)++];
+        for(size_t i=0;i+1<*nr_queries && return_value == SUCCESS;i++) {
+            if((*queries)[i].dev == query->dev && (*queries)[i].ino == query->ino)
+                return_value = ERR_INVALID_PATH;
+        }
+    }
+    free(text);
+    fclose(input);
     return return_value;
 }
 
-int validate_file_with_filter(char * file_path, bool *valid) {
+int multi_visit_entry(walk_entry_t * entry, void * arg) {
+    struct multi_context * context = (struct multi_context*)arg;
     int return_value = SUCCESS;
-    int fd = open(file_path,O_RDONLY);
-    if(fd < 0) {
-        return_value = ERR_INVALID_PATH;
-        goto finish;
+    filter_subject_t subject;
+    bool top = strchr(entry->path + context->root_length + 1,'/') == NULL;
+
+    // the header and the line counts are read once, for all the queries needing them
+    filter_subject_init(&subject,entry,&sf_rules);
+    for(size_t i=0;i<context->nr_queries && return_value == SUCCESS;i++) {
+        struct multi_query * query = &context->queries[i];
+        if(!top && !query->recursive)
+            continue;
+        bool condition;
+        return_value = filter_expr_match(query->expr,&subject,&condition);
+        if(return_value == SUCCESS && condition)
+            return_value = writer_write_line(&query->output,entry->path);
     }
-    struct header sf_header;
-    enum invalid_sf_field failure_src = NONE;
-    *valid = false;
+    filter_subject_release(&subject);
+    return return_value;
+}
 
-    if(parse_file_header(fd,&sf_header,&failure_src) == ERR_INVALID_FILE_FORMAT) {
-        goto finish;
+void perform_op_multi(int nr_parameters, char ** parameters, struct op_env * env) {
+    int return_value = SUCCESS;
+    char dir_path[MAX_PATH_SIZE+1];
+    char queries_path[MAX_PATH_SIZE+1];
+    bool path = false, queries_file = false;
+    int nr_threads = 1;
+    struct multi_query * queries = NULL;
+    size_t nr_queries = 0;
+    bool recursive = false;
+
+    for(int i=2;i<nr_parameters;i++) {
+        char * saveptr;
+        char * filter_option = strtok_r(parameters[i],"=",&saveptr);
+        char * filter_value = parameters[i] + strlen(filter_option) + 1;
+        if(strcmp(filter_option,"path") == 0) {
+            // detected the root shared by all the queries
+            strncpy(dir_path,filter_value,MAX_PATH_SIZE);
+            dir_path[MAX_PATH_SIZE] = '\0';
+            path = true;
+        }else if(strcmp(filter_option,"queries") == 0) {
+            // detected the file with one query per line
+            strncpy(queries_path,filter_value,MAX_PATH_SIZE);
+            queries_path[MAX_PATH_SIZE] = '\0';
+            queries_file = true;
+        }else if(strcmp(filter_option,"threads") == 0) {
+            // detected the number of threads walking the tree
+            nr_threads = strtol(filter_value,NULL,10);
+        }
+    }
+    if(!path || !queries_file || nr_threads < 1 || nr_threads > MAX_NR_THREADS) {
+        return_value = ERR_INVALID_ARGUMENTS;
+        goto display_error_messages;
     }
+    return_value = read_multi_queries(queries_path,env->files != NULL,&queries,&nr_queries);
+    if(return_value != SUCCESS)
+        goto clean_up;
 
-    for(int i=1;i<=sf_header.no_of_sections;i++) {
-        long nr_lines_in_section = 0l;
-        if(count_lines(fd,&sf_header,i,&nr_lines_in_section) != SUCCESS) {
-            return_value = ERR_READING_FILE;
+    struct multi_context context = {.queries = queries,.nr_queries = nr_queries,.root_length = strlen(dir_path)};
+    for(size_t i=0;i<nr_queries;i++) {
+        // every result file starts the way the single query's output would
+        writer_write_line(&queries[i].output,"SUCCESS");
+        recursive = recursive || queries[i].recursive;
+    }
+    return_value = walk_directory_tree(dir_path,recursive,nr_threads,multi_visit_entry,&context);
+    for(size_t i=0;i<nr_queries && return_value != SUCCESS;i++) {
+        if(queries[i].output.flushed == 0) {
+            writer_discard(&queries[i].output);
+            writer_write_line(&queries[i].output,"ERROR\nInvalid directory path");
+        }
+    }
+    if(return_value == SUCCESS)
+        writer_printf(env->output,"SUCCESS\n");
+
+    clean_up:
+    for(size_t i=0;i<nr_queries;i++) {
+        writer_close(&queries[i].output);
+        close(queries[i].fd);
+        filter_expr_free(queries[i].expr);
+    }
+    free(queries);
+
+    display_error_messages:
+    if(return_value != SUCCESS) {
+        writer_printf(env->output,"ERROR\n");
+        if (return_value == ERR_INVALID_ARGUMENTS)
+            writer_printf(env->output," USAGE: multi path=<dir_path> queries=<queries_file> [threads=<nr_threads>]\n"
+                                      "Each line of the queries file: <list|findall> [recursive] [name_ends_with=<suffix>]... [permissions=<rights>] [where=<expression>] out=<result_file>\n");
+        if (return_value == ERR_INVALID_PATH)
+            writer_printf(env->output,"Invalid directory, queries or result file path (each query needs a result file of its own)\n");
+        if (return_value == ERR_ALLOCATING_MEMORY)
+            writer_printf(env->output,"Error allocating memory for the queries.\n");
+    }
+}
+
+int validate_file_with_filter(int dir_fd, const char * file_name, const struct stat * inode, sf_cache_t * cache, visited_set_t * seen, bool *valid) {
+    int return_value = SUCCESS;
+    int fd = -1;
+    sf_cache_key_t key;
+    sf_cache_record_t record;
+    bool cached = false;
+    bool changed = false;
+    // the inode of a file with several links, whose result is shared by all its names (NULL otherwise)
+    const struct stat * linked = NULL;
+    struct stat opened;
+    bool seen_before = false;
+    *valid = false;
+
+    if(seen != NULL && inode != NULL && inode->st_nlink > 1) {
+        linked = inode;
+        int state = visited_set_find(seen,inode->st_dev,inode->st_ino);
+        if(state != 0) {
+            *valid = state == SEEN_VALID;
+            return SUCCESS;
+        }
+    }
+    if(cache != NULL && inode != NULL) {
+        sf_cache_key_from_stat(inode,&key);
+        cached = sf_cache_lookup(cache,&key,&record);
+    }
+    if(!cached) {
+        // open the file relative to its directory
+        fd = openat(dir_fd,file_name,O_RDONLY);
+        stats_add(STATS_CALLS_OPEN,1);
+        if(fd < 0) {
+            return_value = ERR_INVALID_PATH;
             goto finish;
         }
-        if(nr_lines_in_section == 16) {
+        // without the inode from the walk, the links are counted on the open file, which needs no path lookup
+        if(seen != NULL && inode == NULL)
+            stats_add(STATS_CALLS_STAT,1);
+        if(seen != NULL && inode == NULL && fstat(fd,&opened) == 0 && opened.st_nlink > 1) {
+            linked = &opened;
+            int state = visited_set_find(seen,opened.st_dev,opened.st_ino);
+            if(state != 0) {
+                *valid = state == SEEN_VALID;
+                seen_before = true;
+                goto finish;
+            }
+        }
+        sf_invalid_field_t failure_src = SF_VALID;
+        record.parse_status = parse_file_header(fd,&record.sf_header,&failure_src);
+        record.failure_src = failure_src;
+        sf_cache_clear_line_counts(&record);
+        // a file which can't be read is not valid, but is not remembered either
+        if(record.parse_status == ERR_READING_FILE)
+            goto finish;
+        changed = true;
+    }
+    if(record.parse_status != SUCCESS)
+        goto finish;
+
+    // the sections without a count are planned together: read in the order of their offsets, the small ones merged into single reads
+    bool uncounted = false;
+    long line_counts[SF_MAX_NR_SECTIONS];
+    for(int i=0;i<record.sf_header.header.no_of_sections;i++) {
+        line_counts[i] = record.line_counts[i];
+        if(line_counts[i] == 16) {
             *valid = true;
-            break;
+            goto finish;
         }
+        uncounted = uncounted || line_counts[i] < 0;
     }
+    if(!uncounted)
+        goto finish;
+    if(fd < 0) {
+        fd = openat(dir_fd,file_name,O_RDONLY);
+        stats_add(STATS_CALLS_OPEN,1);
+    }
+    if(fd < 0) {
+        return_value = ERR_INVALID_PATH;
+        goto finish;
+    }
+    // an SFv2 file has the counts in its extension, otherwise there is no need to count past the 17th line
+    if(sf_v2_count_sections(fd,&record.sf_header,line_counts) != SUCCESS
+       && scan_count_sections(fd,record.sf_header.sections,record.sf_header.header.no_of_sections,16,line_counts) != SUCCESS) {
+        return_value = ERR_READING_FILE;
+        goto finish;
+    }
+    for(int i=0;i<record.sf_header.header.no_of_sections;i++) {
+        if(record.line_counts[i] < 0 && line_counts[i] > 16)
+            record.capped_counts |= 1u << i;
+        record.line_counts[i] = line_counts[i];
+        *valid = *valid || line_counts[i] == 16;
+    }
+    changed = true;
     finish:
-    if(sf_header.section_headers != NULL)
-        free(sf_header.section_headers);
-    if(fd > 0)
+    if(return_value == SUCCESS && changed && cache != NULL && inode != NULL)
+        sf_cache_store(cache,&key,&record);
+    if(return_value == SUCCESS && linked != NULL && !seen_before)
+        visited_set_put(seen,linked->st_dev,linked->st_ino,*valid ? SEEN_VALID : SEEN_INVALID,NULL);
+    if(fd >= 0)
         close(fd);
     return return_value;
-}
\ No newline at end of file
+}
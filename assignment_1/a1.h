@@ -0,0 +1,22 @@
+#ifndef __A1_H__
+#define __A1_H__
+
+#define MAX_PATH_SIZE 300
+#define MAX_NAME_SIZE 50
+#define MAX_LINE_LENGTH 1024
+#define MAX_NR_THREADS 64
+
+#define SUCCESS 0
+#define ERR_INVALID_PATH -1
+#define ERR_INVALID_ARGUMENTS -2
+#define ERR_MISSING_PATH -3
+#define ERR_READING_FILE -4
+#define ERR_INVALID_LINE_ENDING -5
+#define ERR_INVALID_FILE_FORMAT -6
+#define ERR_ALLOCATING_MEMORY -7
+#define ERR_CREATING_THREAD -8
+#define ERR_MISSING_ARGUMENTS -9
+#define ERR_WRITING_OUTPUT -10
+#define ERR_IO_URING_UNAVAILABLE -11
+
+#endif
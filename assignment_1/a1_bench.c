@@ -0,0 +1,359 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <ftw.h>
+
+#include "a1.h"
+
+#define MAX_NR_ARGS 32
+// options given to a1 on top of the ones each operation needs
+#define MAX_EXTRA_SIZE 256
+// how many of the files findall lists are used by parse and extract
+#define MAX_NR_SAMPLES 4096
+
+/** An operation the benchmark runs, with how it is timed. */
+typedef struct bench_op{
+    const char * name;
+    /** runs once per corpus (list, findall) or once per sample file (parse, extract) */
+    bool per_file;
+}bench_op_t;
+
+static const bench_op_t bench_ops[] = {{"list", false}, {"parse", true}, {"extract", true}, {"findall", false}};
+#define NR_BENCH_OPS (sizeof(bench_ops) / sizeof(bench_ops[0]))
+
+typedef struct bench_params{
+    char binary[MAX_PATH_SIZE+1];
+    char path[MAX_PATH_SIZE+1];
+    char extra[MAX_EXTRA_SIZE+1];
+    int nr_runs;
+    int nr_warmup_runs;
+    bool ops[NR_BENCH_OPS];
+    bool json;
+}bench_params_t;
+
+/** The result of a single run of a1. */
+typedef struct run_result{
+    double latency_ms;
+    size_t output_size;
+    bool failed;
+}run_result_t;
+
+// regular files and bytes of the corpus, counted once before the runs
+static long corpus_nr_files;
+static unsigned long long corpus_nr_bytes;
+
+static int count_file(const char * path, const struct stat * inode, int type, struct FTW * ftw) {
+    (void)path;
+    (void)ftw;
+    if(type == FTW_F && S_ISREG(inode->st_mode)) {
+        corpus_nr_files++;
+        corpus_nr_bytes += inode->st_size;
+    }
+    return 0;
+}
+
+static double elapsed_ms(const struct timespec * start, const struct timespec * end) {
+    return (end->tv_sec - start->tv_sec) * 1e3 + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/**
+ * Runs a1 with args, its output read through a pipe (so the time to write it is paid, but not the one of a terminal).
+ * If output is not NULL the whole output is kept there, otherwise only its size is counted.
+ * A run fails if a1 does not exit with 0 or its answer does not start with SUCCESS.
+ */
+static int run_a1(char ** args, run_result_t * result, char ** output) {
+    int fds[2];
+    char buf[64 * 1024];
+    char first[sizeof("SUCCESS")] = "";
+    size_t kept_size = 0;
+    struct timespec start, end;
+
+    if(pipe(fds) != 0)
+        return ERR_CREATING_THREAD;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t child = fork();
+    if(child < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return ERR_CREATING_THREAD;
+    }
+    if(child == 0) {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(args[0], args);
+        _exit(127);
+    }
+    close(fds[1]);
+    result->output_size = 0;
+    for(;;) {
+        ssize_t nr_bytes = read(fds[0], buf, sizeof(buf));
+        if(nr_bytes < 0 && errno == EINTR)
+            continue;
+        if(nr_bytes <= 0)
+            break;
+        if(result->output_size < sizeof(first) - 1) {
+            size_t copied = sizeof(first) - 1 - result->output_size;
+            copied = copied < (size_t)nr_bytes ? copied : (size_t)nr_bytes;
+            memcpy(first + result->output_size, buf, copied);
+            first[result->output_size + copied] = '\0';
+        }
+        if(output != NULL) {
+            char * grown = (char*)realloc(*output, kept_size + nr_bytes + 1);
+            if(grown == NULL) {
+                free(*output);
+                *output = NULL;
+                output = NULL;
+            }else {
+                *output = grown;
+                memcpy(*output + kept_size, buf, nr_bytes);
+                kept_size += nr_bytes;
+                (*output)[kept_size] = '\0';
+            }
+        }
+        result->output_size += nr_bytes;
+    }
+    close(fds[0]);
+    int status;
+    while(waitpid(child, &status, 0) < 0 && errno == EINTR)
+        ;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    result->latency_ms = elapsed_ms(&start, &end);
+    result->failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0 || strcmp(first, "SUCCESS") != 0;
+    return SUCCESS;
+}
+
+/** Builds the command line of an operation: a1, the operation, its own options, then the extra ones. */
+static int build_args(const bench_params_t * params, const char * op, const char * sample, char * extra, char ** args) {
+    static char path_option[MAX_PATH_SIZE + sizeof("path=")];
+    int nr_args = 0;
+    args[nr_args++] = (char*)params->binary;
+    args[nr_args++] = (char*)op;
+    if(strcmp(op, "list") == 0) {
+        args[nr_args++] = "recursive";
+    }else if(strcmp(op, "extract") == 0) {
+        // every section the corpus generator writes has a first line
+        args[nr_args++] = "section=1";
+        args[nr_args++] = "line=1";
+    }
+    snprintf(path_option, sizeof(path_option), "path=%s", sample != NULL ? sample : params->path);
+    args[nr_args++] = path_option;
+    // the extra options go to the operations walking the tree, parse and extract take none of them
+    if(sample == NULL) {
+        char * saveptr;
+        for(char * option = strtok_r(extra, " ", &saveptr); option != NULL && nr_args < MAX_NR_ARGS - 1;
+            option = strtok_r(NULL, " ", &saveptr))
+            args[nr_args++] = option;
+    }
+    args[nr_args] = NULL;
+    return nr_args;
+}
+
+static int compare_latencies(const void * a, const void * b) {
+    double first = ((const run_result_t*)a)->latency_ms;
+    double second = ((const run_result_t*)b)->latency_ms;
+    return first < second ? -1 : first > second ? 1 : 0;
+}
+
+/** Nearest-rank percentile of results sorted by latency. */
+static double percentile(const run_result_t * results, int nr_results, double rank) {
+    int index = (int)(rank / 100 * nr_results + 0.999999) - 1;
+    if(index < 0)
+        index = 0;
+    if(index >= nr_results)
+        index = nr_results - 1;
+    return results[index].latency_ms;
+}
+
+static void report(const bench_params_t * params, const char * op, run_result_t * results, int nr_results, bool first) {
+    double total_ms = 0;
+    size_t output_size = 0;
+    int nr_failed = 0;
+    for(int i = 0; i < nr_results; i++) {
+        total_ms += results[i].latency_ms;
+        output_size += results[i].output_size;
+        nr_failed += results[i].failed ? 1 : 0;
+    }
+    qsort(results, nr_results, sizeof(run_result_t), compare_latencies);
+    double runs_per_s = total_ms > 0 ? nr_results * 1e3 / total_ms : 0;
+    // the operations walking the tree are also measured in corpus files per second
+    double files_per_s = strcmp(op, "list") == 0 || strcmp(op, "findall") == 0 ? runs_per_s * corpus_nr_files : runs_per_s;
+    double p50 = percentile(results, nr_results, 50);
+    double p90 = percentile(results, nr_results, 90);
+    double p99 = percentile(results, nr_results, 99);
+    double max = results[nr_results - 1].latency_ms;
+    double min = results[0].latency_ms;
+
+    if(params->json) {
+        printf("%s{\"operation\":\"%s\",\"runs\":%d,\"failed\":%d,\"runs_per_s\":%.2f,\"files_per_s\":%.2f,"
+               "\"latency_ms\":{\"min\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f},\"output_bytes\":%zu}",
+               first ? "" : ",\n", op, nr_results, nr_failed, runs_per_s, files_per_s, min, p50, p90, p99, max, output_size / nr_results);
+    }else {
+        printf("%-8s %6d %6d %10.2f %12.2f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+               op, nr_results, nr_failed, runs_per_s, files_per_s, min, p50, p90, p99, max);
+    }
+}
+
+/** Lists the files findall finds in the corpus, they are the valid sf files parse and extract run on. */
+static int find_samples(const bench_params_t * params, char ** samples, int * nr_samples, char ** output) {
+    char * args[MAX_NR_ARGS];
+    run_result_t result;
+    char no_extra[] = "";
+
+    build_args(params, "findall", NULL, no_extra, args);
+    int return_value = run_a1(args, &result, output);
+    if(return_value != SUCCESS)
+        return return_value;
+    if(result.failed || *output == NULL)
+        return ERR_READING_FILE;
+    *nr_samples = 0;
+    char * saveptr;
+    // the first line is SUCCESS
+    strtok_r(*output, "\n", &saveptr);
+    for(char * line = strtok_r(NULL, "\n", &saveptr); line != NULL && *nr_samples < MAX_NR_SAMPLES; line = strtok_r(NULL, "\n", &saveptr))
+        samples[(*nr_samples)++] = line;
+    return SUCCESS;
+}
+
+static int benchmark(const bench_params_t * params) {
+    int return_value = SUCCESS;
+    char * args[MAX_NR_ARGS];
+    char extra[MAX_EXTRA_SIZE+1];
+    static char * samples[MAX_NR_SAMPLES];
+    int nr_samples = 0;
+    char * findall_output = NULL;
+    run_result_t * results = (run_result_t*)malloc(params->nr_runs * sizeof(run_result_t));
+    if(results == NULL)
+        return ERR_ALLOCATING_MEMORY;
+
+    if(nftw(params->path, count_file, 16, FTW_PHYS) != 0) {
+        return_value = ERR_INVALID_PATH;
+        goto clean_up;
+    }
+    if(params->ops[1] || params->ops[2]) {
+        return_value = find_samples(params, samples, &nr_samples, &findall_output);
+        if(return_value != SUCCESS)
+            goto clean_up;
+    }
+
+    if(params->json)
+        printf("{\"corpus\":{\"path\":\"%s\",\"files\":%ld,\"bytes\":%llu},\"results\":[\n", params->path, corpus_nr_files, corpus_nr_bytes);
+    else
+        printf("corpus: %s, %ld files, %llu bytes\n%-8s %6s %6s %10s %12s %9s %9s %9s %9s %9s\n", params->path, corpus_nr_files, corpus_nr_bytes,
+               "op", "runs", "failed", "runs/s", "files/s", "min ms", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    bool first = true;
+    for(size_t op = 0; op < NR_BENCH_OPS; op++) {
+        if(!params->ops[op] || (bench_ops[op].per_file && nr_samples == 0))
+            continue;
+        for(int i = -params->nr_warmup_runs; i < params->nr_runs; i++) {
+            // parse and extract go through the sample files one after the other, so they are not always served from the same pages
+            const char * sample = bench_ops[op].per_file ? samples[(i + params->nr_warmup_runs) % nr_samples] : NULL;
+            strcpy(extra, params->extra);
+            build_args(params, bench_ops[op].name, sample, extra, args);
+            run_result_t result;
+            return_value = run_a1(args, &result, NULL);
+            if(return_value != SUCCESS)
+                goto clean_up;
+            if(i >= 0)
+                results[i] = result;
+        }
+        report(params, bench_ops[op].name, results, params->nr_runs, first);
+        first = false;
+    }
+    if(params->json)
+        printf("\n]}\n");
+
+    clean_up:
+    free(findall_output);
+    free(results);
+    return return_value;
+}
+
+int main(int argc, char **argv){
+    int return_value = SUCCESS;
+    bench_params_t params = {.extra = "",.nr_runs = 20,.nr_warmup_runs = 1,.json = false};
+    bool binary = false;
+    bool path = false;
+    bool ops = false;
+
+    for(int i=1;i<argc;i++) {
+        char * option = argv[i];
+        char * value = strchr(option,'=');
+        if(value == NULL) {
+            if(strcmp(option,"json") == 0)
+                params.json = true;
+            else
+                return_value = ERR_INVALID_ARGUMENTS;
+            continue;
+        }
+        *value++ = '\0';
+        if(strcmp(option,"bin") == 0 && strlen(value) <= MAX_PATH_SIZE) {
+            strcpy(params.binary,value);
+            binary = true;
+        }else if(strcmp(option,"path") == 0 && strlen(value) <= MAX_PATH_SIZE) {
+            strcpy(params.path,value);
+            path = true;
+        }else if(strcmp(option,"runs") == 0) {
+            params.nr_runs = strtol(value,NULL,10);
+        }else if(strcmp(option,"warmup") == 0) {
+            params.nr_warmup_runs = strtol(value,NULL,10);
+        }else if(strcmp(option,"options") == 0 && strlen(value) <= MAX_EXTRA_SIZE) {
+            strcpy(params.extra,value);
+        }else if(strcmp(option,"ops") == 0) {
+            char * saveptr;
+            for(char * name = strtok_r(value,",",&saveptr); name != NULL; name = strtok_r(NULL,",",&saveptr)) {
+                size_t op = 0;
+                while(op < NR_BENCH_OPS && strcmp(bench_ops[op].name,name) != 0)
+                    op++;
+                if(op == NR_BENCH_OPS)
+                    return_value = ERR_INVALID_ARGUMENTS;
+                else
+                    params.ops[op] = true;
+            }
+            ops = true;
+        }else {
+            return_value = ERR_INVALID_ARGUMENTS;
+        }
+    }
+    if(!binary || !path) {
+        return_value = ERR_MISSING_ARGUMENTS;
+        goto display_error_messages;
+    }
+    if(return_value != SUCCESS || params.nr_runs < 1 || params.nr_warmup_runs < 0) {
+        return_value = ERR_INVALID_ARGUMENTS;
+        goto display_error_messages;
+    }
+    if(!ops) {
+        for(size_t op = 0; op < NR_BENCH_OPS; op++)
+            params.ops[op] = true;
+    }
+
+    return_value = benchmark(&params);
+
+    display_error_messages:
+    if(return_value != SUCCESS) {
+        printf("ERROR\n");
+        if(return_value == ERR_MISSING_ARGUMENTS || return_value == ERR_INVALID_ARGUMENTS)
+            printf(" USAGE: a1_bench bin=<a1_path> path=<corpus_dir> [runs=<nr_runs>] [warmup=<nr_runs>] [ops=list,parse,extract,findall]\n"
+                   "        [options=\"<a1 options for list and findall>\"] [json]\n"
+                   "The order of the options is not relevant.\n");
+        else if(return_value == ERR_INVALID_PATH)
+            printf("invalid corpus path\n");
+        else if(return_value == ERR_ALLOCATING_MEMORY)
+            printf("Error allocating memory for the results.\n");
+        else
+            printf("Error running a1.\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "a1.h"
+#include "arena.h"
+
+/** enough for any type the program stores (long double and the 16 byte atomics included) */
+#define ARENA_ALIGNMENT 16
+
+typedef struct arena_block{
+    struct arena_block * next;
+    size_t size;
+    size_t used;
+    char data[] __attribute__((aligned(ARENA_ALIGNMENT)));
+}arena_block_t;
+
+struct arena{
+    /** the block being filled, followed by the full ones */
+    arena_block_t * blocks;
+};
+
+static arena_block_t * new_block(size_t size) {
+    arena_block_t * block = (arena_block_t*)malloc(sizeof(arena_block_t) + size);
+    if(block == NULL)
+        return NULL;
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+int arena_init(arena_t ** arena) {
+    arena_t * new_arena = (arena_t*)malloc(sizeof(arena_t));
+    if(new_arena == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    // the first block is only taken when something is allocated
+    new_arena->blocks = NULL;
+    *arena = new_arena;
+    return SUCCESS;
+}
+
+void arena_destroy(arena_t * arena) {
+    if(arena == NULL)
+        return;
+    while(arena->blocks != NULL) {
+        arena_block_t * next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+    free(arena);
+}
+
+/** Takes size bytes at the given alignment (a power of two) from the current block, starting a new block if needed. */
+static void * take(arena_t * arena, size_t size, size_t alignment) {
+    arena_block_t * block = arena->blocks;
+    size_t start = block != NULL ? (block->used + alignment - 1) & ~(alignment - 1) : 0;
+    if(block == NULL || start > block->size || block->size - start < size) {
+        if(size > ARENA_BLOCK_SIZE / 4) {
+            // a large request doesn't waste the rest of the current block: its own block goes behind it
+            arena_block_t * own = new_block(size);
+            if(own == NULL)
+                return NULL;
+            own->used = size;
+            if(block == NULL) {
+                arena->blocks = own;
+            }else {
+                own->next = block->next;
+                block->next = own;
+            }
+            return own->data;
+        }
+        block = new_block(ARENA_BLOCK_SIZE);
+        if(block == NULL)
+            return NULL;
+        block->next = arena->blocks;
+        arena->blocks = block;
+        start = 0;
+    }
+    block->used = start + size;
+    return block->data + start;
+}
+
+void * arena_alloc(arena_t * arena, size_t size) {
+    return take(arena, size, ARENA_ALIGNMENT);
+}
+
+char * arena_strndup(arena_t * arena, const char * text, size_t length) {
+    // strings need no alignment, so they are packed back to back
+    char * copy = (char*)take(arena, length + 1, 1);
+    if(copy == NULL)
+        return NULL;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    return copy;
+}
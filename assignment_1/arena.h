@@ -0,0 +1,22 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+/** Size of the blocks the arena takes from malloc; larger requests get a block of their own. */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/**
+ * Bump allocator: the allocations are carved back to back out of large blocks and are never freed
+ * one by one, all of them are released at once with arena_destroy. An arena is not thread safe.
+ */
+typedef struct arena arena_t;
+
+int arena_init(arena_t ** arena);
+void arena_destroy(arena_t * arena);
+/** Returns size bytes aligned for any type, NULL if no memory is left. */
+void * arena_alloc(arena_t * arena, size_t size);
+/** Copies the first length characters of text, adding the terminating '\0'. */
+char * arena_strndup(arena_t * arena, const char * text, size_t length);
+
+#endif
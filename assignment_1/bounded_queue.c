@@ -0,0 +1,58 @@
+#include <stdlib.h>
+
+#include "a1.h"
+#include "bounded_queue.h"
+
+int queue_init(bounded_queue_t * queue, size_t capacity) {
+    queue->items = (void**)malloc(capacity * sizeof(void*));
+    if(queue->items == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    queue->closed = false;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    return SUCCESS;
+}
+
+void queue_destroy(bounded_queue_t * queue) {
+    free(queue->items);
+    queue->items = NULL;
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
+
+void queue_push(bounded_queue_t * queue, void * item) {
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count == queue->capacity)
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    queue->items[(queue->head + queue->count) % queue->capacity] = item;
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+bool queue_pop(bounded_queue_t * queue, void ** item) {
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count == 0 && !queue->closed)
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    bool found = queue->count > 0;
+    if(found) {
+        *item = queue->items[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+void queue_close(bounded_queue_t * queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
@@ -0,0 +1,30 @@
+#ifndef __BOUNDED_QUEUE_H__
+#define __BOUNDED_QUEUE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/** Fixed-capacity FIFO of pointers between the threads of two stages; a full queue makes the producer wait. */
+typedef struct bounded_queue{
+    void ** items;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    /** no item will be pushed anymore */
+    bool closed;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+}bounded_queue_t;
+
+int queue_init(bounded_queue_t * queue, size_t capacity);
+void queue_destroy(bounded_queue_t * queue);
+/** Waits for a free place and appends the item. */
+void queue_push(bounded_queue_t * queue, void * item);
+/** Waits for an item; returns false once the queue is closed and empty. */
+bool queue_pop(bounded_queue_t * queue, void ** item);
+/** Lets the consumers finish once the queued items are taken. */
+void queue_close(bounded_queue_t * queue);
+
+#endif
@@ -0,0 +1,459 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "a1.h"
+#include "dir_walker.h"
+#include "arena.h"
+#include "run_stats.h"
+
+#define INITIAL_DEQUE_CAPACITY 64
+#define IDLE_WAIT_NS 1000000L
+#define DENTS_BUF_SIZE (32 * 1024)
+
+/** Record returned by the getdents64 system call. */
+struct linux_dirent64{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/**
+ * The inode of a directory being listed, linked to those of its ancestors. A directory found again among its own
+ * ancestors (through a bind mount inside itself) would be walked forever, it is skipped.
+ */
+typedef struct dir_chain{
+    const struct dir_chain * parent;
+    dev_t dev;
+    ino_t ino;
+}dir_chain_t;
+
+/**
+ * A directory found by the parallel walk, stored as its name and a link to its parent instead of its whole path.
+ * The nodes are allocated from the arena of the worker which found them and released together at the end of the walk.
+ */
+typedef struct dir_node{
+    const struct dir_node * parent;
+    /** the inodes of the parent directory and its ancestors, NULL for the root */
+    const dir_chain_t * ancestors;
+    /** the path given to the walk for the root */
+    char name[];
+}dir_node_t;
+
+/** Directories waiting to be listed by a worker. The owner works at the tail, thieves at the head. */
+typedef struct dir_deque{
+    pthread_mutex_t lock;
+    dir_node_t ** dirs;
+    int head;
+    int tail;
+    int capacity;
+}dir_deque_t;
+
+typedef struct walker{
+    bool recursive;
+    int nr_threads;
+    walk_visitor_t visitor;
+    void * arg;
+    dir_deque_t * deques;
+    /** number of directories which are queued or being listed */
+    long pending;
+    /** first error reported by a worker or by the visitor */
+    int status;
+    /** used by the idle workers to wait for new directories */
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    int nr_idle;
+    /** the directory nodes found by each worker */
+    arena_t * arenas[MAX_NR_THREADS];
+}walker_t;
+
+typedef struct worker_args{
+    walker_t * walker;
+    int id;
+}worker_args_t;
+
+static int list_directory(walker_t * walker, int id, const dir_node_t * dir, const dir_chain_t * ancestors, int dir_fd, char * path, size_t path_length);
+
+static bool push_dir(dir_deque_t * deque, dir_node_t * dir) {
+    pthread_mutex_lock(&deque->lock);
+    if(deque->tail == deque->capacity) {
+        // move the remaining directories to the start, or grow the deque if it is full
+        int count = deque->tail - deque->head;
+        if(count * 2 > deque->capacity) {
+            dir_node_t ** dirs = (dir_node_t**)realloc(deque->dirs, sizeof(dir_node_t*) * deque->capacity * 2);
+            if(dirs == NULL) {
+                pthread_mutex_unlock(&deque->lock);
+                return false;
+            }
+            deque->dirs = dirs;
+            deque->capacity *= 2;
+        }
+        memmove(deque->dirs, deque->dirs + deque->head, sizeof(dir_node_t*) * count);
+        deque->head = 0;
+        deque->tail = count;
+    }
+    deque->dirs[deque->tail++] = dir;
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+static dir_node_t * pop_dir(dir_deque_t * deque) {
+    dir_node_t * dir = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if(deque->tail > deque->head)
+        dir = deque->dirs[--deque->tail];
+    pthread_mutex_unlock(&deque->lock);
+    return dir;
+}
+
+static dir_node_t * steal_dir(dir_deque_t * deque) {
+    dir_node_t * dir = NULL;
+    // don't wait for a busy victim, there are others to try
+    if(pthread_mutex_trylock(&deque->lock) != 0)
+        return NULL;
+    if(deque->tail > deque->head)
+        dir = deque->dirs[deque->head++];
+    pthread_mutex_unlock(&deque->lock);
+    return dir;
+}
+
+/** Appends "/name" to the path of the given length, cutting it at MAX_PATH_SIZE - 1 characters. Returns the new length. */
+static size_t append_name(char * path, size_t length, const char * name) {
+    const size_t limit = MAX_PATH_SIZE - 1;
+    if(length < limit)
+        path[length++] = '/';
+    size_t name_length = strlen(name);
+    if(name_length > limit - length)
+        name_length = limit - length;
+    memcpy(path + length, name, name_length);
+    length += name_length;
+    path[length] = '\0';
+    return length;
+}
+
+/** Writes the path of the directory node into path (MAX_PATH_SIZE + 1 bytes). Returns its length. */
+static size_t build_path(const dir_node_t * dir, char * path) {
+    if(dir->parent != NULL)
+        return append_name(path, build_path(dir->parent, path), dir->name);
+    size_t length = strlen(dir->name);
+    if(length > MAX_PATH_SIZE - 1)
+        length = MAX_PATH_SIZE - 1;
+    memcpy(path, dir->name, length);
+    path[length] = '\0';
+    return length;
+}
+
+static dir_node_t * new_dir_node(arena_t * arena, const dir_node_t * parent, const dir_chain_t * ancestors, const char * name) {
+    size_t length = strlen(name);
+    dir_node_t * dir = (dir_node_t*)arena_alloc(arena, sizeof(dir_node_t) + length + 1);
+    if(dir == NULL)
+        return NULL;
+    dir->parent = parent;
+    dir->ancestors = ancestors;
+    memcpy(dir->name, name, length + 1);
+    return dir;
+}
+
+static void set_status(walker_t * walker, int status) {
+    int expected = SUCCESS;
+    __atomic_compare_exchange_n(&walker->status, &expected, status, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static int schedule_dir(walker_t * walker, int id, const dir_node_t * parent, const dir_chain_t * ancestors, const char * name) {
+    dir_node_t * dir = new_dir_node(walker->arenas[id], parent, ancestors, name);
+    if(dir == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    __atomic_add_fetch(&walker->pending, 1, __ATOMIC_SEQ_CST);
+    if(!push_dir(&walker->deques[id], dir)) {
+        __atomic_sub_fetch(&walker->pending, 1, __ATOMIC_SEQ_CST);
+        return ERR_ALLOCATING_MEMORY;
+    }
+    // wake up a worker which ran out of directories
+    if(__atomic_load_n(&walker->nr_idle, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&walker->idle_lock);
+        pthread_cond_signal(&walker->idle_cond);
+        pthread_mutex_unlock(&walker->idle_lock);
+    }
+    return SUCCESS;
+}
+
+mode_t walk_entry_type(walk_entry_t * entry) {
+    switch(entry->d_type) {
+        case DT_REG: return S_IFREG;
+        case DT_DIR: return S_IFDIR;
+        case DT_LNK: return S_IFLNK;
+        case DT_CHR: return S_IFCHR;
+        case DT_BLK: return S_IFBLK;
+        case DT_FIFO: return S_IFIFO;
+        case DT_SOCK: return S_IFSOCK;
+        default: break;
+    }
+    const struct stat * inode = walk_entry_inode(entry);
+    return inode != NULL ? (inode->st_mode & S_IFMT) : 0;
+}
+
+const struct stat * walk_entry_inode(walk_entry_t * entry) {
+    if(!entry->has_inode) {
+        uint64_t start = stats_clock();
+        int failed = fstatat(entry->dir_fd, entry->name, &entry->inode, AT_SYMLINK_NOFOLLOW);
+        stats_add(STATS_CALLS_STAT, 1);
+        stats_add_time(STATS_TIME_STAT, start);
+        if(failed != 0)
+            return NULL;
+        entry->has_inode = true;
+    }
+    return &entry->inode;
+}
+
+/**
+ * Lists the directory whose path fills the first path_length characters of path (a buffer of MAX_PATH_SIZE + 1 bytes).
+ * The path of each entry is written right after it, so the subdirectories listed by a single thread share the
+ * same buffer. dir is the node of the directory in a parallel walk, whose subdirectories are linked to it.
+ * ancestors are the inodes of the directories above this one. If dir_fd is not -1 it is the already opened directory,
+ * otherwise the path is opened here. The descriptor is closed before returning.
+ */
+static int list_directory(walker_t * walker, int id, const dir_node_t * dir, const dir_chain_t * ancestors, int dir_fd, char * path, size_t path_length) {
+    walk_entry_t walk_entry;
+    int return_value = SUCCESS;
+    char * buf = NULL;
+    long nr_bytes;
+
+    if(dir_fd < 0) {
+        dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        stats_add(STATS_CALLS_OPEN, 1);
+    }
+    if(dir_fd < 0)
+        return ERR_INVALID_PATH;
+    // the inode of the opened directory, not the one getdents reported: a mount point reports the directory under it
+    struct stat dir_inode;
+    dir_chain_t own_chain;
+    dir_chain_t * chain = &own_chain;
+    uint64_t start = stats_clock();
+    int failed = fstat(dir_fd, &dir_inode);
+    stats_add(STATS_CALLS_STAT, 1);
+    stats_add_time(STATS_TIME_STAT, start);
+    if(failed != 0) {
+        return_value = ERR_INVALID_PATH;
+        goto clean_up;
+    }
+    // only a directory inside itself is skipped: one reached under two paths is listed under both, whatever the timing
+    for(const dir_chain_t * ancestor = ancestors; ancestor != NULL; ancestor = ancestor->parent) {
+        if(ancestor->dev == dir_inode.st_dev && ancestor->ino == dir_inode.st_ino)
+            goto clean_up;
+    }
+    // the subdirectories of a parallel walk are listed after this call returns, their chain lives in the arena
+    if(dir != NULL) {
+        chain = (dir_chain_t*)arena_alloc(walker->arenas[id], sizeof(dir_chain_t));
+        if(chain == NULL) {
+            return_value = ERR_ALLOCATING_MEMORY;
+            goto clean_up;
+        }
+    }
+    chain->parent = ancestors;
+    chain->dev = dir_inode.st_dev;
+    chain->ino = dir_inode.st_ino;
+    stats_add(STATS_DIRS_VISITED, 1);
+    // the buffer outlives the recursive calls into the subdirectories, so every level has its own
+    buf = (char*)malloc(DENTS_BUF_SIZE);
+    if(buf == NULL) {
+        return_value = ERR_ALLOCATING_MEMORY;
+        goto clean_up;
+    }
+    for(;;) {
+        start = stats_clock();
+        nr_bytes = syscall(SYS_getdents64, dir_fd, buf, DENTS_BUF_SIZE);
+        stats_add(STATS_CALLS_GETDENTS, 1);
+        stats_add_time(STATS_TIME_TRAVERSAL, start);
+        if(nr_bytes <= 0)
+            break;
+        for(long pos = 0; pos < nr_bytes; ) {
+            struct linux_dirent64 * entry = (struct linux_dirent64*)(buf + pos);
+            pos += entry->d_reclen;
+            if(__atomic_load_n(&walker->status, __ATOMIC_RELAXED) != SUCCESS)
+                goto clean_up;
+            // exclude the parent and current directory
+            if(strcmp(entry->d_name,"..") == 0 || strcmp(entry->d_name,".") == 0)
+                continue;
+            size_t entry_path_length = append_name(path, path_length, entry->d_name);
+            walk_entry.path = path;
+            walk_entry.name = entry->d_name;
+            walk_entry.dir_fd = dir_fd;
+            walk_entry.d_type = entry->d_type;
+            walk_entry.has_inode = false;
+            if(entry->d_type != DT_DIR)
+                stats_add(STATS_FILES_VISITED, 1);
+            return_value = walker->visitor(&walk_entry, walker->arg);
+            if(return_value != SUCCESS)
+                goto clean_up;
+            if(walker->recursive && walk_entry_type(&walk_entry) == S_IFDIR) {
+                if(walker->nr_threads == 1) {
+                    // a single thread keeps the depth-first order of a plain recursive walk and
+                    // opens the subdirectory relative to this one instead of resolving the whole path again
+                    int sub_dir_fd = openat(dir_fd, entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                    stats_add(STATS_CALLS_OPEN, 1);
+                    if(sub_dir_fd < 0) {
+                        return_value = ERR_INVALID_PATH;
+                        goto clean_up;
+                    }
+                    return_value = list_directory(walker, id, NULL, chain, sub_dir_fd, path, entry_path_length);
+                }else {
+                    return_value = schedule_dir(walker, id, dir, chain, entry->d_name);
+                }
+                if(return_value != SUCCESS)
+                    goto clean_up;
+            }
+        }
+    }
+    if(nr_bytes < 0)
+        return_value = ERR_INVALID_PATH;
+    clean_up:
+    free(buf);
+    close(dir_fd);
+    return return_value;
+}
+
+static dir_node_t * find_work(walker_t * walker, int id) {
+    dir_node_t * dir = pop_dir(&walker->deques[id]);
+    for(int i=1; dir == NULL && i<walker->nr_threads; i++) {
+        dir = steal_dir(&walker->deques[(id + i) % walker->nr_threads]);
+    }
+    return dir;
+}
+
+static void * worker_thread(void * arg) {
+    walker_t * walker = ((worker_args_t*)arg)->walker;
+    int id = ((worker_args_t*)arg)->id;
+    // the path of the directory being listed, rebuilt from its node
+    char path[MAX_PATH_SIZE+1];
+
+    while(__atomic_load_n(&walker->pending, __ATOMIC_SEQ_CST) > 0) {
+        dir_node_t * dir = find_work(walker, id);
+        if(dir == NULL) {
+            // nothing to steal right now, wait until a directory is pushed or the walk ends
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += IDLE_WAIT_NS;
+            if(deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_mutex_lock(&walker->idle_lock);
+            walker->nr_idle++;
+            if(__atomic_load_n(&walker->pending, __ATOMIC_SEQ_CST) > 0)
+                pthread_cond_timedwait(&walker->idle_cond, &walker->idle_lock, &deadline);
+            walker->nr_idle--;
+            pthread_mutex_unlock(&walker->idle_lock);
+            continue;
+        }
+        if(__atomic_load_n(&walker->status, __ATOMIC_RELAXED) == SUCCESS) {
+            int return_value = list_directory(walker, id, dir, dir->ancestors, -1, path, build_path(dir, path));
+            if(return_value != SUCCESS)
+                set_status(walker, return_value);
+        }
+        if(__atomic_sub_fetch(&walker->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+            // the last directory was listed, release the idle workers
+            pthread_mutex_lock(&walker->idle_lock);
+            pthread_cond_broadcast(&walker->idle_cond);
+            pthread_mutex_unlock(&walker->idle_lock);
+        }
+    }
+    return NULL;
+}
+
+static int walk_in_parallel(walker_t * walker, const char * dir_path) {
+    int return_value = SUCCESS;
+    int nr_started = 0;
+    pthread_t threads[MAX_NR_THREADS];
+    worker_args_t args[MAX_NR_THREADS];
+
+    walker->deques = (dir_deque_t*)calloc(walker->nr_threads, sizeof(dir_deque_t));
+    if(walker->deques == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    for(int i=0;i<walker->nr_threads;i++) {
+        pthread_mutex_init(&walker->deques[i].lock, NULL);
+        walker->deques[i].capacity = INITIAL_DEQUE_CAPACITY;
+        walker->deques[i].dirs = (dir_node_t**)malloc(sizeof(dir_node_t*) * INITIAL_DEQUE_CAPACITY);
+        if(walker->deques[i].dirs == NULL || arena_init(&walker->arenas[i]) != SUCCESS) {
+            return_value = ERR_ALLOCATING_MEMORY;
+            goto clean_up;
+        }
+    }
+    pthread_mutex_init(&walker->idle_lock, NULL);
+    pthread_cond_init(&walker->idle_cond, NULL);
+
+    // the root is listed by the first worker, the others start by stealing its subdirectories
+    walker->pending = 1;
+    dir_node_t * root = new_dir_node(walker->arenas[0], NULL, NULL, dir_path);
+    if(root == NULL || !push_dir(&walker->deques[0], root)) {
+        return_value = ERR_ALLOCATING_MEMORY;
+        goto clean_up;
+    }
+    for(int i=0;i<walker->nr_threads;i++) {
+        args[i].walker = walker;
+        args[i].id = i;
+        if(pthread_create(&threads[i], NULL, worker_thread, &args[i]) != 0) {
+            set_status(walker, ERR_CREATING_THREAD);
+            break;
+        }
+        nr_started++;
+    }
+    if(nr_started == 0) {
+        // nobody is left to drain the deques
+        walker->pending = 0;
+    }
+    for(int i=0;i<nr_started;i++) {
+        pthread_join(threads[i], NULL);
+    }
+    return_value = walker->status;
+
+    pthread_cond_destroy(&walker->idle_cond);
+    pthread_mutex_destroy(&walker->idle_lock);
+    clean_up:
+    for(int i=0;i<walker->nr_threads;i++) {
+        // the nodes left in the deques after a failure go with the arenas
+        free(walker->deques[i].dirs);
+        arena_destroy(walker->arenas[i]);
+        pthread_mutex_destroy(&walker->deques[i].lock);
+    }
+    free(walker->deques);
+    return return_value;
+}
+
+int walk_directory_tree(const char * dir_path, bool recursive, int nr_threads, walk_visitor_t visitor, void * arg) {
+    walker_t walker = {.recursive = recursive, .nr_threads = nr_threads, .visitor = visitor, .arg = arg,
+                       .deques = NULL, .pending = 0, .status = SUCCESS, .nr_idle = 0, .arenas = {NULL}};
+    int return_value;
+
+    // the root has to be a readable directory, the failure is not deferred to a worker
+    int dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    stats_add(STATS_CALLS_OPEN, 1);
+    if(dir_fd < 0)
+        return ERR_INVALID_PATH;
+    if(nr_threads <= 1 || !recursive) {
+        char path[MAX_PATH_SIZE+1];
+        size_t path_length = strlen(dir_path);
+        if(path_length > MAX_PATH_SIZE - 1)
+            path_length = MAX_PATH_SIZE - 1;
+        memcpy(path, dir_path, path_length);
+        path[path_length] = '\0';
+        walker.nr_threads = 1;
+        return_value = list_directory(&walker, 0, NULL, NULL, dir_fd, path, path_length);
+    }else {
+        close(dir_fd);
+        if(nr_threads > MAX_NR_THREADS)
+            walker.nr_threads = MAX_NR_THREADS;
+        return_value = walk_in_parallel(&walker, dir_path);
+    }
+    return return_value;
+}
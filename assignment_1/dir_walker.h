@@ -0,0 +1,47 @@
+#ifndef __DIR_WALKER_H__
+#define __DIR_WALKER_H__
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/** An entry found while walking a directory tree. */
+typedef struct walk_entry{
+    /** path of the entry, built from the root of the walk */
+    const char * path;
+    /** name of the entry inside its parent directory */
+    const char * name;
+    /** open descriptor of the parent directory, usable with the *at() system calls */
+    int dir_fd;
+    /** file type reported by getdents64 (DT_UNKNOWN if the file system doesn't fill it in) */
+    unsigned char d_type;
+    /** set once the inode was fetched */
+    bool has_inode;
+    struct stat inode;
+}walk_entry_t;
+
+/**
+ * Called once for every entry of the tree. A return value other than SUCCESS stops the walk
+ * and is returned by walk_directory_tree. With more than one thread the visitor is called concurrently.
+ */
+typedef int (*walk_visitor_t)(walk_entry_t * entry, void * arg);
+
+/** Returns the file type bits (S_IFMT) of the entry, calling fstatat only if d_type is unknown. Returns 0 on failure. */
+mode_t walk_entry_type(walk_entry_t * entry);
+/** Returns the lstat-like details of the entry, fetched with fstatat on the parent directory the first time. NULL on failure. */
+const struct stat * walk_entry_inode(walk_entry_t * entry);
+
+/**
+ * Walks the tree rooted at dir_path and calls the visitor for each entry (except "." and "..").
+ * The directories are read with getdents64 and no entry is stat-ed unless the visitor asks for its inode.
+ * With nr_threads == 1 the entries are visited depth-first, in readdir order, on the calling thread.
+ * Otherwise the directories are distributed between nr_threads workers, each owning a deque of
+ * directories: a worker takes the most recently found directory from its own deque and, when it
+ * runs out of work, steals the oldest directory from the deque of another worker.
+ * Symbolic links are never followed, and a directory whose (dev, ino) is one of its own ancestors (reached again through
+ * a bind mount inside itself) is skipped with its whole subtree, so the walk ends on any tree. A directory reachable
+ * under several paths is listed under each of them, so the entries don't depend on which thread gets there first.
+ */
+int walk_directory_tree(const char * dir_path, bool recursive, int nr_threads, walk_visitor_t visitor, void * arg);
+
+#endif
@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "file_table.h"
+#include "section_scan.h"
+#include "run_stats.h"
+
+int file_table_init(file_table_t * table, size_t capacity, const sf_rules_t * rules) {
+    table->entries = (file_table_entry_t*)calloc(capacity, sizeof(file_table_entry_t));
+    if(table->entries == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    table->capacity = capacity;
+    table->clock = 0;
+    table->rules = rules;
+    pthread_mutex_init(&table->lock, NULL);
+    return SUCCESS;
+}
+
+void file_table_destroy(file_table_t * table) {
+    for(size_t i = 0; i < table->capacity; i++) {
+        if(table->entries[i].used)
+            close(table->entries[i].fd);
+    }
+    free(table->entries);
+    table->entries = NULL;
+    pthread_mutex_destroy(&table->lock);
+}
+
+static void drop_locked(file_table_entry_t * entry) {
+    close(entry->fd);
+    entry->used = false;
+    if(entry->detached)
+        free(entry);
+}
+
+/** Finds a free slot, or frees the least recently used entry nobody is using. NULL if every entry is in use. */
+static file_table_entry_t * free_slot_locked(file_table_t * table) {
+    file_table_entry_t * victim = NULL;
+    for(size_t i = 0; i < table->capacity; i++) {
+        file_table_entry_t * entry = &table->entries[i];
+        if(!entry->used)
+            return entry;
+        if(entry->refs == 0 && (victim == NULL || entry->last_use < victim->last_use))
+            victim = entry;
+    }
+    if(victim != NULL)
+        drop_locked(victim);
+    return victim;
+}
+
+int file_table_acquire(file_table_t * table, const char * path, file_table_entry_t ** entry) {
+    struct stat inode;
+    sf_cache_key_t key;
+
+    stats_add(STATS_CALLS_STAT, 1);
+    if(strlen(path) > MAX_PATH_SIZE || stat(path, &inode) != 0)
+        return ERR_INVALID_PATH;
+    sf_cache_key_from_stat(&inode, &key);
+
+    pthread_mutex_lock(&table->lock);
+    for(size_t i = 0; i < table->capacity; i++) {
+        file_table_entry_t * current = &table->entries[i];
+        if(!current->used || current->stale || strcmp(current->path, path) != 0)
+            continue;
+        if(memcmp(&current->key, &key, sizeof(key)) == 0) {
+            // same version of the file: no open and no read at all
+            current->refs++;
+            current->last_use = ++table->clock;
+            *entry = current;
+            pthread_mutex_unlock(&table->lock);
+            return SUCCESS;
+        }
+        current->stale = true;
+        if(current->refs == 0)
+            drop_locked(current);
+    }
+    pthread_mutex_unlock(&table->lock);
+
+    // open and parse the file without holding the table
+    file_table_entry_t opened;
+    opened.fd = open(path, O_RDONLY | O_CLOEXEC);
+    stats_add(STATS_CALLS_OPEN, 1);
+    if(opened.fd < 0)
+        return ERR_INVALID_PATH;
+    if(fstat(opened.fd, &inode) == 0)
+        sf_cache_key_from_stat(&inode, &key);
+    int status = scan_read_header(opened.fd, table->rules, &opened.sf_header, &opened.failure_src);
+    if(status == SF_ERR_READING_FILE) {
+        close(opened.fd);
+        return ERR_READING_FILE;
+    }
+    strcpy(opened.path, path);
+    opened.key = key;
+    opened.parse_status = status == SF_ERR_INVALID_FORMAT ? ERR_INVALID_FILE_FORMAT : SUCCESS;
+    opened.refs = 1;
+    opened.used = true;
+    opened.stale = false;
+    opened.detached = false;
+
+    pthread_mutex_lock(&table->lock);
+    opened.last_use = ++table->clock;
+    file_table_entry_t * slot = free_slot_locked(table);
+    if(slot == NULL) {
+        slot = (file_table_entry_t*)malloc(sizeof(file_table_entry_t));
+        if(slot == NULL) {
+            pthread_mutex_unlock(&table->lock);
+            close(opened.fd);
+            return ERR_ALLOCATING_MEMORY;
+        }
+        opened.detached = true;
+    }
+    *slot = opened;
+    *entry = slot;
+    pthread_mutex_unlock(&table->lock);
+    return SUCCESS;
+}
+
+void file_table_release(file_table_t * table, file_table_entry_t * entry) {
+    pthread_mutex_lock(&table->lock);
+    entry->refs--;
+    if(entry->refs == 0 && (entry->stale || entry->detached))
+        drop_locked(entry);
+    pthread_mutex_unlock(&table->lock);
+}
@@ -0,0 +1,50 @@
+#ifndef __FILE_TABLE_H__
+#define __FILE_TABLE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "a1.h"
+#include "sf_cache.h"
+#include "../common/sf_format.h"
+
+/** An sf file kept open, together with its parsed header. */
+typedef struct file_table_entry{
+    char path[MAX_PATH_SIZE+1];
+    int fd;
+    /** version of the file the header was parsed from */
+    sf_cache_key_t key;
+    /** SUCCESS or ERR_INVALID_FILE_FORMAT */
+    int parse_status;
+    sf_invalid_field_t failure_src;
+    sf_file_header_t sf_header;
+    int refs;
+    unsigned long last_use;
+    bool used;
+    /** the file changed since it was opened, the entry is dropped with its last reference */
+    bool stale;
+    /** allocated outside the table because every slot was busy */
+    bool detached;
+}file_table_entry_t;
+
+/** Open files shared between the requests of the query server, replaced in least recently used order. */
+typedef struct file_table{
+    file_table_entry_t * entries;
+    size_t capacity;
+    unsigned long clock;
+    const sf_rules_t * rules;
+    pthread_mutex_t lock;
+}file_table_t;
+
+int file_table_init(file_table_t * table, size_t capacity, const sf_rules_t * rules);
+void file_table_destroy(file_table_t * table);
+/**
+ * Returns the entry of the file, reusing the open descriptor and the parsed header as long as the file
+ * (its inode, size and modification time) didn't change. Returns ERR_INVALID_PATH if the file can't be opened
+ * and ERR_READING_FILE if its header can't be read; otherwise the entry must be given back with file_table_release.
+ */
+int file_table_acquire(file_table_t * table, const char * path, file_table_entry_t ** entry);
+void file_table_release(file_table_t * table, file_table_entry_t * entry);
+
+#endif
@@ -0,0 +1,402 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "a1.h"
+#include "filter_expr.h"
+#include "section_scan.h"
+#include "sf_v2.h"
+#include "run_stats.h"
+
+typedef enum {NODE_AND, NODE_OR, NODE_NOT, NODE_SUFFIX, NODE_NAME, NODE_TYPE, NODE_PERM,
+              NODE_SF, NODE_VERSION, NODE_SECTIONS, NODE_SECT_TYPE, NODE_LINES} node_kind_t;
+typedef enum {OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE} compare_op_t;
+
+/** What evaluating a predicate costs, the plan evaluates the cheaper ones first. */
+enum {COST_NAME, COST_TYPE, COST_INODE, COST_HEADER, COST_SECTIONS};
+
+typedef struct filter_node{
+    node_kind_t kind;
+    int cost;
+    compare_op_t op;
+    long value;
+    char * text;
+    size_t text_length;
+    mode_t type;
+    struct filter_node ** children;
+    int nr_children;
+}filter_node_t;
+
+struct filter_expr{
+    filter_node_t * root;
+};
+
+typedef struct parser{
+    const char * pos;
+    bool failed;
+}parser_t;
+
+static filter_node_t * parse_expression(parser_t * parser);
+
+static filter_node_t * new_node(node_kind_t kind, int cost) {
+    filter_node_t * node = (filter_node_t*)calloc(1, sizeof(filter_node_t));
+    if(node != NULL) {
+        node->kind = kind;
+        node->cost = cost;
+    }
+    return node;
+}
+
+static void free_node(filter_node_t * node) {
+    if(node == NULL)
+        return;
+    for(int i = 0; i < node->nr_children; i++)
+        free_node(node->children[i]);
+    free(node->children);
+    free(node->text);
+    free(node);
+}
+
+static bool add_child(filter_node_t * node, filter_node_t * child) {
+    filter_node_t ** children = (filter_node_t**)realloc(node->children, (node->nr_children + 1) * sizeof(filter_node_t*));
+    if(children == NULL)
+        return false;
+    node->children = children;
+    node->children[node->nr_children++] = child;
+    return true;
+}
+
+static bool starts_with(parser_t * parser, const char * word) {
+    size_t length = strlen(word);
+    if(strncmp(parser->pos, word, length) != 0)
+        return false;
+    parser->pos += length;
+    return true;
+}
+
+/** Reads the text of a predicate, up to the next operator. */
+static char * parse_text(parser_t * parser, size_t * length) {
+    const char * start = parser->pos;
+    while(*parser->pos != 0 && strchr("&|)", *parser->pos) == NULL)
+        parser->pos++;
+    *length = parser->pos - start;
+    char * text = (char*)malloc(*length + 1);
+    if(text != NULL) {
+        memcpy(text, start, *length);
+        text[*length] = 0;
+    }
+    return text;
+}
+
+static bool parse_comparison(parser_t * parser, filter_node_t * node) {
+    if(starts_with(parser, "!="))
+        node->op = OP_NE;
+    else if(starts_with(parser, "<="))
+        node->op = OP_LE;
+    else if(starts_with(parser, ">="))
+        node->op = OP_GE;
+    else if(starts_with(parser, "="))
+        node->op = OP_EQ;
+    else if(starts_with(parser, "<"))
+        node->op = OP_LT;
+    else if(starts_with(parser, ">"))
+        node->op = OP_GT;
+    else
+        return false;
+    if(!isdigit((unsigned char)*parser->pos))
+        return false;
+    node->value = strtol(parser->pos, (char**)&parser->pos, 10);
+    return true;
+}
+
+static filter_node_t * parse_predicate(parser_t * parser) {
+    filter_node_t * node = NULL;
+    if(starts_with(parser, "suffix:")) {
+        node = new_node(NODE_SUFFIX, COST_NAME);
+        if(node != NULL && (node->text = parse_text(parser, &node->text_length)) == NULL)
+            parser->failed = true;
+    }else if(starts_with(parser, "name:")) {
+        node = new_node(NODE_NAME, COST_NAME);
+        if(node != NULL && (node->text = parse_text(parser, &node->text_length)) == NULL)
+            parser->failed = true;
+    }else if(starts_with(parser, "type:")) {
+        static const char letters[] = "fdlpscb";
+        static const mode_t types[] = {S_IFREG, S_IFDIR, S_IFLNK, S_IFIFO, S_IFSOCK, S_IFCHR, S_IFBLK};
+        const char * letter = *parser->pos != 0 ? strchr(letters, *parser->pos) : NULL;
+        node = new_node(NODE_TYPE, COST_TYPE);
+        if(letter == NULL)
+            parser->failed = true;
+        else if(node != NULL) {
+            node->type = types[letter - letters];
+            parser->pos++;
+        }
+    }else if(starts_with(parser, "perm:")) {
+        node = new_node(NODE_PERM, COST_INODE);
+        if(node != NULL && (node->text = parse_text(parser, &node->text_length)) != NULL && node->text_length == 9) {
+            // the same bits as permissions=: every position which is not '-' is required
+            for(int i = 0; i < 9; i++) {
+                if(node->text[i] != '-')
+                    node->value |= 1l << (8 - i);
+            }
+        }else {
+            parser->failed = true;
+        }
+    }else if(starts_with(parser, "sect_type:")) {
+        node = new_node(NODE_SECT_TYPE, COST_HEADER);
+        if(!isdigit((unsigned char)*parser->pos))
+            parser->failed = true;
+        else if(node != NULL)
+            node->value = strtol(parser->pos, (char**)&parser->pos, 10);
+    }else if(starts_with(parser, "version")) {
+        node = new_node(NODE_VERSION, COST_HEADER);
+        if(node != NULL && !parse_comparison(parser, node))
+            parser->failed = true;
+    }else if(starts_with(parser, "sections")) {
+        node = new_node(NODE_SECTIONS, COST_HEADER);
+        if(node != NULL && !parse_comparison(parser, node))
+            parser->failed = true;
+    }else if(starts_with(parser, "lines")) {
+        node = new_node(NODE_LINES, COST_SECTIONS);
+        if(node != NULL && !parse_comparison(parser, node))
+            parser->failed = true;
+    }else if(starts_with(parser, "sf")) {
+        node = new_node(NODE_SF, COST_HEADER);
+    }else {
+        parser->failed = true;
+    }
+    if(node == NULL)
+        parser->failed = true;
+    return node;
+}
+
+static filter_node_t * parse_factor(parser_t * parser) {
+    if(starts_with(parser, "!")) {
+        filter_node_t * node = new_node(NODE_NOT, 0);
+        filter_node_t * child = parse_factor(parser);
+        if(node == NULL || !add_child(node, child)) {
+            free_node(child);
+            parser->failed = true;
+        }
+        return node;
+    }
+    if(starts_with(parser, "(")) {
+        filter_node_t * node = parse_expression(parser);
+        if(!starts_with(parser, ")"))
+            parser->failed = true;
+        return node;
+    }
+    return parse_predicate(parser);
+}
+
+/** Parses the operands of a '&' or '|' chain, flattened into a single node. */
+static filter_node_t * parse_chain(parser_t * parser, node_kind_t kind, char separator) {
+    filter_node_t * first = kind == NODE_AND ? parse_factor(parser) : parse_chain(parser, NODE_AND, '&');
+    if(*parser->pos != separator || parser->failed)
+        return first;
+    filter_node_t * node = new_node(kind, 0);
+    if(node == NULL || !add_child(node, first)) {
+        free_node(first);
+        parser->failed = true;
+        return node;
+    }
+    while(!parser->failed && *parser->pos == separator) {
+        parser->pos++;
+        filter_node_t * child = kind == NODE_AND ? parse_factor(parser) : parse_chain(parser, NODE_AND, '&');
+        if(!add_child(node, child)) {
+            free_node(child);
+            parser->failed = true;
+        }
+    }
+    return node;
+}
+
+static filter_node_t * parse_expression(parser_t * parser) {
+    return parse_chain(parser, NODE_OR, '|');
+}
+
+static int compare_cost(const void * a, const void * b) {
+    const filter_node_t * first = *(filter_node_t * const *)a;
+    const filter_node_t * second = *(filter_node_t * const *)b;
+    return first->cost - second->cost;
+}
+
+/** Orders the operands by cost; a node costs as much as its most expensive operand. */
+static void plan(filter_node_t * node) {
+    if(node->nr_children == 0)
+        return;
+    for(int i = 0; i < node->nr_children; i++)
+        plan(node->children[i]);
+    qsort(node->children, node->nr_children, sizeof(filter_node_t*), compare_cost);
+    node->cost = node->children[node->nr_children - 1]->cost;
+}
+
+int filter_expr_compile(const char * text, filter_expr_t ** expr) {
+    parser_t parser = {.pos = text, .failed = false};
+    filter_node_t * root = parse_expression(&parser);
+    if(parser.failed || *parser.pos != 0 || root == NULL) {
+        free_node(root);
+        return ERR_INVALID_ARGUMENTS;
+    }
+    *expr = (filter_expr_t*)malloc(sizeof(filter_expr_t));
+    if(*expr == NULL) {
+        free_node(root);
+        return ERR_ALLOCATING_MEMORY;
+    }
+    plan(root);
+    (*expr)->root = root;
+    return SUCCESS;
+}
+
+void filter_expr_free(filter_expr_t * expr) {
+    if(expr == NULL)
+        return;
+    free_node(expr->root);
+    free(expr);
+}
+
+static bool compare(long actual, compare_op_t op, long value) {
+    switch(op) {
+        case OP_EQ: return actual == value;
+        case OP_NE: return actual != value;
+        case OP_LT: return actual < value;
+        case OP_LE: return actual <= value;
+        case OP_GT: return actual > value;
+        default: return actual >= value;
+    }
+}
+
+/** Reads the header the first time an sf predicate needs it. */
+static bool load_header(filter_subject_t * subject) {
+    if(subject->header_state == 0) {
+        sf_invalid_field_t failure_src;
+        subject->header_state = -1;
+        if(walk_entry_type(subject->entry) != S_IFREG)
+            return false;
+        subject->fd = openat(subject->entry->dir_fd, subject->entry->name, O_RDONLY | O_CLOEXEC);
+        stats_add(STATS_CALLS_OPEN, 1);
+        if(subject->fd < 0)
+            subject->error = ERR_INVALID_PATH;
+        else if(scan_read_header(subject->fd, subject->rules, &subject->header, &failure_src) == SF_SUCCESS)
+            subject->header_state = 1;
+    }
+    return subject->header_state == 1;
+}
+
+/** Counts the lines of the section far enough to compare them with bound, reusing an earlier count if possible. */
+static bool load_line_count(filter_subject_t * subject, int section, long bound, long * line_count) {
+    long known_bound = subject->count_bounds[section];
+    // an earlier count is enough if it was exact, or if it stopped past this bound as well
+    if(known_bound < 0 || (subject->line_counts[section] > known_bound && known_bound < bound)) {
+        long count = 0;
+        const sect_header_t * header = &subject->header.sections[section];
+        if(sf_v2_count_lines(subject->fd, &subject->header, section, &count) == SUCCESS) {
+            // the count of an SFv2 file is exact, whatever the bound
+            subject->count_bounds[section] = LONG_MAX;
+        }else {
+            if(scan_count_lines(subject->fd, header->sect_offset, (size_t)header->sect_size, bound, &count) != SUCCESS) {
+                subject->error = ERR_READING_FILE;
+                return false;
+            }
+            subject->count_bounds[section] = bound;
+        }
+        subject->line_counts[section] = count;
+    }
+    *line_count = subject->line_counts[section];
+    // past the bound only "more than bound" is known, which decides every comparison with it
+    if(*line_count > bound)
+        *line_count = bound + 1;
+    return true;
+}
+
+static bool eval_node(const filter_node_t * node, filter_subject_t * subject) {
+    walk_entry_t * entry = subject->entry;
+    switch(node->kind) {
+        case NODE_AND:
+            for(int i = 0; i < node->nr_children; i++) {
+                if(!eval_node(node->children[i], subject) || subject->error != SUCCESS)
+                    return false;
+            }
+            return true;
+        case NODE_OR:
+            for(int i = 0; i < node->nr_children; i++) {
+                if(eval_node(node->children[i], subject) || subject->error != SUCCESS)
+                    return subject->error == SUCCESS;
+            }
+            return false;
+        case NODE_NOT:
+            return !eval_node(node->children[0], subject);
+        case NODE_SUFFIX: {
+            size_t length = strlen(entry->name);
+            return length >= node->text_length && memcmp(entry->name + length - node->text_length, node->text, node->text_length) == 0;
+        }
+        case NODE_NAME:
+            return strcmp(entry->name, node->text) == 0;
+        case NODE_TYPE:
+            return walk_entry_type(entry) == node->type;
+        case NODE_PERM: {
+            const struct stat * inode = walk_entry_inode(entry);
+            return inode != NULL && (inode->st_mode & node->value) == (mode_t)node->value;
+        }
+        case NODE_SF:
+            return load_header(subject);
+        case NODE_VERSION:
+            return load_header(subject) && compare(subject->header.header.version, node->op, node->value);
+        case NODE_SECTIONS:
+            return load_header(subject) && compare(subject->header.header.no_of_sections, node->op, node->value);
+        case NODE_SECT_TYPE:
+            if(!load_header(subject))
+                return false;
+            for(int i = 0; i < subject->header.header.no_of_sections; i++) {
+                if(subject->header.sections[i].sect_type == node->value)
+                    return true;
+            }
+            return false;
+        case NODE_LINES:
+            if(!load_header(subject))
+                return false;
+            for(int i = 0; i < subject->header.header.no_of_sections; i++) {
+                long line_count;
+                if(!load_line_count(subject, i, node->value, &line_count))
+                    return false;
+                if(compare(line_count, node->op, node->value))
+                    return true;
+            }
+            return false;
+    }
+    return false;
+}
+
+void filter_subject_init(filter_subject_t * subject, walk_entry_t * entry, const sf_rules_t * rules) {
+    subject->entry = entry;
+    subject->rules = rules;
+    subject->fd = -1;
+    subject->header_state = 0;
+    subject->error = SUCCESS;
+    for(int i = 0; i < SF_MAX_NR_SECTIONS; i++)
+        subject->count_bounds[i] = -1;
+}
+
+void filter_subject_release(filter_subject_t * subject) {
+    if(subject->fd >= 0)
+        close(subject->fd);
+    subject->fd = -1;
+}
+
+int filter_expr_match(const filter_expr_t * expr, filter_subject_t * subject, bool * result) {
+    // a subject an earlier expression failed to read is not read again
+    *result = subject->error == SUCCESS && (expr == NULL || eval_node(expr->root, subject));
+    // and an evaluation cut short by an error (a '!' may have turned it around) matches nothing
+    *result = *result && subject->error == SUCCESS;
+    return subject->error;
+}
+
+int filter_expr_eval(const filter_expr_t * expr, walk_entry_t * entry, const sf_rules_t * rules, bool * result) {
+    filter_subject_t subject;
+    filter_subject_init(&subject, entry, rules);
+    int return_value = filter_expr_match(expr, &subject, result);
+    filter_subject_release(&subject);
+    return return_value;
+}
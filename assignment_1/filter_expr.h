@@ -0,0 +1,67 @@
+#ifndef __FILTER_EXPR_H__
+#define __FILTER_EXPR_H__
+
+#include <stdbool.h>
+
+#include "dir_walker.h"
+#include "../common/sf_format.h"
+
+/**
+ * Filter expressions for list and findall, given as where=<expression>:
+ *
+ *     expression := term ('|' term)*
+ *     term       := factor ('&' factor)*
+ *     factor     := '!' factor | '(' expression ')' | predicate
+ *
+ * with the predicates
+ *
+ *     suffix:<text>       the name ends with text
+ *     name:<text>         the name is text
+ *     type:f|d|l|p|s|c|b  the file type
+ *     perm:<rwxrwxrwx>    all the permission bits given (as in permissions=) are set
+ *     sf                  the file is a valid sf file
+ *     version<op><n>      the sf version compares as asked with n
+ *     sections<op><n>     the number of sections compares as asked with n
+ *     sect_type:<n>       some section has type n
+ *     lines<op><n>        some section has a number of lines comparing as asked with n
+ *
+ * where <op> is one of =, !=, <, <=, >, >=. The sf predicates are false for files which are not valid sf files.
+ *
+ * A compiled expression is a plan: the operands of every '&' and '|' are reordered so the cheapest are
+ * evaluated first (name, then type, permissions, the header and finally the sections), and evaluation
+ * stops as soon as the result is known. The header is read only if an sf predicate is reached, and a
+ * section only as far as the largest line count being compared needs.
+ */
+typedef struct filter_expr filter_expr_t;
+
+/** What was already learned about an entry, shared by all the expressions evaluated on it. */
+typedef struct filter_subject{
+    walk_entry_t * entry;
+    const sf_rules_t * rules;
+    int fd;
+    /** 0 not read yet, 1 valid sf file, -1 anything else */
+    int header_state;
+    sf_file_header_t header;
+    long line_counts[SF_MAX_NR_SECTIONS];
+    /** the bound the line count was taken with (the count is exact if it doesn't exceed it), -1 if not counted */
+    long count_bounds[SF_MAX_NR_SECTIONS];
+    /** the first error met reading the file (SUCCESS if none), it ends the evaluation */
+    int error;
+}filter_subject_t;
+
+/** Compiles the expression. Returns ERR_INVALID_ARGUMENTS if it is malformed. */
+int filter_expr_compile(const char * text, filter_expr_t ** expr);
+void filter_expr_free(filter_expr_t * expr);
+void filter_subject_init(filter_subject_t * subject, walk_entry_t * entry, const sf_rules_t * rules);
+/** Closes the file, if an expression had to open it. */
+void filter_subject_release(filter_subject_t * subject);
+/**
+ * Evaluates the expression (NULL matching everything), reusing and completing what the subject knows.
+ * Like findall, a file which can't be opened fails with ERR_INVALID_PATH and a section which can't be read
+ * with ERR_READING_FILE (a header too short or unreadable only makes the file invalid).
+ */
+int filter_expr_match(const filter_expr_t * expr, filter_subject_t * subject, bool * result);
+/** Evaluates the expression on the entry of a walk, failing like filter_expr_match. */
+int filter_expr_eval(const filter_expr_t * expr, walk_entry_t * entry, const sf_rules_t * rules, bool * result);
+
+#endif
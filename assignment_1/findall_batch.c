@@ -0,0 +1,468 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "a1.h"
+#include "findall_batch.h"
+#include "line_scan.h"
+#include "run_stats.h"
+#include "section_scan.h"
+#include "sf_v2.h"
+#include "uring.h"
+
+/** the number of lines a section must have for its file to be listed */
+#define FINDALL_NR_LINES 16
+
+typedef enum item_state{ ITEM_OPEN, ITEM_HEADER, ITEM_SECTIONS, ITEM_DONE }item_state_t;
+
+typedef struct batch_item{
+    char path[MAX_PATH_SIZE+1];
+    item_state_t state;
+    int fd;
+    bool valid;
+    bool has_key;
+    /** the number of links is known, from the walk or the open file */
+    bool links_known;
+    /** the file has other names, which share its result */
+    bool linked;
+    dev_t dev;
+    ino_t ino;
+    /** the file couldn't be read, it is not valid but its result is not remembered */
+    bool unreadable;
+    /** the record has to be written back to the cache */
+    bool changed;
+    sf_cache_key_t key;
+    sf_cache_record_t record;
+    /** the next section whose line count is checked */
+    int section;
+    /** the SFv2 line tables were looked for (they are, once the file is open and its header known) */
+    bool tables_checked;
+    /** the header, then the first chunk of a section, is read here */
+    char * buf;
+}batch_item_t;
+
+typedef struct batch_set{
+    batch_item_t items[FINDALL_BATCH_SIZE];
+    int nr_items;
+}batch_set_t;
+
+struct findall_batch{
+    const sf_rules_t * rules;
+    sf_cache_t * cache;
+    visited_set_t * seen;
+    out_writer_t * output;
+    uring_t ring;
+    /** the walkers fill one set while the other one is validated */
+    batch_set_t sets[2];
+    batch_set_t * filling;
+    /** the set which is not filling is being validated (and holds the ring) */
+    bool flushing;
+    /** the walker threads share the batch */
+    pthread_mutex_t lock;
+    pthread_cond_t flushed;
+};
+
+int findall_batch_init(findall_batch_t ** batch, const sf_rules_t * rules, sf_cache_t * cache, visited_set_t * seen, out_writer_t * output) {
+    *batch = (findall_batch_t*)calloc(1, sizeof(findall_batch_t));
+    if(*batch == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    int return_value = uring_init(&(*batch)->ring, FINDALL_BATCH_SIZE);
+    if(return_value != SUCCESS) {
+        free(*batch);
+        *batch = NULL;
+        return return_value;
+    }
+    (*batch)->rules = rules;
+    (*batch)->cache = cache;
+    (*batch)->seen = seen;
+    (*batch)->output = output;
+    (*batch)->filling = &(*batch)->sets[0];
+    pthread_mutex_init(&(*batch)->lock, NULL);
+    pthread_cond_init(&(*batch)->flushed, NULL);
+    for(int i=0;i<2*FINDALL_BATCH_SIZE;i++) {
+        batch_item_t * item = &(*batch)->sets[i/FINDALL_BATCH_SIZE].items[i%FINDALL_BATCH_SIZE];
+        item->fd = -1;
+        item->buf = (char*)malloc(SECTION_CHUNK_SIZE);
+        if(item->buf == NULL) {
+            findall_batch_destroy(*batch);
+            *batch = NULL;
+            return ERR_ALLOCATING_MEMORY;
+        }
+    }
+    return SUCCESS;
+}
+
+void findall_batch_destroy(findall_batch_t * batch) {
+    if(batch == NULL)
+        return;
+    for(int i=0;i<2*FINDALL_BATCH_SIZE;i++)
+        free(batch->sets[i/FINDALL_BATCH_SIZE].items[i%FINDALL_BATCH_SIZE].buf);
+    uring_exit(&batch->ring);
+    pthread_mutex_destroy(&batch->lock);
+    pthread_cond_destroy(&batch->flushed);
+    free(batch);
+}
+
+/**
+ * Submits the prepared requests and hands every completion to the item it belongs to.
+ * Every request is accounted in the run stats as the system call (calls) it stands for, with the bytes it read.
+ */
+static int complete_round(findall_batch_t * batch, unsigned nr_requests, int * results, stats_counter_t calls) {
+    struct io_uring_cqe cqe;
+    if(nr_requests == 0)
+        return SUCCESS;
+    int return_value = uring_submit_and_wait(&batch->ring, nr_requests);
+    if(return_value != SUCCESS)
+        return return_value;
+    for(unsigned i=0;i<nr_requests;i++) {
+        while(!uring_pop_cqe(&batch->ring, &cqe)) {
+            return_value = uring_submit_and_wait(&batch->ring, 1);
+            if(return_value != SUCCESS)
+                return return_value;
+        }
+        results[cqe.user_data] = cqe.res;
+        if(calls == STATS_CALLS_READ && cqe.res > 0)
+            stats_add(STATS_BYTES_READ, cqe.res);
+    }
+    stats_add(calls, nr_requests);
+    return SUCCESS;
+}
+
+/** Moves the item to the next section with an unknown line count, deciding on the known ones. */
+static void skip_known_sections(batch_item_t * item) {
+    while(item->section < item->record.sf_header.header.no_of_sections) {
+        long nr_lines = item->record.line_counts[item->section];
+        if(nr_lines < 0)
+            return;
+        if(nr_lines == FINDALL_NR_LINES) {
+            item->valid = true;
+            break;
+        }
+        item->section++;
+    }
+    item->state = ITEM_DONE;
+}
+
+/** Decides the item with the result of another name of its file, if that one was validated already. */
+static bool recall(findall_batch_t * batch, batch_item_t * item) {
+    if(batch->seen == NULL || !item->linked)
+        return false;
+    int state = visited_set_find(batch->seen, item->dev, item->ino);
+    if(state == 0)
+        return false;
+    item->valid = state == SEEN_VALID;
+    item->state = ITEM_DONE;
+    return true;
+}
+
+/** Without the inode from the walk, the links are counted on the open file, which needs no path lookup. */
+static void stat_links(findall_batch_t * batch, batch_item_t * item) {
+    struct stat opened;
+    if(batch->seen == NULL || item->links_known)
+        return;
+    stats_add(STATS_CALLS_STAT, 1);
+    if(fstat(item->fd, &opened) == 0) {
+        item->linked = opened.st_nlink > 1;
+        item->dev = opened.st_dev;
+        item->ino = opened.st_ino;
+    }
+    item->links_known = true;
+}
+
+/** Size of the first read of a section (the size is taken as unsigned, like the sequential scan does). */
+static size_t first_chunk_size(const sect_header_t * section) {
+    size_t size = (size_t)section->sect_size;
+    return size < SECTION_CHUNK_SIZE ? size : SECTION_CHUNK_SIZE;
+}
+
+/** Counts the lines of the current section of the item from the first chunk, which was just read. */
+static int count_section_lines(batch_item_t * item, int nr_bytes) {
+    sect_header_t * section = &item->record.sf_header.sections[item->section];
+    size_t first_chunk = first_chunk_size(section);
+    long nr_lines = 0;
+
+    if(nr_bytes < 0)
+        return ERR_READING_FILE;
+    uint64_t start = stats_clock();
+    long nr_newlines = count_newlines(item->buf, nr_bytes);
+    stats_add_time(STATS_TIME_SCAN, start);
+    if((size_t)nr_bytes == (size_t)section->sect_size) {
+        // the whole section fit in the chunk
+        nr_lines = nr_newlines + (nr_bytes > 0 && item->buf[nr_bytes-1] != '\n' ? 1 : 0);
+    }else if((size_t)nr_bytes == first_chunk && nr_newlines > FINDALL_NR_LINES) {
+        // too many lines already
+        nr_lines = nr_newlines;
+    }else {
+        // a large section with few lines so far, or a short read: finish it the usual way
+        int return_value = scan_count_lines(item->fd, section->sect_offset, section->sect_size, FINDALL_NR_LINES, &nr_lines);
+        if(return_value != SUCCESS)
+            return return_value;
+    }
+    item->record.line_counts[item->section] = nr_lines;
+    if(nr_lines > FINDALL_NR_LINES)
+        item->record.capped_counts |= 1u << item->section;
+    item->changed = true;
+    return SUCCESS;
+}
+
+/** Takes the line counts of an SFv2 file from its extension, which needs no section read. Returns false if it has no usable tables. */
+static bool count_from_tables(batch_item_t * item) {
+    sf_cache_record_t * record = &item->record;
+    long line_counts[SF_MAX_NR_SECTIONS];
+    item->tables_checked = true;
+    if(!sf_v2_present(&record->sf_header))
+        return false;
+    for(int i=0;i<record->sf_header.header.no_of_sections;i++)
+        line_counts[i] = record->line_counts[i];
+    if(sf_v2_count_sections(item->fd, &record->sf_header, line_counts) != SUCCESS)
+        return false;
+    for(int i=0;i<record->sf_header.header.no_of_sections;i++) {
+        if(record->line_counts[i] < 0 && line_counts[i] > FINDALL_NR_LINES)
+            record->capped_counts |= 1u << i;
+        record->line_counts[i] = line_counts[i];
+    }
+    item->changed = true;
+    skip_known_sections(item);
+    return true;
+}
+
+static int validate_batch(findall_batch_t * batch, batch_set_t * set) {
+    int results[FINDALL_BATCH_SIZE];
+    unsigned nr_requests = 0;
+    int return_value = SUCCESS;
+    int nr_items = set->nr_items;
+    // the error of the first file which failed; the set is cut before it, but the files before it are still validated
+    int failure = SUCCESS;
+    sf_invalid_field_t failure_src;
+
+    // open every file which is not known from the cache
+    for(int i=0;i<nr_items;i++) {
+        batch_item_t * item = &set->items[i];
+        if(item->state != ITEM_OPEN)
+            continue;
+        struct io_uring_sqe * sqe = uring_get_sqe(&batch->ring);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)item->path;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe->user_data = i;
+        nr_requests++;
+    }
+    return_value = complete_round(batch, nr_requests, results, STATS_CALLS_OPEN);
+    if(return_value != SUCCESS)
+        return return_value;
+
+    // read all the headers at once
+    nr_requests = 0;
+    for(int i=0;i<nr_items;i++) {
+        batch_item_t * item = &set->items[i];
+        if(item->state != ITEM_OPEN)
+            continue;
+        if(results[i] < 0) {
+            // the same error the files validated one by one would give, the files opened after this one are closed
+            for(int j=i+1;j<nr_items;j++) {
+                if(set->items[j].state == ITEM_OPEN && results[j] >= 0)
+                    close(results[j]);
+            }
+            nr_items = i;
+            failure = ERR_INVALID_PATH;
+            break;
+        }
+        item->fd = results[i];
+        stat_links(batch, item);
+        if(recall(batch, item))
+            continue;
+        item->state = ITEM_HEADER;
+        struct io_uring_sqe * sqe = uring_get_sqe(&batch->ring);
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = item->fd;
+        sqe->addr = (unsigned long)item->buf;
+        sqe->len = SF_HEADER_SIZE(batch->rules->max_nr_sections);
+        sqe->off = 0;
+        sqe->user_data = i;
+        nr_requests++;
+    }
+    uint64_t start = stats_clock();
+    return_value = complete_round(batch, nr_requests, results, STATS_CALLS_READ);
+    if(return_value != SUCCESS)
+        return return_value;
+    for(int i=0;i<nr_items;i++) {
+        batch_item_t * item = &set->items[i];
+        if(item->state == ITEM_HEADER) {
+            if(results[i] < 0) {
+                // a file which can't be read is not valid, but is not remembered either
+                item->state = ITEM_DONE;
+                item->unreadable = true;
+                continue;
+            }
+            if(sf_decode_header(item->buf, results[i], batch->rules, &item->record.sf_header, &failure_src) == SF_SUCCESS)
+                item->record.parse_status = SUCCESS;
+            else
+                item->record.parse_status = ERR_INVALID_FILE_FORMAT;
+            item->record.failure_src = failure_src;
+            sf_cache_clear_line_counts(&item->record);
+            item->changed = true;
+            item->state = ITEM_SECTIONS;
+        }
+        if(item->state == ITEM_SECTIONS) {
+            if(item->record.parse_status != SUCCESS)
+                item->state = ITEM_DONE;
+            else
+                skip_known_sections(item);
+        }
+    }
+    stats_add_time(STATS_TIME_HEADER, start);
+
+    // one round per section index: the first chunk of the next undecided section of every file is read together
+    while(true) {
+        nr_requests = 0;
+        for(int i=0;i<nr_items;i++) {
+            batch_item_t * item = &set->items[i];
+            if(item->state != ITEM_SECTIONS)
+                continue;
+            if(item->fd < 0) {
+                // known from the cache, but some section was never counted
+                item->fd = open(item->path, O_RDONLY | O_CLOEXEC);
+                stats_add(STATS_CALLS_OPEN, 1);
+                if(item->fd < 0) {
+                    nr_items = i;
+                    failure = ERR_INVALID_PATH;
+                    break;
+                }
+            }
+            // an SFv2 file has the counts in its extension, its sections are not read at all
+            if(!item->tables_checked && count_from_tables(item))
+                continue;
+            sect_header_t * section = &item->record.sf_header.sections[item->section];
+            struct io_uring_sqe * sqe = uring_get_sqe(&batch->ring);
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = item->fd;
+            sqe->addr = (unsigned long)item->buf;
+            sqe->len = first_chunk_size(section);
+            sqe->off = (__u64)(long)section->sect_offset;
+            sqe->user_data = i;
+            nr_requests++;
+        }
+        if(nr_requests == 0)
+            break;
+        // the counting of what was read is timed on its own, the scans finishing large sections too
+        start = stats_clock();
+        return_value = complete_round(batch, nr_requests, results, STATS_CALLS_READ);
+        stats_add_time(STATS_TIME_SCAN, start);
+        if(return_value != SUCCESS)
+            return return_value;
+        for(int i=0;i<nr_items;i++) {
+            batch_item_t * item = &set->items[i];
+            if(item->state != ITEM_SECTIONS)
+                continue;
+            if(count_section_lines(item, results[i]) != SUCCESS) {
+                nr_items = i;
+                failure = ERR_READING_FILE;
+                break;
+            }
+            skip_known_sections(item);
+        }
+    }
+    set->nr_items = nr_items;
+    return failure;
+}
+
+/** Validates the files of the set, outputs the valid ones and empties the set. Called without the lock. */
+static int flush_set(findall_batch_t * batch, batch_set_t * set) {
+    int return_value = validate_batch(batch, set);
+    // on error only the files before the failing one are reported, like in the sequential walk
+    for(int i=0;i<set->nr_items;i++) {
+        batch_item_t * item = &set->items[i];
+        if(item->changed && item->has_key)
+            sf_cache_store(batch->cache, &item->key, &item->record);
+        // the other names of the file get its result
+        if(batch->seen != NULL && item->linked && item->state == ITEM_DONE && !item->unreadable)
+            visited_set_put(batch->seen, item->dev, item->ino, item->valid ? SEEN_VALID : SEEN_INVALID, NULL);
+        if(item->valid) {
+            int write_status = writer_write_line(batch->output, item->path);
+            if(return_value == SUCCESS)
+                return_value = write_status;
+        }
+    }
+    for(int i=0;i<FINDALL_BATCH_SIZE;i++) {
+        if(set->items[i].fd >= 0)
+            close(set->items[i].fd);
+        set->items[i].fd = -1;
+    }
+    set->nr_items = 0;
+    return return_value;
+}
+
+/**
+ * Takes the filling set (if it has files) and validates it, the walkers going on with the other set meanwhile.
+ * Called with the lock held, which is released during the validation.
+ */
+static int flush_filling(findall_batch_t * batch) {
+    int return_value = SUCCESS;
+    // a single validation at a time, it has the ring to itself
+    while(batch->flushing)
+        pthread_cond_wait(&batch->flushed, &batch->lock);
+    batch_set_t * set = batch->filling;
+    if(set->nr_items == 0)
+        return SUCCESS;
+    batch->filling = set == &batch->sets[0] ? &batch->sets[1] : &batch->sets[0];
+    batch->flushing = true;
+    pthread_cond_broadcast(&batch->flushed);
+    pthread_mutex_unlock(&batch->lock);
+    return_value = flush_set(batch, set);
+    pthread_mutex_lock(&batch->lock);
+    batch->flushing = false;
+    pthread_cond_broadcast(&batch->flushed);
+    return return_value;
+}
+
+int findall_batch_add(findall_batch_t * batch, const char * path, const struct stat * inode) {
+    int return_value = SUCCESS;
+    pthread_mutex_lock(&batch->lock);
+    // a full set waits for the other one to be validated before it can be swapped
+    while(batch->filling->nr_items == FINDALL_BATCH_SIZE)
+        pthread_cond_wait(&batch->flushed, &batch->lock);
+    batch_item_t * item = &batch->filling->items[batch->filling->nr_items++];
+    strncpy(item->path, path, MAX_PATH_SIZE);
+    item->path[MAX_PATH_SIZE] = '\0';
+    item->state = ITEM_OPEN;
+    item->fd = -1;
+    item->valid = false;
+    item->changed = false;
+    item->unreadable = false;
+    item->section = 0;
+    item->tables_checked = false;
+    item->links_known = inode != NULL;
+    item->linked = inode != NULL && inode->st_nlink > 1;
+    if(inode != NULL) {
+        item->dev = inode->st_dev;
+        item->ino = inode->st_ino;
+    }
+    item->has_key = batch->cache != NULL && inode != NULL;
+    // a file whose other name was validated already is not even opened
+    if(!recall(batch, item) && item->has_key) {
+        sf_cache_key_from_stat(inode, &item->key);
+        if(sf_cache_lookup(batch->cache, &item->key, &item->record)) {
+            // only the sections which were never counted are still read
+            item->state = ITEM_SECTIONS;
+            if(item->record.parse_status != SUCCESS)
+                item->state = ITEM_DONE;
+            else
+                skip_known_sections(item);
+        }
+    }
+    if(batch->filling->nr_items == FINDALL_BATCH_SIZE)
+        return_value = flush_filling(batch);
+    pthread_mutex_unlock(&batch->lock);
+    return return_value;
+}
+
+int findall_batch_flush(findall_batch_t * batch) {
+    pthread_mutex_lock(&batch->lock);
+    int return_value = flush_filling(batch);
+    pthread_mutex_unlock(&batch->lock);
+    return return_value;
+}
@@ -0,0 +1,34 @@
+#ifndef __FINDALL_BATCH_H__
+#define __FINDALL_BATCH_H__
+
+#include <sys/stat.h>
+
+#include "../common/sf_format.h"
+#include "out_writer.h"
+#include "sf_cache.h"
+#include "visited_set.h"
+
+/** Number of files validated together, which is also the number of requests kept in flight. */
+#define FINDALL_BATCH_SIZE 64
+
+typedef struct findall_batch findall_batch_t;
+
+/**
+ * Prepares the io_uring backed findall validation: the candidate files are collected in batches whose opens,
+ * header reads and section reads are each submitted at once (an SFv2 file gets its line counts from its extension
+ * instead, with a single read of its own). Returns ERR_IO_URING_UNAVAILABLE if the kernel
+ * has no io_uring, in which case the caller keeps validating the files one by one. A file with several hard links is
+ * validated once (unless two of its names are in the same batch), its other names get the result kept in seen
+ * (unless it is NULL).
+ */
+int findall_batch_init(findall_batch_t ** batch, const sf_rules_t * rules, sf_cache_t * cache, visited_set_t * seen, out_writer_t * output);
+/**
+ * Queues a regular file; the batch is validated when it fills up and the valid files are written to the output,
+ * in the order they were added. inode is only needed (and may be NULL otherwise) when a cache is used.
+ */
+int findall_batch_add(findall_batch_t * batch, const char * path, const struct stat * inode);
+/** Validates the files which are still queued. */
+int findall_batch_flush(findall_batch_t * batch);
+void findall_batch_destroy(findall_batch_t * batch);
+
+#endif
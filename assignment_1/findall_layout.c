@@ -0,0 +1,333 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+#include "a1.h"
+#include "findall_layout.h"
+#include "section_scan.h"
+#include "sf_v2.h"
+#include "arena.h"
+#include "run_stats.h"
+
+#define INITIAL_NR_CANDIDATES 256
+/** the number of lines a section must have for its file to be listed */
+#define FINDALL_NR_LINES 16
+
+typedef struct layout_candidate{
+    char * path;
+    /** built from the stat of the walk (which gives the device and inode numbers too), valid only if has_key */
+    sf_cache_key_t key;
+    bool has_key;
+    /** the file has other names, which share its result */
+    bool linked;
+    /** -1 not an sf file (or not readable), 0 still undecided, 1 valid */
+    int decision;
+    /** where the sections still to be counted start on the disk, valid only if mapped */
+    bool mapped;
+    uint64_t physical;
+    /** offset in the file of the first section to count, used with the inode number when the file can't be mapped */
+    off_t offset;
+    /** the header and line counts of an undecided file, kept until its sections are counted (NULL otherwise) */
+    sf_cache_record_t * record;
+}layout_candidate_t;
+
+struct findall_layout{
+    const sf_rules_t * rules;
+    sf_cache_t * cache;
+    visited_set_t * seen;
+    pthread_mutex_t lock;
+    /** the candidates and their paths, released all at once */
+    arena_t * arena;
+    layout_candidate_t ** candidates;
+    size_t nr_candidates;
+    size_t capacity;
+};
+
+int findall_layout_init(findall_layout_t ** layout, const sf_rules_t * rules, sf_cache_t * cache, visited_set_t * seen) {
+    findall_layout_t * new_layout = (findall_layout_t*)calloc(1, sizeof(findall_layout_t));
+    if(new_layout == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    new_layout->capacity = INITIAL_NR_CANDIDATES;
+    new_layout->candidates = (layout_candidate_t**)malloc(new_layout->capacity * sizeof(layout_candidate_t*));
+    if(new_layout->candidates == NULL || arena_init(&new_layout->arena) != SUCCESS) {
+        free(new_layout->candidates);
+        free(new_layout);
+        return ERR_ALLOCATING_MEMORY;
+    }
+    new_layout->rules = rules;
+    new_layout->cache = cache;
+    new_layout->seen = seen;
+    pthread_mutex_init(&new_layout->lock, NULL);
+    *layout = new_layout;
+    return SUCCESS;
+}
+
+int findall_layout_add(findall_layout_t * layout, const char * path, const struct stat * inode) {
+    int return_value = SUCCESS;
+    pthread_mutex_lock(&layout->lock);
+    if(layout->nr_candidates == layout->capacity) {
+        layout_candidate_t ** candidates = (layout_candidate_t**)realloc(layout->candidates, layout->capacity * 2 * sizeof(layout_candidate_t*));
+        if(candidates == NULL) {
+            return_value = ERR_ALLOCATING_MEMORY;
+            goto unlock;
+        }
+        layout->candidates = candidates;
+        layout->capacity *= 2;
+    }
+    layout_candidate_t * candidate = (layout_candidate_t*)arena_alloc(layout->arena, sizeof(layout_candidate_t));
+    if(candidate == NULL) {
+        return_value = ERR_ALLOCATING_MEMORY;
+        goto unlock;
+    }
+    memset(candidate, 0, sizeof(layout_candidate_t));
+    candidate->path = arena_strndup(layout->arena, path, strlen(path));
+    if(candidate->path == NULL) {
+        return_value = ERR_ALLOCATING_MEMORY;
+        goto unlock;
+    }
+    candidate->linked = inode != NULL && inode->st_nlink > 1;
+    candidate->has_key = inode != NULL;
+    if(inode != NULL)
+        sf_cache_key_from_stat(inode, &candidate->key);
+    layout->candidates[layout->nr_candidates++] = candidate;
+    unlock:
+    pthread_mutex_unlock(&layout->lock);
+    return return_value;
+}
+
+static int open_counted(const char * path) {
+    stats_add(STATS_CALLS_OPEN, 1);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/** Finds the physical address of the byte at offset in the file. Returns false if the file system can't tell. */
+static bool map_offset(int fd, off_t offset, uint64_t * physical) {
+    union{
+        struct fiemap map;
+        char bytes[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+    }request;
+    memset(&request, 0, sizeof(request));
+    request.map.fm_start = offset;
+    request.map.fm_length = 1;
+    request.map.fm_extent_count = 1;
+    if(ioctl(fd, FS_IOC_FIEMAP, &request.map) != 0)
+        return false;
+    if(request.map.fm_mapped_extents == 0) {
+        // a hole or an empty file costs no seek
+        *physical = 0;
+        return true;
+    }
+    const struct fiemap_extent * extent = &request.map.fm_extents[0];
+    if(extent->fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_NOT_ALIGNED))
+        return false;
+    *physical = extent->fe_physical + (offset - extent->fe_logical);
+    return true;
+}
+
+static int compare_physical(const void * a, const void * b) {
+    const layout_candidate_t * first = *(layout_candidate_t * const *)a;
+    const layout_candidate_t * second = *(layout_candidate_t * const *)b;
+    if(first->physical != second->physical)
+        return first->physical < second->physical ? -1 : 1;
+    return strcmp(first->path, second->path);
+}
+
+static int compare_inode(const void * a, const void * b) {
+    const layout_candidate_t * first = *(layout_candidate_t * const *)a;
+    const layout_candidate_t * second = *(layout_candidate_t * const *)b;
+    if(first->key.ino != second->key.ino)
+        return first->key.ino < second->key.ino ? -1 : 1;
+    if(first->offset != second->offset)
+        return first->offset < second->offset ? -1 : 1;
+    return strcmp(first->path, second->path);
+}
+
+static int compare_path(const void * a, const void * b) {
+    return strcmp((*(layout_candidate_t * const *)a)->path, (*(layout_candidate_t * const *)b)->path);
+}
+
+/**
+ * Sorts the pending reads of the candidates by their place on the disk. Physical addresses are only compared
+ * if every read could be mapped, otherwise the inode numbers are.
+ */
+static void sort_by_layout(layout_candidate_t ** candidates, size_t nr_candidates) {
+    bool all_mapped = true;
+    for(size_t i = 0; i < nr_candidates && all_mapped; i++)
+        all_mapped = candidates[i]->mapped;
+    qsort(candidates, nr_candidates, sizeof(layout_candidate_t*), all_mapped ? compare_physical : compare_inode);
+}
+
+/** Tells from the line counts already known if the file is valid (1), invalid (-1) or still undecided (0). */
+static int decide(const sf_cache_record_t * record) {
+    int decision = -1;
+    for(int i = 0; i < record->sf_header.header.no_of_sections; i++) {
+        if(record->line_counts[i] == FINDALL_NR_LINES)
+            return 1;
+        if(record->line_counts[i] < 0)
+            decision = 0;
+    }
+    return decision;
+}
+
+/** Offset of the first section which still has to be counted. */
+static off_t first_uncounted_offset(const sf_cache_record_t * record) {
+    off_t offset = -1;
+    for(int i = 0; i < record->sf_header.header.no_of_sections; i++) {
+        if(record->line_counts[i] < 0 && (offset < 0 || record->sf_header.sections[i].sect_offset < offset))
+            offset = record->sf_header.sections[i].sect_offset;
+    }
+    return offset;
+}
+
+/** Takes the result of another name of the candidate's file, if that one was validated already. */
+static bool recall(findall_layout_t * layout, layout_candidate_t * candidate) {
+    if(layout->seen == NULL || !candidate->linked)
+        return false;
+    int state = visited_set_find(layout->seen, candidate->key.dev, candidate->key.ino);
+    if(state == 0)
+        return false;
+    candidate->decision = state == SEEN_VALID ? 1 : -1;
+    return true;
+}
+
+/** Keeps the result of a decided candidate for the other names of its file. */
+static void remember(findall_layout_t * layout, const layout_candidate_t * candidate) {
+    if(layout->seen != NULL && candidate->linked && candidate->decision != 0)
+        visited_set_put(layout->seen, candidate->key.dev, candidate->key.ino, candidate->decision == 1 ? SEEN_VALID : SEEN_INVALID, NULL);
+}
+
+/**
+ * Reads (or looks up) the header of a candidate and, if it is still undecided, maps its first section to be counted
+ * with the same descriptor. Only an undecided candidate keeps its record, the others are written to the cache at once.
+ */
+static int read_header(findall_layout_t * layout, layout_candidate_t * candidate) {
+    int return_value = SUCCESS;
+    int fd = -1;
+    sf_cache_record_t record;
+    bool changed = false;
+    if(recall(layout, candidate))
+        return SUCCESS;
+    if(!(candidate->has_key && layout->cache != NULL && sf_cache_lookup(layout->cache, &candidate->key, &record))) {
+        fd = open_counted(candidate->path);
+        if(fd < 0)
+            return ERR_INVALID_PATH;
+        sf_invalid_field_t failure_src = SF_VALID;
+        int status = scan_read_header(fd, layout->rules, &record.sf_header, &failure_src);
+        // a file which can't be read is not valid, but is not remembered either
+        if(status == SF_ERR_READING_FILE) {
+            candidate->decision = -1;
+            goto clean_up;
+        }
+        record.parse_status = status == SF_SUCCESS ? SUCCESS : ERR_INVALID_FILE_FORMAT;
+        record.failure_src = failure_src;
+        sf_cache_clear_line_counts(&record);
+        changed = true;
+    }
+    candidate->decision = record.parse_status == SUCCESS ? decide(&record) : -1;
+    remember(layout, candidate);
+    if(candidate->decision != 0) {
+        if(changed && candidate->has_key && layout->cache != NULL)
+            sf_cache_store(layout->cache, &candidate->key, &record);
+        goto clean_up;
+    }
+    // the walk is over, the arena is only used by this thread now
+    candidate->record = (sf_cache_record_t*)arena_alloc(layout->arena, sizeof(sf_cache_record_t));
+    if(candidate->record == NULL) {
+        return_value = ERR_ALLOCATING_MEMORY;
+        goto clean_up;
+    }
+    *candidate->record = record;
+    candidate->offset = first_uncounted_offset(&record);
+    // a cached header still needs the file opened to map its sections
+    if(fd < 0)
+        fd = open_counted(candidate->path);
+    candidate->mapped = fd >= 0 && map_offset(fd, candidate->offset, &candidate->physical);
+    clean_up:
+    if(fd >= 0)
+        close(fd);
+    return return_value;
+}
+
+static int count_sections(findall_layout_t * layout, layout_candidate_t * candidate) {
+    sf_cache_record_t * record = candidate->record;
+    long line_counts[SF_MAX_NR_SECTIONS];
+    // another name of the file may have been counted since the headers were read
+    if(recall(layout, candidate))
+        return SUCCESS;
+    int fd = open_counted(candidate->path);
+    if(fd < 0)
+        return ERR_INVALID_PATH;
+    for(int i = 0; i < record->sf_header.header.no_of_sections; i++)
+        line_counts[i] = record->line_counts[i];
+    // there is no need to count past the 17th line
+    // an SFv2 file has the counts in its extension, the others are scanned
+    int return_value = sf_v2_count_sections(fd, &record->sf_header, line_counts);
+    if(return_value != SUCCESS)
+        return_value = scan_count_sections(fd, record->sf_header.sections, record->sf_header.header.no_of_sections, FINDALL_NR_LINES, line_counts);
+    close(fd);
+    if(return_value != SUCCESS)
+        return ERR_READING_FILE;
+    candidate->decision = -1;
+    for(int i = 0; i < record->sf_header.header.no_of_sections; i++) {
+        if(record->line_counts[i] < 0 && line_counts[i] > FINDALL_NR_LINES)
+            record->capped_counts |= 1u << i;
+        record->line_counts[i] = line_counts[i];
+        if(line_counts[i] == FINDALL_NR_LINES)
+            candidate->decision = 1;
+    }
+    if(candidate->has_key && layout->cache != NULL)
+        sf_cache_store(layout->cache, &candidate->key, record);
+    remember(layout, candidate);
+    return SUCCESS;
+}
+
+int findall_layout_run(findall_layout_t * layout, out_writer_t * output) {
+    int return_value = SUCCESS;
+    layout_candidate_t ** candidates = layout->candidates;
+    size_t nr_candidates = layout->nr_candidates;
+    size_t nr_undecided = 0;
+
+    // the headers, in the order of the inode numbers the walk already has: most file systems allocate the inodes
+    // close to the data, and mapping the files first would cost each one an extra open
+    qsort(candidates, nr_candidates, sizeof(layout_candidate_t*), compare_inode);
+    for(size_t i = 0; i < nr_candidates; i++) {
+        return_value = read_header(layout, candidates[i]);
+        if(return_value != SUCCESS)
+            return return_value;
+        if(candidates[i]->decision == 0) {
+            // the undecided files are moved to the front, keeping the others behind them
+            layout_candidate_t * undecided = candidates[i];
+            candidates[i] = candidates[nr_undecided];
+            candidates[nr_undecided++] = undecided;
+        }
+    }
+    // then the sections, in the order of the first block each file still has to read
+    sort_by_layout(candidates, nr_undecided);
+    for(size_t i = 0; i < nr_undecided; i++) {
+        return_value = count_sections(layout, candidates[i]);
+        if(return_value != SUCCESS)
+            return return_value;
+    }
+
+    qsort(candidates, nr_candidates, sizeof(layout_candidate_t*), compare_path);
+    for(size_t i = 0; i < nr_candidates && return_value == SUCCESS; i++) {
+        if(candidates[i]->decision == 1)
+            return_value = writer_write_line(output, candidates[i]->path);
+    }
+    return return_value;
+}
+
+void findall_layout_destroy(findall_layout_t * layout) {
+    if(layout == NULL)
+        return;
+    free(layout->candidates);
+    arena_destroy(layout->arena);
+    pthread_mutex_destroy(&layout->lock);
+    free(layout);
+}
@@ -0,0 +1,28 @@
+#ifndef __FINDALL_LAYOUT_H__
+#define __FINDALL_LAYOUT_H__
+
+#include <sys/stat.h>
+
+#include "../common/sf_format.h"
+#include "out_writer.h"
+#include "sf_cache.h"
+#include "visited_set.h"
+
+typedef struct findall_layout findall_layout_t;
+
+/**
+ * Prepares a findall which reads the files in the order they are stored on the disk instead of the order they are found.
+ * The candidates are only collected during the walk. Afterwards their headers are read in the order of their inode
+ * numbers, which most file systems allocate close to the data, and each file still undecided has its first section to
+ * count mapped (FIEMAP) while it is open. Those sections are then read in the order of their physical blocks; if the file
+ * system can't map one of them, by inode number and offset instead. The valid files are written sorted by path, so the output doesn't depend on the layout.
+ * A file with several hard links is validated once, its other names get the result kept in seen (unless it is NULL).
+ */
+int findall_layout_init(findall_layout_t ** layout, const sf_rules_t * rules, sf_cache_t * cache, visited_set_t * seen);
+/** Collects a regular file. Safe to call from several walking threads. */
+int findall_layout_add(findall_layout_t * layout, const char * path, const struct stat * inode);
+/** Validates the collected files and writes the valid ones to the output. */
+int findall_layout_run(findall_layout_t * layout, out_writer_t * output);
+void findall_layout_destroy(findall_layout_t * layout);
+
+#endif
@@ -0,0 +1,278 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "a1.h"
+#include "bounded_queue.h"
+#include "findall_pipeline.h"
+#include "section_scan.h"
+#include "sf_v2.h"
+#include "run_stats.h"
+
+/** the number of lines a section must have for its file to be listed */
+#define FINDALL_NR_LINES 16
+
+typedef struct pipeline_item{
+    char path[MAX_PATH_SIZE+1];
+    int fd;
+    /** the number of links is known, from the walk or the open file */
+    bool links_known;
+    /** the file has other names, which share its result */
+    bool linked;
+    dev_t dev;
+    ino_t ino;
+    bool has_key;
+    /** the record has to be written back to the cache */
+    bool changed;
+    sf_cache_key_t key;
+    sf_cache_record_t record;
+}pipeline_item_t;
+
+struct findall_pipeline{
+    const sf_rules_t * rules;
+    sf_cache_t * cache;
+    visited_set_t * seen;
+    out_writer_t * output;
+    /** walk -> header stage */
+    bounded_queue_t candidates;
+    /** header stage -> scan stage */
+    bounded_queue_t sf_files;
+    pthread_t header_threads[MAX_NR_THREADS];
+    pthread_t scan_threads[MAX_NR_THREADS];
+    int nr_header_threads;
+    int nr_scan_threads;
+    /** first error met by any stage */
+    int status;
+};
+
+static void set_error(findall_pipeline_t * pipeline, int error) {
+    int expected = SUCCESS;
+    __atomic_compare_exchange_n(&pipeline->status, &expected, error, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static bool failed(findall_pipeline_t * pipeline) {
+    return __atomic_load_n(&pipeline->status, __ATOMIC_RELAXED) != SUCCESS;
+}
+
+static void finish_item(findall_pipeline_t * pipeline, pipeline_item_t * item, bool valid) {
+    if(valid && !failed(pipeline))
+        writer_write_line(pipeline->output, item->path);
+    // a record is not stored after an error, it may be missing some counts it claims
+    if(item->changed && item->has_key && pipeline->cache != NULL && !failed(pipeline))
+        sf_cache_store(pipeline->cache, &item->key, &item->record);
+    if(item->fd >= 0)
+        close(item->fd);
+    free(item);
+}
+
+/** Finishes the item with the result of another name of its file, if that one was validated already. */
+static bool recall(findall_pipeline_t * pipeline, pipeline_item_t * item) {
+    if(pipeline->seen == NULL || !item->linked)
+        return false;
+    int state = visited_set_find(pipeline->seen, item->dev, item->ino);
+    if(state == 0)
+        return false;
+    finish_item(pipeline, item, state == SEEN_VALID);
+    return true;
+}
+
+/** Keeps the result of the item for the other names of its file. */
+static void remember(findall_pipeline_t * pipeline, const pipeline_item_t * item, bool valid) {
+    if(pipeline->seen != NULL && item->linked && !failed(pipeline))
+        visited_set_put(pipeline->seen, item->dev, item->ino, valid ? SEEN_VALID : SEEN_INVALID, NULL);
+}
+
+/** Without the inode from the walk, the links are counted on the open file, which needs no path lookup. */
+static void stat_links(findall_pipeline_t * pipeline, pipeline_item_t * item) {
+    struct stat opened;
+    if(pipeline->seen == NULL || item->links_known)
+        return;
+    stats_add(STATS_CALLS_STAT, 1);
+    if(fstat(item->fd, &opened) == 0) {
+        item->linked = opened.st_nlink > 1;
+        item->dev = opened.st_dev;
+        item->ino = opened.st_ino;
+    }
+    item->links_known = true;
+}
+
+static int open_counted(const char * path) {
+    stats_add(STATS_CALLS_OPEN, 1);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/** Tells from the line counts already known if the file is valid (1), invalid (0) or still undecided (-1). */
+static int decide(const sf_cache_record_t * record) {
+    int decision = 0;
+    for(int i = 0; i < record->sf_header.header.no_of_sections; i++) {
+        if(record->line_counts[i] == FINDALL_NR_LINES)
+            return 1;
+        if(record->line_counts[i] < 0)
+            decision = -1;
+    }
+    return decision;
+}
+
+static void * header_stage(void * arg) {
+    findall_pipeline_t * pipeline = (findall_pipeline_t*)arg;
+    void * popped;
+
+    while(queue_pop(&pipeline->candidates, &popped)) {
+        pipeline_item_t * item = (pipeline_item_t*)popped;
+        // after an error the queue is only drained, so the walk is never left waiting
+        if(failed(pipeline)) {
+            finish_item(pipeline, item, false);
+            continue;
+        }
+        if(recall(pipeline, item))
+            continue;
+        if(!(item->has_key && pipeline->cache != NULL && sf_cache_lookup(pipeline->cache, &item->key, &item->record))) {
+            item->fd = open_counted(item->path);
+            if(item->fd < 0) {
+                set_error(pipeline, ERR_INVALID_PATH);
+                finish_item(pipeline, item, false);
+                continue;
+            }
+            stat_links(pipeline, item);
+            if(recall(pipeline, item))
+                continue;
+            sf_invalid_field_t failure_src = SF_VALID;
+            int status = scan_read_header(item->fd, pipeline->rules, &item->record.sf_header, &failure_src);
+            // a file which can't be read is not valid, but is not remembered either
+            if(status == SF_ERR_READING_FILE) {
+                finish_item(pipeline, item, false);
+                continue;
+            }
+            item->record.parse_status = status == SF_SUCCESS ? SUCCESS : ERR_INVALID_FILE_FORMAT;
+            item->record.failure_src = failure_src;
+            sf_cache_clear_line_counts(&item->record);
+            item->changed = true;
+        }
+        int decision = item->record.parse_status == SUCCESS ? decide(&item->record) : 0;
+        if(decision >= 0) {
+            remember(pipeline, item, decision == 1);
+            finish_item(pipeline, item, decision == 1);
+            continue;
+        }
+        if(item->fd < 0 && (item->fd = open_counted(item->path)) < 0) {
+            set_error(pipeline, ERR_INVALID_PATH);
+            finish_item(pipeline, item, false);
+            continue;
+        }
+        // the sections are left to the scan stage, this thread goes on with the next header
+        queue_push(&pipeline->sf_files, item);
+    }
+    return NULL;
+}
+
+static void * scan_stage(void * arg) {
+    findall_pipeline_t * pipeline = (findall_pipeline_t*)arg;
+    void * popped;
+
+    while(queue_pop(&pipeline->sf_files, &popped)) {
+        pipeline_item_t * item = (pipeline_item_t*)popped;
+        bool valid = false;
+        sf_cache_record_t * record = &item->record;
+        long line_counts[SF_MAX_NR_SECTIONS];
+        for(int i = 0; i < record->sf_header.header.no_of_sections; i++)
+            line_counts[i] = record->line_counts[i];
+        // an SFv2 file has the counts in its extension, otherwise the sections left are read in the order of their offsets
+        // and there is no need to count past the 17th line
+        if(!failed(pipeline) && sf_v2_count_sections(item->fd, &record->sf_header, line_counts) != SUCCESS
+           && scan_count_sections(item->fd, record->sf_header.sections, record->sf_header.header.no_of_sections,
+                                  FINDALL_NR_LINES, line_counts) != SUCCESS)
+            set_error(pipeline, ERR_READING_FILE);
+        for(int i = 0; i < record->sf_header.header.no_of_sections && !failed(pipeline); i++) {
+            if(record->line_counts[i] < 0 && line_counts[i] > FINDALL_NR_LINES)
+                record->capped_counts |= 1u << i;
+            record->line_counts[i] = line_counts[i];
+            item->changed = true;
+            valid = valid || line_counts[i] == FINDALL_NR_LINES;
+        }
+        remember(pipeline, item, valid);
+        finish_item(pipeline, item, valid);
+    }
+    return NULL;
+}
+
+int findall_pipeline_init(findall_pipeline_t ** pipeline, const sf_rules_t * rules, sf_cache_t * cache, visited_set_t * seen,
+                          out_writer_t * output, int nr_header_threads, int nr_scan_threads) {
+    findall_pipeline_t * new_pipeline = (findall_pipeline_t*)calloc(1, sizeof(findall_pipeline_t));
+    if(new_pipeline == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    new_pipeline->rules = rules;
+    new_pipeline->cache = cache;
+    new_pipeline->seen = seen;
+    new_pipeline->output = output;
+    new_pipeline->status = SUCCESS;
+    if(queue_init(&new_pipeline->candidates, PIPELINE_QUEUE_SIZE) != SUCCESS) {
+        free(new_pipeline);
+        return ERR_ALLOCATING_MEMORY;
+    }
+    if(queue_init(&new_pipeline->sf_files, PIPELINE_QUEUE_SIZE) != SUCCESS) {
+        queue_destroy(&new_pipeline->candidates);
+        free(new_pipeline);
+        return ERR_ALLOCATING_MEMORY;
+    }
+    *pipeline = new_pipeline;
+    for(; new_pipeline->nr_header_threads < nr_header_threads; new_pipeline->nr_header_threads++) {
+        if(pthread_create(&new_pipeline->header_threads[new_pipeline->nr_header_threads], NULL, header_stage, new_pipeline) != 0)
+            break;
+    }
+    for(; new_pipeline->nr_scan_threads < nr_scan_threads; new_pipeline->nr_scan_threads++) {
+        if(pthread_create(&new_pipeline->scan_threads[new_pipeline->nr_scan_threads], NULL, scan_stage, new_pipeline) != 0)
+            break;
+    }
+    if(new_pipeline->nr_header_threads == 0 || new_pipeline->nr_scan_threads == 0) {
+        findall_pipeline_finish(new_pipeline);
+        findall_pipeline_destroy(new_pipeline);
+        *pipeline = NULL;
+        return ERR_CREATING_THREAD;
+    }
+    return SUCCESS;
+}
+
+int findall_pipeline_add(findall_pipeline_t * pipeline, const char * path, const struct stat * inode) {
+    if(failed(pipeline))
+        return pipeline->status;
+    pipeline_item_t * item = (pipeline_item_t*)malloc(sizeof(pipeline_item_t));
+    if(item == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    strncpy(item->path, path, MAX_PATH_SIZE);
+    item->path[MAX_PATH_SIZE] = '\0';
+    item->fd = -1;
+    item->changed = false;
+    item->has_key = inode != NULL;
+    item->links_known = inode != NULL;
+    item->linked = inode != NULL && inode->st_nlink > 1;
+    if(inode != NULL) {
+        sf_cache_key_from_stat(inode, &item->key);
+        item->dev = inode->st_dev;
+        item->ino = inode->st_ino;
+    }
+    queue_push(&pipeline->candidates, item);
+    return SUCCESS;
+}
+
+int findall_pipeline_finish(findall_pipeline_t * pipeline) {
+    // each stage ends once the previous one ended and its queue is drained
+    queue_close(&pipeline->candidates);
+    for(int i = 0; i < pipeline->nr_header_threads; i++)
+        pthread_join(pipeline->header_threads[i], NULL);
+    pipeline->nr_header_threads = 0;
+    queue_close(&pipeline->sf_files);
+    for(int i = 0; i < pipeline->nr_scan_threads; i++)
+        pthread_join(pipeline->scan_threads[i], NULL);
+    pipeline->nr_scan_threads = 0;
+    return pipeline->status;
+}
+
+void findall_pipeline_destroy(findall_pipeline_t * pipeline) {
+    if(pipeline == NULL)
+        return;
+    queue_destroy(&pipeline->candidates);
+    queue_destroy(&pipeline->sf_files);
+    free(pipeline);
+}
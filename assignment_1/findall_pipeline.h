@@ -0,0 +1,35 @@
+#ifndef __FINDALL_PIPELINE_H__
+#define __FINDALL_PIPELINE_H__
+
+#include <sys/stat.h>
+
+#include "../common/sf_format.h"
+#include "out_writer.h"
+#include "sf_cache.h"
+#include "visited_set.h"
+
+/** Capacity of each queue between two stages. */
+#define PIPELINE_QUEUE_SIZE 256
+
+typedef struct findall_pipeline findall_pipeline_t;
+
+/**
+ * Starts the stages of a pipelined findall: the walk (the caller) hands the regular files to nr_header_threads
+ * threads which open them and validate their headers, and those pass the sf files to nr_scan_threads threads
+ * counting the lines of their sections. The stages are connected by bounded queues, so a slow stage holds
+ * the previous one back instead of piling up work. The valid files are written to the output in the order
+ * they are found to be valid. A file with several hard links is validated once (unless two of its names are in the
+ * stages at the same time), its other names get the result kept in seen (unless it is NULL).
+ */
+int findall_pipeline_init(findall_pipeline_t ** pipeline, const sf_rules_t * rules, sf_cache_t * cache, visited_set_t * seen,
+                          out_writer_t * output, int nr_header_threads, int nr_scan_threads);
+/**
+ * Hands a regular file to the header stage, waiting if its queue is full. inode is only needed (and may be NULL
+ * otherwise) when a cache is used. Returns the first error met by the stages, which stops the walk.
+ */
+int findall_pipeline_add(findall_pipeline_t * pipeline, const char * path, const struct stat * inode);
+/** Waits until every file handed over went through all the stages. Returns the first error met. */
+int findall_pipeline_finish(findall_pipeline_t * pipeline);
+void findall_pipeline_destroy(findall_pipeline_t * pipeline);
+
+#endif
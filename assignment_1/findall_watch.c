@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "a1.h"
+#include "dir_walker.h"
+#include "findall_watch.h"
+
+#define WATCH_MASK (IN_CREATE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE | IN_ONLYDIR)
+#define EVENT_BUF_SIZE (64 * 1024)
+#define EMPTY_SLOT -1
+#define DELETED_SLOT -2
+
+struct findall_watch{
+    char root[MAX_PATH_SIZE+1];
+    int inotify_fd;
+    pthread_t thread;
+    watch_validator_t validator;
+    void * arg;
+    /** guards the result, queries only read it */
+    pthread_rwlock_t lock;
+    /** paths of the valid files, kept dense so a query costs O(result size) */
+    char ** results;
+    size_t nr_results;
+    size_t results_capacity;
+    /** open addressing set of the result paths, each slot holding an index into results */
+    int * slots;
+    size_t nr_slots;
+    size_t nr_used_slots;
+    /** path of every watched directory, indexed by its watch descriptor */
+    char ** dirs;
+    size_t dirs_capacity;
+};
+
+static size_t hash_path(const char * path) {
+    // FNV-1a
+    size_t hash = 14695981039346656037ull;
+    for(; *path; path++)
+        hash = (hash ^ (unsigned char)*path) * 1099511628211ull;
+    return hash;
+}
+
+/** Returns the slot holding path, or -1. */
+static long find_slot(findall_watch_t * watch, const char * path) {
+    size_t mask = watch->nr_slots - 1;
+    for(size_t i = hash_path(path) & mask; watch->slots[i] != EMPTY_SLOT; i = (i + 1) & mask) {
+        if(watch->slots[i] >= 0 && strcmp(watch->results[watch->slots[i]], path) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static int rebuild_slots(findall_watch_t * watch, size_t nr_slots) {
+    int * slots = (int*)malloc(nr_slots * sizeof(int));
+    if(slots == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    for(size_t i = 0; i < nr_slots; i++)
+        slots[i] = EMPTY_SLOT;
+    for(size_t k = 0; k < watch->nr_results; k++) {
+        size_t i = hash_path(watch->results[k]) & (nr_slots - 1);
+        while(slots[i] != EMPTY_SLOT)
+            i = (i + 1) & (nr_slots - 1);
+        slots[i] = k;
+    }
+    free(watch->slots);
+    watch->slots = slots;
+    watch->nr_slots = nr_slots;
+    watch->nr_used_slots = watch->nr_results;
+    return SUCCESS;
+}
+
+static int add_result_locked(findall_watch_t * watch, const char * path) {
+    if(find_slot(watch, path) >= 0)
+        return SUCCESS;
+    if((watch->nr_used_slots + 1) * 4 > watch->nr_slots * 3) {
+        // grow only if the live paths need it, otherwise just sweep the deleted slots
+        size_t nr_slots = (watch->nr_results + 1) * 2 > watch->nr_slots ? watch->nr_slots * 2 : watch->nr_slots;
+        if(rebuild_slots(watch, nr_slots) != SUCCESS)
+            return ERR_ALLOCATING_MEMORY;
+    }
+    if(watch->nr_results == watch->results_capacity) {
+        char ** results = (char**)realloc(watch->results, 2 * watch->results_capacity * sizeof(char*));
+        if(results == NULL)
+            return ERR_ALLOCATING_MEMORY;
+        watch->results = results;
+        watch->results_capacity *= 2;
+    }
+    char * copy = strdup(path);
+    if(copy == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    size_t mask = watch->nr_slots - 1;
+    size_t i = hash_path(path) & mask;
+    while(watch->slots[i] >= 0)
+        i = (i + 1) & mask;
+    if(watch->slots[i] == EMPTY_SLOT)
+        watch->nr_used_slots++;
+    watch->slots[i] = watch->nr_results;
+    watch->results[watch->nr_results++] = copy;
+    return SUCCESS;
+}
+
+static void remove_result_locked(findall_watch_t * watch, long slot) {
+    int index = watch->slots[slot];
+    free(watch->results[index]);
+    watch->slots[slot] = DELETED_SLOT;
+    // the last path takes the place of the removed one
+    int last = watch->nr_results - 1;
+    if(index != last) {
+        watch->slots[find_slot(watch, watch->results[last])] = index;
+        watch->results[index] = watch->results[last];
+    }
+    watch->nr_results--;
+}
+
+static void set_result(findall_watch_t * watch, const char * path, bool valid) {
+    pthread_rwlock_wrlock(&watch->lock);
+    long slot = find_slot(watch, path);
+    if(valid && slot < 0)
+        add_result_locked(watch, path);
+    else if(!valid && slot >= 0)
+        remove_result_locked(watch, slot);
+    pthread_rwlock_unlock(&watch->lock);
+}
+
+/** Takes every file under dir_path out of the result. */
+static void remove_tree_results(findall_watch_t * watch, const char * dir_path) {
+    size_t length = strlen(dir_path);
+    pthread_rwlock_wrlock(&watch->lock);
+    for(size_t k = 0; k < watch->nr_results; ) {
+        const char * path = watch->results[k];
+        if(strncmp(path, dir_path, length) == 0 && path[length] == '/')
+            remove_result_locked(watch, find_slot(watch, path));
+        else
+            k++;
+    }
+    pthread_rwlock_unlock(&watch->lock);
+}
+
+static void validate_path(findall_watch_t * watch, const char * path) {
+    struct stat inode;
+    bool valid = false;
+    // only regular files are reported, like a walk of the tree would
+    if(lstat(path, &inode) == 0 && S_ISREG(inode.st_mode) && watch->validator(path, &valid, watch->arg) != SUCCESS)
+        valid = false;
+    set_result(watch, path, valid);
+}
+
+static void watch_dir(findall_watch_t * watch, const char * dir_path) {
+    int wd = inotify_add_watch(watch->inotify_fd, dir_path, WATCH_MASK);
+    if(wd < 0)
+        return;
+    if((size_t)wd >= watch->dirs_capacity) {
+        size_t capacity = watch->dirs_capacity;
+        while((size_t)wd >= capacity)
+            capacity *= 2;
+        char ** dirs = (char**)realloc(watch->dirs, capacity * sizeof(char*));
+        if(dirs == NULL)
+            return;
+        memset(dirs + watch->dirs_capacity, 0, (capacity - watch->dirs_capacity) * sizeof(char*));
+        watch->dirs = dirs;
+        watch->dirs_capacity = capacity;
+    }
+    free(watch->dirs[wd]);
+    watch->dirs[wd] = strdup(dir_path);
+}
+
+/** Stops watching dir_path and every directory under it. */
+static void unwatch_tree(findall_watch_t * watch, const char * dir_path) {
+    size_t length = strlen(dir_path);
+    for(size_t wd = 0; wd < watch->dirs_capacity; wd++) {
+        const char * path = watch->dirs[wd];
+        if(path != NULL && strncmp(path, dir_path, length) == 0 && (path[length] == '/' || path[length] == 0)) {
+            inotify_rm_watch(watch->inotify_fd, wd);
+            free(watch->dirs[wd]);
+            watch->dirs[wd] = NULL;
+        }
+    }
+}
+
+static int visit_watched_entry(walk_entry_t * entry, void * arg) {
+    findall_watch_t * watch = (findall_watch_t*)arg;
+    mode_t type = walk_entry_type(entry);
+    // a directory is watched before it is read, so no file created in it can be missed
+    if(type == S_IFDIR)
+        watch_dir(watch, entry->path);
+    else if(type == S_IFREG)
+        validate_path(watch, entry->path);
+    return SUCCESS;
+}
+
+static int add_tree(findall_watch_t * watch, const char * dir_path) {
+    watch_dir(watch, dir_path);
+    return walk_directory_tree(dir_path, true, 1, visit_watched_entry, watch);
+}
+
+static void handle_events(findall_watch_t * watch, const char * buf, ssize_t size) {
+    char path[MAX_PATH_SIZE+1];
+    char ** touched = NULL;
+    size_t nr_touched = 0;
+
+    for(const char * pos = buf; pos < buf + size; ) {
+        const struct inotify_event * event = (const struct inotify_event*)pos;
+        pos += sizeof(struct inotify_event) + event->len;
+        if(event->mask & IN_Q_OVERFLOW) {
+            // events were lost: start over
+            unwatch_tree(watch, watch->root);
+            pthread_rwlock_wrlock(&watch->lock);
+            for(size_t k = 0; k < watch->nr_results; k++)
+                free(watch->results[k]);
+            watch->nr_results = 0;
+            rebuild_slots(watch, watch->nr_slots);
+            pthread_rwlock_unlock(&watch->lock);
+            add_tree(watch, watch->root);
+            continue;
+        }
+        if(event->wd < 0 || (size_t)event->wd >= watch->dirs_capacity || watch->dirs[event->wd] == NULL)
+            continue;
+        if(event->mask & IN_IGNORED) {
+            // the directory is gone
+            free(watch->dirs[event->wd]);
+            watch->dirs[event->wd] = NULL;
+            continue;
+        }
+        if(event->len == 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", watch->dirs[event->wd], event->name);
+        if(event->mask & IN_ISDIR) {
+            if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                unwatch_tree(watch, path);
+                remove_tree_results(watch, path);
+            }else if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                add_tree(watch, path);
+            }
+            continue;
+        }
+        // the files are validated once per batch of events, however many times they were written
+        bool seen = false;
+        for(size_t i = 0; i < nr_touched && !seen; i++)
+            seen = strcmp(touched[i], path) == 0;
+        if(!seen) {
+            char ** grown = (char**)realloc(touched, (nr_touched + 1) * sizeof(char*));
+            if(grown == NULL)
+                break;
+            touched = grown;
+            touched[nr_touched++] = strdup(path);
+        }
+    }
+    for(size_t i = 0; i < nr_touched; i++) {
+        if(touched[i] != NULL)
+            validate_path(watch, touched[i]);
+        free(touched[i]);
+    }
+    free(touched);
+}
+
+static void * watch_thread(void * arg) {
+    findall_watch_t * watch = (findall_watch_t*)arg;
+    char * buf = (char*)malloc(EVENT_BUF_SIZE);
+    if(buf == NULL)
+        return NULL;
+    for(;;) {
+        ssize_t size = read(watch->inotify_fd, buf, EVENT_BUF_SIZE);
+        if(size < 0 && errno == EINTR)
+            continue;
+        if(size <= 0)
+            break;
+        // the thread is only cancelled while it waits for events, never in the middle of an update
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        handle_events(watch, buf, size);
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    }
+    free(buf);
+    return NULL;
+}
+
+static void strip_trailing_slashes(char * path) {
+    size_t length = strlen(path);
+    while(length > 1 && path[length-1] == '/')
+        path[--length] = 0;
+}
+
+int findall_watch_start(findall_watch_t ** watch, const char * root, watch_validator_t validator, void * arg) {
+    int return_value = SUCCESS;
+    findall_watch_t * new_watch = (findall_watch_t*)calloc(1, sizeof(findall_watch_t));
+    if(new_watch == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    strncpy(new_watch->root, root, MAX_PATH_SIZE);
+    strip_trailing_slashes(new_watch->root);
+    new_watch->validator = validator;
+    new_watch->arg = arg;
+    new_watch->results_capacity = 1024;
+    new_watch->results = (char**)malloc(new_watch->results_capacity * sizeof(char*));
+    new_watch->dirs_capacity = 1024;
+    new_watch->dirs = (char**)calloc(new_watch->dirs_capacity, sizeof(char*));
+    new_watch->nr_slots = 1024;
+    if(new_watch->results == NULL || new_watch->dirs == NULL || rebuild_slots(new_watch, new_watch->nr_slots) != SUCCESS) {
+        return_value = ERR_ALLOCATING_MEMORY;
+        goto clean_up;
+    }
+    pthread_rwlock_init(&new_watch->lock, NULL);
+    new_watch->inotify_fd = inotify_init1(IN_CLOEXEC);
+    if(new_watch->inotify_fd < 0) {
+        return_value = ERR_INVALID_PATH;
+        goto clean_up;
+    }
+    // the initial result, built with the same walk as a plain findall
+    return_value = add_tree(new_watch, new_watch->root);
+    if(return_value != SUCCESS) {
+        close(new_watch->inotify_fd);
+        goto clean_up;
+    }
+    if(pthread_create(&new_watch->thread, NULL, watch_thread, new_watch) != 0) {
+        close(new_watch->inotify_fd);
+        return_value = ERR_CREATING_THREAD;
+        goto clean_up;
+    }
+    *watch = new_watch;
+    return SUCCESS;
+
+    clean_up:
+    for(size_t k = 0; k < new_watch->nr_results; k++)
+        free(new_watch->results[k]);
+    for(size_t wd = 0; new_watch->dirs != NULL && wd < new_watch->dirs_capacity; wd++)
+        free(new_watch->dirs[wd]);
+    free(new_watch->results);
+    free(new_watch->dirs);
+    free(new_watch->slots);
+    free(new_watch);
+    return return_value;
+}
+
+void findall_watch_stop(findall_watch_t * watch) {
+    if(watch == NULL)
+        return;
+    pthread_cancel(watch->thread);
+    pthread_join(watch->thread, NULL);
+    close(watch->inotify_fd);
+    for(size_t k = 0; k < watch->nr_results; k++)
+        free(watch->results[k]);
+    for(size_t wd = 0; wd < watch->dirs_capacity; wd++)
+        free(watch->dirs[wd]);
+    free(watch->results);
+    free(watch->dirs);
+    free(watch->slots);
+    pthread_rwlock_destroy(&watch->lock);
+    free(watch);
+}
+
+bool findall_watch_covers(findall_watch_t * watch, const char * path) {
+    char normalized[MAX_PATH_SIZE+1];
+    strncpy(normalized, path, MAX_PATH_SIZE);
+    normalized[MAX_PATH_SIZE] = 0;
+    strip_trailing_slashes(normalized);
+    return strcmp(normalized, watch->root) == 0;
+}
+
+int findall_watch_write(findall_watch_t * watch, out_writer_t * output) {
+    size_t size = 0;
+    // the result is copied under the lock and written after it: a slow client must not hold back the updates
+    pthread_rwlock_rdlock(&watch->lock);
+    for(size_t k = 0; k < watch->nr_results; k++)
+        size += strlen(watch->results[k]) + 1;
+    char * copy = (char*)malloc(size + 1);
+    if(copy == NULL) {
+        pthread_rwlock_unlock(&watch->lock);
+        return ERR_ALLOCATING_MEMORY;
+    }
+    char * end = copy;
+    for(size_t k = 0; k < watch->nr_results; k++) {
+        size_t length = strlen(watch->results[k]);
+        memcpy(end, watch->results[k], length);
+        end += length;
+        *end++ = '\n';
+    }
+    pthread_rwlock_unlock(&watch->lock);
+    int return_value = writer_write(output, copy, size);
+    free(copy);
+    return return_value;
+}
@@ -0,0 +1,26 @@
+#ifndef __FINDALL_WATCH_H__
+#define __FINDALL_WATCH_H__
+
+#include <stdbool.h>
+
+#include "out_writer.h"
+
+/** Decides if the file found at path belongs to the findall result. */
+typedef int (*watch_validator_t)(const char * path, bool * valid, void * arg);
+
+typedef struct findall_watch findall_watch_t;
+
+/**
+ * Builds the findall result of the tree rooted at root, then starts a thread which keeps it current:
+ * every directory of the tree is watched with inotify and only the files named by the create, modify,
+ * attribute change (a chmod may make a file unreadable), move and delete events are validated again. Directories moved into the tree are walked, the ones
+ * moved out or deleted take their files out of the result.
+ */
+int findall_watch_start(findall_watch_t ** watch, const char * root, watch_validator_t validator, void * arg);
+void findall_watch_stop(findall_watch_t * watch);
+/** Tells if path is the root of the watched tree (trailing slashes aside). */
+bool findall_watch_covers(findall_watch_t * watch, const char * path);
+/** Writes the current result, one path per line, without touching the file system. */
+int findall_watch_write(findall_watch_t * watch, out_writer_t * output);
+
+#endif
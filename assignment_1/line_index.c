@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "a1.h"
+#include "line_index.h"
+#include "line_scan.h"
+#include "section_scan.h"
+#include "sf_cache.h"
+
+#define LINE_INDEX_MAGIC "SFLI"
+
+/** Start of an index file, followed by the start offset (from the section start) of every line. */
+typedef struct line_index_header{
+    char magic[4];
+    uint32_t nr_lines;
+    sf_cache_key_t key;
+    /** offset and size of the indexed section, an edited header invalidates the index as well */
+    int64_t sect_offset;
+    int64_t sect_size;
+    /** end of the last line (without its new line, if it has one) */
+    uint32_t last_line_end;
+    uint32_t padding;
+}line_index_header_t;
+
+static void index_file_path(char * path, size_t size, const char * index_dir, const struct stat * inode, int section_nr) {
+    snprintf(path, size, "%s/%llu-%llu-%d.idx", index_dir, (unsigned long long)inode->st_dev,
+             (unsigned long long)inode->st_ino, section_nr);
+}
+
+/** Scans the section once, collecting the start of every line, and writes the index file. */
+static int build_index(const char * path, int fd, const sf_cache_key_t * key, const sect_header_t * section) {
+    int return_value = SUCCESS;
+    line_index_header_t header;
+    uint32_t * starts = NULL;
+    size_t nr_starts = 0;
+    size_t capacity = 1024;
+    size_t size = (size_t)section->sect_size;
+    size_t done = 0;
+    char last = '\n';
+    char tmp_path[MAX_PATH_SIZE + 16];
+    char * chunk = (char*)malloc(SECTION_CHUNK_SIZE);
+
+    starts = (uint32_t*)malloc(capacity * sizeof(uint32_t));
+    if(chunk == NULL || starts == NULL) {
+        return_value = ERR_ALLOCATING_MEMORY;
+        goto clean_up;
+    }
+    while(done < size) {
+        size_t chunk_size = size - done < SECTION_CHUNK_SIZE ? size - done : SECTION_CHUNK_SIZE;
+        ssize_t nr_bytes = scan_read_fully(fd, chunk, chunk_size, section->sect_offset + done);
+        if(nr_bytes < 0) {
+            return_value = ERR_READING_FILE;
+            goto clean_up;
+        }
+        if(nr_bytes == 0)
+            break;
+        if(done == 0) {
+            // the first line starts with the section
+            starts[nr_starts++] = 0;
+        }
+        const char * pos = chunk;
+        const char * end = chunk + nr_bytes;
+        const char * newline;
+        while(pos < end && (newline = find_nth_newline(pos, end - pos, 1, NULL)) != NULL) {
+            if(nr_starts == capacity) {
+                uint32_t * grown = (uint32_t*)realloc(starts, capacity * 2 * sizeof(uint32_t));
+                if(grown == NULL) {
+                    return_value = ERR_ALLOCATING_MEMORY;
+                    goto clean_up;
+                }
+                starts = grown;
+                capacity *= 2;
+            }
+            starts[nr_starts++] = done + (newline - chunk) + 1;
+            pos = newline + 1;
+        }
+        last = chunk[nr_bytes-1];
+        done += nr_bytes;
+        if((size_t)nr_bytes < chunk_size)
+            break;
+    }
+    // a new line at the very end doesn't start another line
+    if(nr_starts > 0 && starts[nr_starts-1] == done)
+        nr_starts--;
+
+    memcpy(header.magic, LINE_INDEX_MAGIC, 4);
+    header.nr_lines = nr_starts;
+    header.key = *key;
+    header.sect_offset = section->sect_offset;
+    header.sect_size = section->sect_size;
+    header.last_line_end = done - (done > 0 && last == '\n' ? 1 : 0);
+    header.padding = 0;
+
+    // write a temporary file first, so a reader never sees half of an index
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+    int index_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(index_fd < 0) {
+        return_value = ERR_INVALID_PATH;
+        goto clean_up;
+    }
+    if(write(index_fd, &header, sizeof(header)) != sizeof(header)
+       || write(index_fd, starts, nr_starts * sizeof(uint32_t)) != (ssize_t)(nr_starts * sizeof(uint32_t))) {
+        return_value = ERR_WRITING_OUTPUT;
+    }
+    close(index_fd);
+    if(return_value == SUCCESS && rename(tmp_path, path) != 0)
+        return_value = ERR_INVALID_PATH;
+    if(return_value != SUCCESS)
+        unlink(tmp_path);
+
+    clean_up:
+    free(chunk);
+    free(starts);
+    return return_value;
+}
+
+/** Maps the index file if it exists and still describes the current content of the section. */
+static int map_index(const char * path, const sf_cache_key_t * key, const sect_header_t * section, void ** data, size_t * size) {
+    int index_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(index_fd < 0)
+        return ERR_INVALID_PATH;
+    off_t file_size = lseek(index_fd, 0, SEEK_END);
+    if(file_size < (off_t)sizeof(line_index_header_t)) {
+        close(index_fd);
+        return ERR_INVALID_FILE_FORMAT;
+    }
+    *data = mmap(NULL, file_size, PROT_READ, MAP_SHARED, index_fd, 0);
+    close(index_fd);
+    if(*data == MAP_FAILED)
+        return ERR_ALLOCATING_MEMORY;
+    *size = file_size;
+    line_index_header_t * header = (line_index_header_t*)*data;
+    if(memcmp(header->magic, LINE_INDEX_MAGIC, 4) != 0 || memcmp(&header->key, key, sizeof(sf_cache_key_t)) != 0
+       || header->sect_offset != section->sect_offset || header->sect_size != section->sect_size
+       || file_size != (off_t)(sizeof(line_index_header_t) + header->nr_lines * sizeof(uint32_t))) {
+        munmap(*data, file_size);
+        return ERR_INVALID_FILE_FORMAT;
+    }
+    return SUCCESS;
+}
+
+int line_index_locate(const char * index_dir, int fd, const struct stat * inode, int section_nr, const sect_header_t * section,
+                      long line_nr, off_t * line_start, size_t * line_length, bool * found) {
+    char path[MAX_PATH_SIZE + 64];
+    sf_cache_key_t key;
+    void * data;
+    size_t size;
+
+    *found = false;
+    sf_cache_key_from_stat(inode, &key);
+    index_file_path(path, sizeof(path), index_dir, inode, section_nr);
+    int return_value = map_index(path, &key, section, &data, &size);
+    if(return_value != SUCCESS) {
+        // missing or stale: (re)build it once, later lookups only map it
+        return_value = build_index(path, fd, &key, section);
+        if(return_value != SUCCESS)
+            return return_value;
+        return_value = map_index(path, &key, section, &data, &size);
+        if(return_value != SUCCESS)
+            return return_value;
+    }
+    line_index_header_t * header = (line_index_header_t*)data;
+    const uint32_t * starts = (const uint32_t*)((char*)data + sizeof(line_index_header_t));
+    if(line_nr >= 1 && (unsigned long)line_nr <= header->nr_lines) {
+        uint32_t end = (unsigned long)line_nr < header->nr_lines ? starts[line_nr] - 1 : header->last_line_end;
+        *line_start = section->sect_offset + starts[line_nr-1];
+        *line_length = end - starts[line_nr-1];
+        *found = true;
+    }
+    munmap(data, size);
+    return SUCCESS;
+}
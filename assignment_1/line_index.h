@@ -0,0 +1,20 @@
+#ifndef __LINE_INDEX_H__
+#define __LINE_INDEX_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "../common/sf_format.h"
+
+/**
+ * Finds a line of a section through its line-offset index, kept in index_dir as "<dev>-<ino>-<section_nr>.idx".
+ * The index is built by one scan of the section the first time it is needed, and rebuilt whenever the file
+ * changes (its size or modification time differs from the ones recorded in the index).
+ * Sets *found to false if the section has fewer than line_nr lines.
+ */
+int line_index_locate(const char * index_dir, int fd, const struct stat * inode, int section_nr, const sect_header_t * section,
+                      long line_nr, off_t * line_start, size_t * line_length, bool * found);
+
+#endif
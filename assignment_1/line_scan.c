@@ -0,0 +1,241 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "line_scan.h"
+
+#if defined(__x86_64__)
+#define LINE_SCAN_X86
+#include <immintrin.h>
+#endif
+
+typedef size_t (*count_fn_t)(const char *, size_t);
+typedef const char * (*find_fn_t)(const char *, size_t, size_t, size_t *);
+typedef void (*reverse_fn_t)(char *, const char *, size_t);
+
+static size_t count_newlines_scalar(const char * buf, size_t size) {
+    size_t count = 0;
+    const char * end = buf + size;
+    // memchr is vectorized by the C library even when we can't be
+    while(buf < end && (buf = memchr(buf, '\n', end - buf)) != NULL) {
+        count++;
+        buf++;
+    }
+    return count;
+}
+
+static const char * find_nth_newline_scalar(const char * buf, size_t size, size_t n, size_t * nr_found) {
+    size_t count = 0;
+    const char * end = buf + size;
+    while(buf < end && (buf = memchr(buf, '\n', end - buf)) != NULL) {
+        if(++count == n)
+            return buf;
+        buf++;
+    }
+    if(nr_found != NULL)
+        *nr_found = count;
+    return NULL;
+}
+
+/** Returns the position of the k-th (from 1) set bit of mask. */
+static inline int nth_set_bit(uint32_t mask, size_t k) {
+    while(--k > 0)
+        mask &= mask - 1;
+    return __builtin_ctz(mask);
+}
+
+static void reverse_bytes_scalar(char * dst, const char * src, size_t size) {
+    // a byte from each end per round, both loaded before either is stored, so dst may be src
+    for(size_t i = 0, j = size; i + 1 < j; i++) {
+        j--;
+        char front = src[i];
+        dst[i] = src[j];
+        dst[j] = front;
+    }
+    if(size % 2 == 1)
+        dst[size / 2] = src[size / 2];
+}
+
+#ifdef LINE_SCAN_X86
+
+static size_t count_newlines_sse2(const char * buf, size_t size) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+    while(i + 16 <= size) {
+        // the comparisons give -1 per match, so subtracting them counts in 8 bit lanes for at most 255 rounds
+        __m128i acc = _mm_setzero_si128();
+        size_t rounds = (size - i) / 16;
+        if(rounds > 255)
+            rounds = 255;
+        for(size_t r = 0; r < rounds; r++, i += 16) {
+            __m128i chunk = _mm_loadu_si128((const __m128i*)(buf + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(chunk, newline));
+        }
+        __m128i sums = _mm_sad_epu8(acc, _mm_setzero_si128());
+        count += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_extract_epi16(sums, 4);
+    }
+    return count + count_newlines_scalar(buf + i, size - i);
+}
+
+static const char * find_nth_newline_sse2(const char * buf, size_t size, size_t n, size_t * nr_found) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+    for(; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(buf + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline));
+        size_t bits = __builtin_popcount(mask);
+        if(count + bits >= n)
+            return buf + i + nth_set_bit(mask, n - count);
+        count += bits;
+    }
+    size_t tail_found = 0;
+    const char * found = find_nth_newline_scalar(buf + i, size - i, n - count, &tail_found);
+    if(found == NULL && nr_found != NULL)
+        *nr_found = count + tail_found;
+    return found;
+}
+
+__attribute__((target("avx2")))
+static size_t count_newlines_avx2(const char * buf, size_t size) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+    while(i + 32 <= size) {
+        __m256i acc = _mm256_setzero_si256();
+        size_t rounds = (size - i) / 32;
+        if(rounds > 255)
+            rounds = 255;
+        for(size_t r = 0; r < rounds; r++, i += 32) {
+            __m256i chunk = _mm256_loadu_si256((const __m256i*)(buf + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(chunk, newline));
+        }
+        __m256i sums = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+        count += (size_t)_mm256_extract_epi64(sums, 0) + (size_t)_mm256_extract_epi64(sums, 1)
+               + (size_t)_mm256_extract_epi64(sums, 2) + (size_t)_mm256_extract_epi64(sums, 3);
+    }
+    return count + count_newlines_sse2(buf + i, size - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static const char * find_nth_newline_avx2(const char * buf, size_t size, size_t n, size_t * nr_found) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+    for(; i + 32 <= size; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(buf + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline));
+        size_t bits = __builtin_popcount(mask);
+        if(count + bits >= n)
+            return buf + i + nth_set_bit(mask, n - count);
+        count += bits;
+    }
+    size_t tail_found = 0;
+    const char * found = find_nth_newline_sse2(buf + i, size - i, n - count, &tail_found);
+    if(found == NULL && nr_found != NULL)
+        *nr_found = count + tail_found;
+    return found;
+}
+
+__attribute__((target("ssse3")))
+static void reverse_bytes_ssse3(char * dst, const char * src, size_t size) {
+    const __m128i reversed = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    size_t i = 0;
+    // a block from each end per round, both loaded before either is stored
+    for(; size - 2 * i >= 32; i += 16) {
+        __m128i front = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i back = _mm_loadu_si128((const __m128i*)(src + size - i - 16));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_shuffle_epi8(back, reversed));
+        _mm_storeu_si128((__m128i*)(dst + size - i - 16), _mm_shuffle_epi8(front, reversed));
+    }
+    // the middle is reversed onto itself
+    reverse_bytes_scalar(dst + i, src + i, size - 2 * i);
+}
+
+__attribute__((target("avx2")))
+static void reverse_bytes_avx2(char * dst, const char * src, size_t size) {
+    // the shuffle only moves bytes inside each 128 bit lane, the permutation then swaps the lanes
+    const __m256i reversed = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                              15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    size_t i = 0;
+    for(; size - 2 * i >= 64; i += 32) {
+        __m256i front = _mm256_loadu_si256((const __m256i*)(src + i));
+        __m256i back = _mm256_loadu_si256((const __m256i*)(src + size - i - 32));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute4x64_epi64(_mm256_shuffle_epi8(back, reversed), 0x4E));
+        _mm256_storeu_si256((__m256i*)(dst + size - i - 32), _mm256_permute4x64_epi64(_mm256_shuffle_epi8(front, reversed), 0x4E));
+    }
+    reverse_bytes_ssse3(dst + i, src + i, size - 2 * i);
+}
+
+#endif
+
+static count_fn_t count_impl = NULL;
+static find_fn_t find_impl = NULL;
+static reverse_fn_t reverse_impl = NULL;
+static const char * variant = "scalar";
+
+static void select_implementation(void) {
+    count_fn_t count = count_newlines_scalar;
+    find_fn_t find = find_nth_newline_scalar;
+    reverse_fn_t reverse = reverse_bytes_scalar;
+    const char * name = "scalar";
+#ifdef LINE_SCAN_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        count = count_newlines_avx2;
+        find = find_nth_newline_avx2;
+        reverse = reverse_bytes_avx2;
+        name = "avx2";
+    }else if(__builtin_cpu_supports("sse2")) {
+        count = count_newlines_sse2;
+        find = find_nth_newline_sse2;
+        name = "sse2";
+        // the byte shuffle came with SSSE3
+        if(__builtin_cpu_supports("ssse3"))
+            reverse = reverse_bytes_ssse3;
+    }
+#endif
+    // every thread computes the same values, so the race on the first call is harmless
+    variant = name;
+    __atomic_store_n(&reverse_impl, reverse, __ATOMIC_RELEASE);
+    __atomic_store_n(&find_impl, find, __ATOMIC_RELEASE);
+    __atomic_store_n(&count_impl, count, __ATOMIC_RELEASE);
+}
+
+size_t count_newlines(const char * buf, size_t size) {
+    count_fn_t count = __atomic_load_n(&count_impl, __ATOMIC_ACQUIRE);
+    if(count == NULL) {
+        select_implementation();
+        count = count_impl;
+    }
+    return count(buf, size);
+}
+
+const char * find_nth_newline(const char * buf, size_t size, size_t n, size_t * nr_found) {
+    find_fn_t find = __atomic_load_n(&find_impl, __ATOMIC_ACQUIRE);
+    if(find == NULL) {
+        select_implementation();
+        find = find_impl;
+    }
+    if(n == 0) {
+        if(nr_found != NULL)
+            *nr_found = 0;
+        return NULL;
+    }
+    return find(buf, size, n, nr_found);
+}
+
+void reverse_bytes(char * dst, const char * src, size_t size) {
+    reverse_fn_t reverse = __atomic_load_n(&reverse_impl, __ATOMIC_ACQUIRE);
+    if(reverse == NULL) {
+        select_implementation();
+        reverse = reverse_impl;
+    }
+    reverse(dst, src, size);
+}
+
+const char * line_scan_variant(void) {
+    if(__atomic_load_n(&count_impl, __ATOMIC_ACQUIRE) == NULL)
+        select_implementation();
+    return variant;
+}
@@ -0,0 +1,26 @@
+#ifndef __LINE_SCAN_H__
+#define __LINE_SCAN_H__
+
+#include <stddef.h>
+
+/**
+ * Line-boundary kernels used on the sections of the sf files. The implementation (AVX2, SSE2 or plain C)
+ * is chosen at the first call, according to what the CPU supports.
+ */
+
+/** Returns the number of '\n' bytes in buf. */
+size_t count_newlines(const char * buf, size_t size);
+/**
+ * Returns a pointer to the n-th '\n' (counting from 1) of buf, or NULL if there are fewer.
+ * In that case *nr_found (if not NULL) holds the number of '\n' bytes found.
+ */
+const char * find_nth_newline(const char * buf, size_t size, size_t n, size_t * nr_found);
+/**
+ * Writes the size bytes of src to dst in reverse order (byte shuffles when the CPU has SSSE3 or AVX2).
+ * dst may be src itself, the bytes are then reversed in place; otherwise the two must not overlap.
+ */
+void reverse_bytes(char * dst, const char * src, size_t size);
+/** Name of the selected implementation: "avx2", "sse2" or "scalar". */
+const char * line_scan_variant(void);
+
+#endif
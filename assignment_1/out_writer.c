@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "a1.h"
+#include "out_writer.h"
+#include "run_stats.h"
+
+int writer_init(out_writer_t * writer, int fd) {
+    writer->fd = fd;
+    writer->len = 0;
+    writer->flushed = 0;
+    writer->capacity = OUT_WRITER_BUF_SIZE;
+    writer->line_buffered = isatty(fd);
+    writer->buf = (char*)malloc(writer->capacity);
+    if(writer->buf == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    pthread_mutex_init(&writer->lock, NULL);
+    return SUCCESS;
+}
+
+static int flush_locked(out_writer_t * writer) {
+    size_t done = 0;
+    uint64_t start = stats_clock();
+    while(done < writer->len) {
+        ssize_t nr_bytes = write(writer->fd, writer->buf + done, writer->len - done);
+        stats_add(STATS_CALLS_WRITE, 1);
+        if(nr_bytes < 0) {
+            if(errno == EINTR)
+                continue;
+            writer->len = 0;
+            return ERR_WRITING_OUTPUT;
+        }
+        done += nr_bytes;
+    }
+    stats_add(STATS_BYTES_WRITTEN, writer->len);
+    stats_add_time(STATS_TIME_OUTPUT, start);
+    writer->flushed += writer->len;
+    writer->len = 0;
+    return SUCCESS;
+}
+
+static int write_locked(out_writer_t * writer, const char * data, size_t size) {
+    int return_value = SUCCESS;
+    while(size > 0) {
+        if(writer->len == writer->capacity) {
+            return_value = flush_locked(writer);
+            if(return_value != SUCCESS)
+                return return_value;
+        }
+        size_t chunk = writer->capacity - writer->len;
+        if(chunk > size)
+            chunk = size;
+        memcpy(writer->buf + writer->len, data, chunk);
+        writer->len += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+    return return_value;
+}
+
+int writer_write(out_writer_t * writer, const char * data, size_t size) {
+    pthread_mutex_lock(&writer->lock);
+    int return_value = write_locked(writer, data, size);
+    pthread_mutex_unlock(&writer->lock);
+    return return_value;
+}
+
+int writer_write_line(out_writer_t * writer, const char * line) {
+    size_t size = strlen(line);
+    pthread_mutex_lock(&writer->lock);
+    // keep the whole line in one flush, so a reader of a pipe never sees half of it
+    int return_value = SUCCESS;
+    if(writer->len + size + 1 > writer->capacity && size + 1 <= writer->capacity)
+        return_value = flush_locked(writer);
+    if(return_value == SUCCESS)
+        return_value = write_locked(writer, line, size);
+    if(return_value == SUCCESS)
+        return_value = write_locked(writer, "\n", 1);
+    if(return_value == SUCCESS && writer->line_buffered)
+        return_value = flush_locked(writer);
+    pthread_mutex_unlock(&writer->lock);
+    return return_value;
+}
+
+int writer_printf(out_writer_t * writer, const char * format, ...) {
+    char text[1024];
+    char * formatted = text;
+    va_list args;
+
+    va_start(args, format);
+    int size = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if(size < 0)
+        return ERR_WRITING_OUTPUT;
+    if((size_t)size >= sizeof(text)) {
+        // rare long text: format it again in a buffer big enough
+        formatted = (char*)malloc(size + 1);
+        if(formatted == NULL)
+            return ERR_ALLOCATING_MEMORY;
+        va_start(args, format);
+        vsnprintf(formatted, size + 1, format, args);
+        va_end(args);
+    }
+    pthread_mutex_lock(&writer->lock);
+    int return_value = write_locked(writer, formatted, size);
+    if(return_value == SUCCESS && writer->line_buffered && memchr(formatted, '\n', size) != NULL)
+        return_value = flush_locked(writer);
+    pthread_mutex_unlock(&writer->lock);
+    if(formatted != text)
+        free(formatted);
+    return return_value;
+}
+
+char * writer_reserve(out_writer_t * writer, size_t size) {
+    pthread_mutex_lock(&writer->lock);
+    // what is buffered leaves first, the memory stays bounded however much is written
+    if(writer->len + size > writer->capacity && flush_locked(writer) != SUCCESS) {
+        pthread_mutex_unlock(&writer->lock);
+        return NULL;
+    }
+    if(size > writer->capacity) {
+        // a single piece larger than the buffer: grown for it only, writer_commit shrinks it back
+        char * grown = (char*)realloc(writer->buf, size);
+        if(grown == NULL) {
+            pthread_mutex_unlock(&writer->lock);
+            return NULL;
+        }
+        writer->buf = grown;
+        writer->capacity = size;
+    }
+    return writer->buf + writer->len;
+}
+
+int writer_commit(out_writer_t * writer, size_t size) {
+    int return_value = SUCCESS;
+    const char * data = writer->buf + writer->len;
+    writer->len += size;
+    if(writer->capacity > OUT_WRITER_BUF_SIZE) {
+        // the oversized piece goes out with one write, then the buffer gets its usual size again
+        return_value = flush_locked(writer);
+        char * shrunk = (char*)realloc(writer->buf, OUT_WRITER_BUF_SIZE);
+        if(shrunk != NULL) {
+            writer->buf = shrunk;
+            writer->capacity = OUT_WRITER_BUF_SIZE;
+        }
+    }else if(writer->line_buffered && memchr(data, '\n', size) != NULL) {
+        return_value = flush_locked(writer);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return return_value;
+}
+
+int writer_flush(out_writer_t * writer) {
+    pthread_mutex_lock(&writer->lock);
+    int return_value = flush_locked(writer);
+    pthread_mutex_unlock(&writer->lock);
+    return return_value;
+}
+
+void writer_discard(out_writer_t * writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->len = 0;
+    pthread_mutex_unlock(&writer->lock);
+}
+
+int writer_close(out_writer_t * writer) {
+    int return_value = writer_flush(writer);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer->buf);
+    writer->buf = NULL;
+    return return_value;
+}
@@ -0,0 +1,45 @@
+#ifndef __OUT_WRITER_H__
+#define __OUT_WRITER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define OUT_WRITER_BUF_SIZE (256 * 1024)
+
+/** Buffered writer on top of a file descriptor, safe to use from several threads. */
+typedef struct out_writer{
+    int fd;
+    char * buf;
+    size_t len;
+    size_t capacity;
+    /** number of bytes already handed to write() */
+    size_t flushed;
+    /** flush after every line, used when the output goes to a terminal */
+    bool line_buffered;
+    pthread_mutex_t lock;
+}out_writer_t;
+
+int writer_init(out_writer_t * writer, int fd);
+/** Appends the bytes, flushing the buffer whenever it fills up. */
+int writer_write(out_writer_t * writer, const char * data, size_t size);
+/** Appends the string followed by a new line. The line is never interleaved with the lines of other threads. */
+int writer_write_line(out_writer_t * writer, const char * line);
+/** Appends the text formatted as by printf. */
+int writer_printf(out_writer_t * writer, const char * format, ...) __attribute__((format(printf, 2, 3)));
+/**
+ * Returns room for size contiguous bytes at the end of the buffer, for the caller to fill in place; NULL if it can't be had.
+ * The bytes already buffered are flushed first if there is not enough room left. Only a size larger than the whole buffer
+ * makes it grow, and writer_commit then writes that piece and shrinks the buffer back to OUT_WRITER_BUF_SIZE.
+ * The writer stays locked until writer_commit.
+ */
+char * writer_reserve(out_writer_t * writer, size_t size);
+/** Appends the first size bytes of the room writer_reserve gave (0 to drop them all) and unlocks the writer. */
+int writer_commit(out_writer_t * writer, size_t size);
+int writer_flush(out_writer_t * writer);
+/** Drops the buffered bytes which were not flushed yet. */
+void writer_discard(out_writer_t * writer);
+/** Flushes the remaining bytes and releases the buffer. */
+int writer_close(out_writer_t * writer);
+
+#endif
@@ -0,0 +1,198 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "a1.h"
+#include "query_server.h"
+
+struct server{
+    int listen_fd;
+    query_handler_t handler;
+    void * arg;
+};
+
+static char bound_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+
+static void stop_server(int signal_nr) {
+    (void)signal_nr;
+    unlink(bound_path);
+    _exit(0);
+}
+
+static int fill_address(struct sockaddr_un * address, const char * socket_path) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if(strlen(socket_path) >= sizeof(address->sun_path))
+        return ERR_INVALID_PATH;
+    strcpy(address->sun_path, socket_path);
+    return SUCCESS;
+}
+
+static long elapsed_ms(const struct timespec * start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/**
+ * Reads the request line and splits it into options, in place. Returns the number of parameters, -1 if there are
+ * too many of them or -2 if the whole line didn't arrive within REQUEST_TIMEOUT_MS.
+ */
+static int read_request(int fd, char * request, char ** parameters) {
+    size_t size = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while(size < MAX_REQUEST_SIZE - 1 && memchr(request, '\n', size) == NULL) {
+        // a client sending nothing, or a byte now and then, doesn't keep the thread for longer than the deadline
+        struct pollfd client = {.fd = fd, .events = POLLIN};
+        long remaining = REQUEST_TIMEOUT_MS - elapsed_ms(&start);
+        int ready = remaining > 0 ? poll(&client, 1, (int)remaining) : 0;
+        if(ready < 0 && errno == EINTR)
+            continue;
+        if(ready == 0)
+            return -2;
+        if(ready < 0)
+            break;
+        ssize_t nr_bytes = read(fd, request + size, MAX_REQUEST_SIZE - 1 - size);
+        if(nr_bytes < 0 && errno == EINTR)
+            continue;
+        if(nr_bytes <= 0)
+            break;
+        size += nr_bytes;
+    }
+    request[size] = 0;
+    request[strcspn(request, "\r\n")] = 0;
+
+    int nr_parameters = 0;
+    char * saveptr;
+    // the operation comes where main finds it, after the program name
+    parameters[nr_parameters++] = "a1";
+    for(char * token = strtok_r(request, " \t", &saveptr); token != NULL; token = strtok_r(NULL, " \t", &saveptr)) {
+        if(nr_parameters == MAX_REQUEST_PARAMETERS)
+            return -1;
+        parameters[nr_parameters++] = token;
+    }
+    parameters[nr_parameters] = NULL;
+    return nr_parameters;
+}
+
+static void * serve_clients(void * arg) {
+    struct server * server = (struct server*)arg;
+    char request[MAX_REQUEST_SIZE];
+    char * parameters[MAX_REQUEST_PARAMETERS + 1];
+    out_writer_t output;
+
+    for(;;) {
+        int client_fd = accept4(server->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if(client_fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE)
+                continue;
+            break;
+        }
+        int nr_parameters = read_request(client_fd, request, parameters);
+        if(writer_init(&output, client_fd) == SUCCESS) {
+            if(nr_parameters == -2)
+                writer_write_line(&output, "ERROR\nThe request was not received in time.");
+            else if(nr_parameters < 0)
+                writer_write_line(&output, "ERROR\nToo many options.");
+            else
+                server->handler(nr_parameters, parameters, &output, server->arg);
+            writer_close(&output);
+        }
+        close(client_fd);
+    }
+    return NULL;
+}
+
+int serve_queries(const char * socket_path, int nr_threads, query_handler_t handler, void * arg) {
+    struct sockaddr_un address;
+    struct server server = {.handler = handler, .arg = arg};
+    pthread_t threads[MAX_NR_THREADS];
+
+    if(fill_address(&address, socket_path) != SUCCESS)
+        return ERR_INVALID_PATH;
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(server.listen_fd < 0)
+        return ERR_INVALID_PATH;
+    // a socket left behind by a previous server is replaced
+    unlink(socket_path);
+    if(bind(server.listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(server.listen_fd, SOMAXCONN) != 0) {
+        close(server.listen_fd);
+        return ERR_INVALID_PATH;
+    }
+    strcpy(bound_path, socket_path);
+    // a client leaving early must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stop_server);
+    signal(SIGTERM, stop_server);
+
+    // every thread, the calling one included, accepts and answers clients on its own
+    int nr_started = 0;
+    for(; nr_started < nr_threads - 1; nr_started++) {
+        if(pthread_create(&threads[nr_started], NULL, serve_clients, &server) != 0)
+            break;
+    }
+    serve_clients(&server);
+    for(int i = 0; i < nr_started; i++)
+        pthread_join(threads[i], NULL);
+    close(server.listen_fd);
+    unlink(socket_path);
+    return ERR_INVALID_PATH;
+}
+
+int send_query(const char * socket_path, int nr_parameters, char ** parameters, int output_fd) {
+    struct sockaddr_un address;
+    char request[MAX_REQUEST_SIZE];
+    char answer[64 * 1024];
+    size_t size = 0;
+
+    if(fill_address(&address, socket_path) != SUCCESS)
+        return ERR_INVALID_PATH;
+    for(int i = 0; i < nr_parameters; i++) {
+        size_t length = strlen(parameters[i]);
+        if(size + length + 2 > sizeof(request))
+            return ERR_INVALID_ARGUMENTS;
+        memcpy(request + size, parameters[i], length);
+        size += length;
+        request[size++] = i + 1 < nr_parameters ? ' ' : '\n';
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        return ERR_INVALID_PATH;
+    if(connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return ERR_INVALID_PATH;
+    }
+    int return_value = SUCCESS;
+    if(write(fd, request, size) != (ssize_t)size)
+        return_value = ERR_WRITING_OUTPUT;
+    shutdown(fd, SHUT_WR);
+    while(return_value == SUCCESS) {
+        ssize_t nr_bytes = read(fd, answer, sizeof(answer));
+        if(nr_bytes < 0 && errno == EINTR)
+            continue;
+        if(nr_bytes < 0)
+            return_value = ERR_READING_FILE;
+        if(nr_bytes <= 0)
+            break;
+        for(ssize_t done = 0; done < nr_bytes; ) {
+            ssize_t written = write(output_fd, answer + done, nr_bytes - done);
+            if(written < 0) {
+                return_value = ERR_WRITING_OUTPUT;
+                break;
+            }
+            done += written;
+        }
+    }
+    close(fd);
+    return return_value;
+}
@@ -0,0 +1,29 @@
+#ifndef __QUERY_SERVER_H__
+#define __QUERY_SERVER_H__
+
+#include "out_writer.h"
+
+/** Longest request line accepted by the server. */
+#define MAX_REQUEST_SIZE 4096
+/** Most options a request may have (the operation included). */
+#define MAX_REQUEST_PARAMETERS 64
+/** Time a client has to send its whole request, in milliseconds. */
+#define REQUEST_TIMEOUT_MS 5000
+
+/**
+ * Answers one request. parameters has the layout of main's argv: parameters[1] is the operation,
+ * followed by its options. The answer is written to output, which goes back to the client.
+ */
+typedef void (*query_handler_t)(int nr_parameters, char ** parameters, out_writer_t * output, void * arg);
+
+/**
+ * Listens on the Unix domain socket socket_path and answers the requests of any number of clients with
+ * nr_threads threads. A client connects, sends one request as a line of space separated options
+ * ("extract path=f.sf section=2 line=7\n") and reads the answer until the server closes the connection.
+ * Only returns on error; SIGINT and SIGTERM remove the socket and stop the process.
+ */
+int serve_queries(const char * socket_path, int nr_threads, query_handler_t handler, void * arg);
+/** Sends one request to the server and copies its answer to output_fd. */
+int send_query(const char * socket_path, int nr_parameters, char ** parameters, int output_fd);
+
+#endif
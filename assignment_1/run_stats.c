@@ -0,0 +1,82 @@
+#include <time.h>
+#include <inttypes.h>
+
+#include "run_stats.h"
+
+static bool enabled = false;
+static uint64_t started;
+static uint64_t counters[STATS_NR_COUNTERS];
+
+static const char * counter_names[STATS_NR_COUNTERS] = {
+    [STATS_TIME_TRAVERSAL] = "traversal",
+    [STATS_TIME_STAT] = "stat",
+    [STATS_TIME_HEADER] = "header_parse",
+    [STATS_TIME_SCAN] = "section_scan",
+    [STATS_TIME_OUTPUT] = "output",
+    [STATS_CALLS_GETDENTS] = "getdents64",
+    [STATS_CALLS_OPEN] = "open",
+    [STATS_CALLS_STAT] = "stat",
+    [STATS_CALLS_READ] = "pread",
+    [STATS_CALLS_WRITE] = "write",
+    [STATS_BYTES_READ] = "bytes_read",
+    [STATS_BYTES_WRITTEN] = "bytes_written",
+    [STATS_DIRS_VISITED] = "dirs_visited",
+    [STATS_FILES_VISITED] = "files_visited",
+    [STATS_CACHE_HITS] = "cache_hits",
+    [STATS_CACHE_MISSES] = "cache_misses",
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void stats_enable(void) {
+    started = monotonic_ns();
+    __atomic_store_n(&enabled, true, __ATOMIC_RELEASE);
+}
+
+uint64_t stats_clock(void) {
+    return __atomic_load_n(&enabled, __ATOMIC_RELAXED) ? monotonic_ns() : 0;
+}
+
+void stats_add(stats_counter_t counter, uint64_t amount) {
+    if(__atomic_load_n(&enabled, __ATOMIC_RELAXED))
+        __atomic_add_fetch(&counters[counter], amount, __ATOMIC_RELAXED);
+}
+
+void stats_add_time(stats_counter_t counter, uint64_t start) {
+    if(start != 0)
+        stats_add(counter, monotonic_ns() - start);
+}
+
+void stats_report(FILE * stream, const char * operation, bool json) {
+    uint64_t wall_time = monotonic_ns() - started;
+    uint64_t values[STATS_NR_COUNTERS];
+    for(int i = 0; i < STATS_NR_COUNTERS; i++)
+        values[i] = __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+
+    if(json) {
+        fprintf(stream, "{\"operation\":\"%s\",\"wall_time_ns\":%" PRIu64 ",\"phases_ns\":{", operation, wall_time);
+        for(int i = STATS_TIME_TRAVERSAL; i <= STATS_TIME_OUTPUT; i++)
+            fprintf(stream, "%s\"%s\":%" PRIu64, i > STATS_TIME_TRAVERSAL ? "," : "", counter_names[i], values[i]);
+        fprintf(stream, "},\"syscalls\":{");
+        for(int i = STATS_CALLS_GETDENTS; i <= STATS_CALLS_WRITE; i++)
+            fprintf(stream, "%s\"%s\":%" PRIu64, i > STATS_CALLS_GETDENTS ? "," : "", counter_names[i], values[i]);
+        fprintf(stream, "}");
+        for(int i = STATS_BYTES_READ; i < STATS_NR_COUNTERS; i++)
+            fprintf(stream, ",\"%s\":%" PRIu64, counter_names[i], values[i]);
+        fprintf(stream, "}\n");
+        return;
+    }
+    fprintf(stream, "STATS %s\n", operation);
+    fprintf(stream, "wall time: %.3f ms\n", wall_time / 1e6);
+    // the phases overlap when several threads work, so their sum may exceed the wall time
+    for(int i = STATS_TIME_TRAVERSAL; i <= STATS_TIME_OUTPUT; i++)
+        fprintf(stream, "phase %s: %.3f ms\n", counter_names[i], values[i] / 1e6);
+    for(int i = STATS_CALLS_GETDENTS; i <= STATS_CALLS_WRITE; i++)
+        fprintf(stream, "syscall %s: %" PRIu64 "\n", counter_names[i], values[i]);
+    for(int i = STATS_BYTES_READ; i < STATS_NR_COUNTERS; i++)
+        fprintf(stream, "%s: %" PRIu64 "\n", counter_names[i], values[i]);
+}
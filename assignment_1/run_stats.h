@@ -0,0 +1,42 @@
+#ifndef __RUN_STATS_H__
+#define __RUN_STATS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/** What a run accounts for. The counters are process wide and only updated once stats_enable was called. */
+typedef enum stats_counter{
+    /** time spent in each phase, in nanoseconds, summed over the threads */
+    STATS_TIME_TRAVERSAL,
+    STATS_TIME_STAT,
+    STATS_TIME_HEADER,
+    STATS_TIME_SCAN,
+    STATS_TIME_OUTPUT,
+    /** system calls by type */
+    STATS_CALLS_GETDENTS,
+    STATS_CALLS_OPEN,
+    STATS_CALLS_STAT,
+    STATS_CALLS_READ,
+    STATS_CALLS_WRITE,
+    STATS_BYTES_READ,
+    STATS_BYTES_WRITTEN,
+    STATS_DIRS_VISITED,
+    STATS_FILES_VISITED,
+    /** lookups in the sf metadata cache */
+    STATS_CACHE_HITS,
+    STATS_CACHE_MISSES,
+    STATS_NR_COUNTERS
+}stats_counter_t;
+
+/** Starts accounting, and the wall clock of the run. */
+void stats_enable(void);
+/** Returns the monotonic time in nanoseconds to time a phase with, 0 if the stats are off. */
+uint64_t stats_clock(void);
+void stats_add(stats_counter_t counter, uint64_t amount);
+/** Adds the time elapsed since start (a value of stats_clock) to the counter of a phase. */
+void stats_add_time(stats_counter_t counter, uint64_t start);
+/** Writes the counters of the run, as "key: value" lines or as a single JSON object. */
+void stats_report(FILE * stream, const char * operation, bool json);
+
+#endif
@@ -0,0 +1,604 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "a1.h"
+#include "line_scan.h"
+#include "section_scan.h"
+#include "run_stats.h"
+
+/** The chunk buffer is reused by every scan of the thread, so the memory doesn't depend on the section size. */
+static __thread char chunk[SECTION_CHUNK_SIZE];
+
+/** A section which has to be counted. */
+typedef struct section_read{
+    int section;
+    off_t offset;
+    size_t size;
+}section_read_t;
+
+/** One read of the plan: either several small sections fetched at once, or a single large section streamed chunk by chunk. */
+typedef struct read_run{
+    off_t offset;
+    size_t size;
+    /** the sections of the run are reads[first] .. reads[last-1] */
+    int first;
+    int last;
+    bool streamed;
+}read_run_t;
+
+/** A range of a section, counted by a single thread. */
+typedef struct count_task{
+    int section;
+    off_t offset;
+    size_t size;
+    long nr_newlines;
+}count_task_t;
+
+/** The ranges of one parallel scan, taken by the threads in order. */
+typedef struct parallel_count{
+    int fd;
+    /** a range stops once its section has more than max_lines new lines (unless negative) */
+    long max_lines;
+    count_task_t * tasks;
+    size_t nr_tasks;
+    size_t next_task;
+    /** new lines found so far in each section, by all its ranges */
+    long * section_newlines;
+    int status;
+}parallel_count_t;
+
+int scan_parallelism(void) {
+    static int nr_cpus = 0;
+    int parallelism = __atomic_load_n(&nr_cpus, __ATOMIC_RELAXED);
+    if(parallelism == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        parallelism = online < 1 ? 1 : online > MAX_NR_THREADS ? MAX_NR_THREADS : (int)online;
+        __atomic_store_n(&nr_cpus, parallelism, __ATOMIC_RELAXED);
+    }
+    return parallelism;
+}
+
+static void count_range(parallel_count_t * count, count_task_t * task) {
+    size_t done = 0;
+    while(done < task->size) {
+        if(__atomic_load_n(&count->status, __ATOMIC_RELAXED) != SUCCESS)
+            return;
+        if(count->max_lines >= 0 && __atomic_load_n(&count->section_newlines[task->section], __ATOMIC_RELAXED) > count->max_lines)
+            return;
+        size_t chunk_size = task->size - done < SECTION_CHUNK_SIZE ? task->size - done : SECTION_CHUNK_SIZE;
+        ssize_t nr_bytes = scan_read_fully(count->fd, chunk, chunk_size, task->offset + done);
+        if(nr_bytes < 0) {
+            __atomic_store_n(&count->status, ERR_READING_FILE, __ATOMIC_RELAXED);
+            return;
+        }
+        if(nr_bytes == 0)
+            break;
+        long nr_newlines = count_newlines(chunk, nr_bytes);
+        task->nr_newlines += nr_newlines;
+        __atomic_add_fetch(&count->section_newlines[task->section], nr_newlines, __ATOMIC_RELAXED);
+        done += nr_bytes;
+        if((size_t)nr_bytes < chunk_size)
+            break;
+    }
+}
+
+static void * count_worker(void * arg) {
+    parallel_count_t * count = (parallel_count_t*)arg;
+    for(;;) {
+        size_t i = __atomic_fetch_add(&count->next_task, 1, __ATOMIC_RELAXED);
+        if(i >= count->nr_tasks)
+            break;
+        count_range(count, &count->tasks[i]);
+    }
+    return NULL;
+}
+
+/** Counts the new lines of every task, the calling thread working along with the threads it starts. */
+static int run_count(parallel_count_t * count) {
+    pthread_t threads[MAX_NR_THREADS];
+    int nr_threads = 0;
+    int nr_wanted = scan_parallelism();
+    if((size_t)nr_wanted > count->nr_tasks)
+        nr_wanted = count->nr_tasks;
+    // a thread which can't be started is no error, its ranges are taken by the others
+    while(nr_threads < nr_wanted - 1 && pthread_create(&threads[nr_threads], NULL, count_worker, count) == 0)
+        nr_threads++;
+    count_worker(count);
+    for(int i = 0; i < nr_threads; i++)
+        pthread_join(threads[i], NULL);
+    return count->status;
+}
+
+/** Splits size bytes at offset in ranges of the given section, returning how many were added to tasks. */
+static size_t split_ranges(count_task_t * tasks, int section, off_t offset, size_t size) {
+    size_t nr_tasks = 0;
+    for(size_t done = 0; done < size; done += PARALLEL_SCAN_RANGE) {
+        tasks[nr_tasks].section = section;
+        tasks[nr_tasks].offset = offset + done;
+        tasks[nr_tasks].size = size - done < PARALLEL_SCAN_RANGE ? size - done : PARALLEL_SCAN_RANGE;
+        tasks[nr_tasks].nr_newlines = 0;
+        nr_tasks++;
+    }
+    return nr_tasks;
+}
+
+static size_t nr_ranges(size_t size) {
+    return size / PARALLEL_SCAN_RANGE + (size % PARALLEL_SCAN_RANGE != 0);
+}
+
+/** Size of the file, 0 if it can't be known. */
+static off_t file_size(int fd) {
+    struct stat inode;
+    stats_add(STATS_CALLS_STAT, 1);
+    return fstat(fd, &inode) == 0 ? inode.st_size : 0;
+}
+
+/**
+ * The part of the size bytes at offset which lies in a file of file_size bytes. The sizes come from the headers: a negative
+ * one (a huge size_t) or one running past the end of the file would otherwise split bytes which don't exist in ranges.
+ */
+static size_t size_in_file(off_t file_size, off_t offset, size_t size) {
+    if(offset < 0 || offset >= file_size)
+        return 0;
+    return size < (size_t)(file_size - offset) ? size : (size_t)(file_size - offset);
+}
+
+static int count_lines_sequential(int fd, off_t offset, size_t size, long max_lines, long * line_count);
+static int count_lines(int fd, off_t offset, size_t size, long max_lines, long * line_count);
+
+/** Turns the new lines of a section into its number of lines: the last line may end with the section instead of a new line. */
+static int close_count(int fd, off_t offset, size_t size, long max_lines, long nr_newlines, long * line_count) {
+    char last = '\n';
+    if((max_lines >= 0 && nr_newlines > max_lines) || size == 0) {
+        *line_count += nr_newlines;
+        return SUCCESS;
+    }
+    ssize_t nr_bytes = scan_read_fully(fd, &last, 1, offset + size - 1);
+    if(nr_bytes < 0)
+        return ERR_READING_FILE;
+    if(nr_bytes == 0) {
+        // the file ends inside the section, only a scan from the start knows its last character
+        return count_lines_sequential(fd, offset, size, max_lines, line_count);
+    }
+    *line_count += nr_newlines + (last != '\n' ? 1 : 0);
+    return SUCCESS;
+}
+
+static int compare_section_reads(const void * a, const void * b) {
+    const section_read_t * first = (const section_read_t*)a;
+    const section_read_t * second = (const section_read_t*)b;
+    if(first->offset != second->offset)
+        return first->offset < second->offset ? -1 : 1;
+    return first->section - second->section;
+}
+
+/** Collects the sections which have no line count yet, sorted by their offset. Returns how many there are. */
+static int sort_section_reads(const sect_header_t * sections, int nr_sections, const long * line_counts, section_read_t * reads) {
+    int nr_reads = 0;
+    for(int i = 0; i < nr_sections; i++) {
+        if(line_counts[i] < 0) {
+            reads[nr_reads].section = i;
+            reads[nr_reads].offset = sections[i].sect_offset;
+            reads[nr_reads].size = sections[i].sect_size;
+            nr_reads++;
+        }
+    }
+    qsort(reads, nr_reads, sizeof(section_read_t), compare_section_reads);
+    return nr_reads;
+}
+
+/** Counts the sections in parallel, each one only as far as sizes[i] (its part inside the file). */
+static int count_lines_parallel(int fd, const sect_header_t * sections, const size_t * sizes, int nr_sections, long max_lines, long * line_counts) {
+    long section_newlines[SF_MAX_NR_SECTIONS] = {0};
+    section_read_t reads[SF_MAX_NR_SECTIONS];
+    size_t nr_tasks = 0;
+    int nr_reads = sort_section_reads(sections, nr_sections, line_counts, reads);
+    for(int i = 0; i < nr_reads; i++) {
+        reads[i].size = sizes[reads[i].section];
+        nr_tasks += nr_ranges(reads[i].size);
+    }
+    count_task_t * tasks = (count_task_t*)malloc(nr_tasks * sizeof(count_task_t));
+    if(tasks == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    parallel_count_t count = {.fd = fd, .max_lines = max_lines, .tasks = tasks, .nr_tasks = 0, .next_task = 0,
+                              .section_newlines = section_newlines, .status = SUCCESS};
+    // the ranges are handed out in the order of the file, so the threads read close to each other
+    for(int i = 0; i < nr_reads; i++)
+        count.nr_tasks += split_ranges(tasks + count.nr_tasks, reads[i].section, reads[i].offset, reads[i].size);
+    int return_value = run_count(&count);
+    for(int i = 0; i < nr_sections && return_value == SUCCESS; i++) {
+        if(line_counts[i] < 0) {
+            long line_count = 0;
+            return_value = close_count(fd, sections[i].sect_offset, sizes[i], max_lines, section_newlines[i], &line_count);
+            line_counts[i] = line_count;
+        }
+    }
+    free(tasks);
+    return return_value;
+}
+
+/** Groups the sorted reads into runs, merging the small sections which fit in a chunk with their gaps. Returns the number of runs. */
+static int plan_read_runs(const section_read_t * reads, int nr_reads, read_run_t * runs) {
+    int nr_runs = 0;
+    for(int i = 0; i < nr_reads; nr_runs++) {
+        read_run_t * run = &runs[nr_runs];
+        run->offset = reads[i].offset;
+        run->size = reads[i].size;
+        run->first = i++;
+        run->streamed = run->size > SECTION_CHUNK_SIZE;
+        while(!run->streamed && i < nr_reads && reads[i].size <= SECTION_CHUNK_SIZE
+              && reads[i].offset <= run->offset + (off_t)run->size + SCAN_COALESCE_GAP) {
+            // sections may overlap, the run ends with the one ending last
+            off_t end = reads[i].offset + (off_t)reads[i].size;
+            size_t size = end > run->offset + (off_t)run->size ? (size_t)(end - run->offset) : run->size;
+            if(size > SECTION_CHUNK_SIZE)
+                break;
+            run->size = size;
+            i++;
+        }
+        run->last = i;
+    }
+    return nr_runs;
+}
+
+static int count_lines_coalesced(int fd, const sect_header_t * sections, int nr_sections, long max_lines, long * line_counts) {
+    section_read_t reads[SF_MAX_NR_SECTIONS];
+    read_run_t runs[SF_MAX_NR_SECTIONS];
+    int nr_reads = sort_section_reads(sections, nr_sections, line_counts, reads);
+    int nr_runs = plan_read_runs(reads, nr_reads, runs);
+
+    // the kernel can fetch the later runs while the first ones are counted; a capped count rarely needs more than a chunk
+    for(int i = 0; i < nr_runs && nr_runs > 1; i++) {
+        size_t advised = runs[i].streamed && max_lines >= 0 && runs[i].size > SECTION_CHUNK_SIZE ? SECTION_CHUNK_SIZE : runs[i].size;
+        posix_fadvise(fd, runs[i].offset, advised, POSIX_FADV_WILLNEED);
+    }
+    for(int i = 0; i < nr_runs; i++) {
+        if(runs[i].streamed) {
+            long line_count = 0;
+            int return_value = count_lines_sequential(fd, runs[i].offset, runs[i].size, max_lines, &line_count);
+            if(return_value != SUCCESS)
+                return return_value;
+            line_counts[reads[runs[i].first].section] = line_count;
+            continue;
+        }
+        ssize_t nr_bytes = scan_read_fully(fd, chunk, runs[i].size, runs[i].offset);
+        if(nr_bytes < 0)
+            return ERR_READING_FILE;
+        for(int j = runs[i].first; j < runs[i].last; j++) {
+            // a section cut by the end of the file only has the bytes which were read
+            size_t start = reads[j].offset - runs[i].offset;
+            size_t size = start >= (size_t)nr_bytes ? 0 : (size_t)nr_bytes - start < reads[j].size ? (size_t)nr_bytes - start : reads[j].size;
+            long nr_newlines = size > 0 ? count_newlines(chunk + start, size) : 0;
+            // the last line may end with the section instead of a new line
+            line_counts[reads[j].section] = nr_newlines + (size > 0 && chunk[start + size - 1] != '\n' ? 1 : 0);
+        }
+    }
+    return SUCCESS;
+}
+
+/**
+ * Looks for the range holding the nr_newlines-th new line, counting the ranges of a window in parallel.
+ * *range_offset is set to the start of that range and *newlines_before to the new lines found before it.
+ * Sets *reached to false if the section has fewer new lines.
+ */
+static int skip_lines_parallel(int fd, off_t offset, size_t size, long nr_newlines, off_t * range_offset, long * newlines_before, bool * reached) {
+    long section_newlines = 0;
+    long newlines = 0;
+    size_t done = 0;
+    // a window keeps every thread busy twice, so one slow range doesn't leave the others idle for long
+    size_t window = (size_t)scan_parallelism() * 2;
+    count_task_t tasks[MAX_NR_THREADS * 2];
+
+    *reached = false;
+    while(done < size) {
+        size_t window_size = size - done < window * PARALLEL_SCAN_RANGE ? size - done : window * PARALLEL_SCAN_RANGE;
+        parallel_count_t count = {.fd = fd, .max_lines = -1, .tasks = tasks, .nr_tasks = 0, .next_task = 0,
+                                  .section_newlines = &section_newlines, .status = SUCCESS};
+        count.nr_tasks = split_ranges(tasks, 0, offset + done, window_size);
+        int return_value = run_count(&count);
+        if(return_value != SUCCESS)
+            return return_value;
+        for(size_t i = 0; i < count.nr_tasks; i++) {
+            if(newlines + tasks[i].nr_newlines >= nr_newlines) {
+                *range_offset = tasks[i].offset;
+                *newlines_before = newlines;
+                *reached = true;
+                return SUCCESS;
+            }
+            newlines += tasks[i].nr_newlines;
+            // a range cut short by the end of the file ends the section
+            if(tasks[i].nr_newlines == 0 && scan_read_fully(fd, chunk, 1, tasks[i].offset + tasks[i].size - 1) == 0)
+                return SUCCESS;
+        }
+        done += window_size;
+    }
+    return SUCCESS;
+}
+
+ssize_t scan_read_fully(int fd, char * buf, size_t size, off_t offset) {
+    size_t done = 0;
+    while(done < size) {
+        ssize_t nr_bytes = pread(fd, buf + done, size - done, offset + done);
+        stats_add(STATS_CALLS_READ, 1);
+        if(nr_bytes < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        if(nr_bytes == 0)
+            break;
+        done += nr_bytes;
+    }
+    stats_add(STATS_BYTES_READ, done);
+    return done;
+}
+
+int scan_read_header(int fd, const sf_rules_t * rules, sf_file_header_t * sf_header, sf_invalid_field_t * failure_src) {
+    uint64_t start = stats_clock();
+    int nr_reads = 0;
+    ssize_t nr_bytes = 0;
+    int return_value = sf_read_header_counted(fd, rules, sf_header, failure_src, &nr_reads, &nr_bytes);
+    stats_add(STATS_CALLS_READ, nr_reads);
+    stats_add(STATS_BYTES_READ, nr_bytes);
+    stats_add_time(STATS_TIME_HEADER, start);
+    return return_value;
+}
+
+int scan_count_lines(int fd, off_t offset, size_t size, long max_lines, long * line_count) {
+    uint64_t start = stats_clock();
+    int return_value = count_lines(fd, offset, size, max_lines, line_count);
+    stats_add_time(STATS_TIME_SCAN, start);
+    return return_value;
+}
+
+static int count_lines(int fd, off_t offset, size_t size, long max_lines, long * line_count) {
+    // only the bytes really in the file are split in ranges
+    size_t parallel_size = size >= PARALLEL_SCAN_THRESHOLD && scan_parallelism() > 1 ? size_in_file(file_size(fd), offset, size) : 0;
+    if(parallel_size >= PARALLEL_SCAN_THRESHOLD) {
+        long nr_newlines = 0;
+        count_task_t * tasks = (count_task_t*)malloc(nr_ranges(parallel_size) * sizeof(count_task_t));
+        if(tasks != NULL) {
+            parallel_count_t count = {.fd = fd, .max_lines = max_lines, .tasks = tasks, .nr_tasks = 0, .next_task = 0,
+                                      .section_newlines = &nr_newlines, .status = SUCCESS};
+            count.nr_tasks = split_ranges(tasks, 0, offset, parallel_size);
+            int return_value = run_count(&count);
+            free(tasks);
+            if(return_value != SUCCESS)
+                return return_value;
+            return close_count(fd, offset, parallel_size, max_lines, nr_newlines, line_count);
+        }
+    }
+    return count_lines_sequential(fd, offset, size, max_lines, line_count);
+}
+
+static int count_lines_sequential(int fd, off_t offset, size_t size, long max_lines, long * line_count) {
+    long nr_newlines = 0;
+    char last = '\n';
+    size_t done = 0;
+
+    while(done < size) {
+        size_t chunk_size = size - done < SECTION_CHUNK_SIZE ? size - done : SECTION_CHUNK_SIZE;
+        ssize_t nr_bytes = scan_read_fully(fd, chunk, chunk_size, offset + done);
+        if(nr_bytes < 0)
+            return ERR_READING_FILE;
+        if(nr_bytes == 0)
+            break;
+        nr_newlines += count_newlines(chunk, nr_bytes);
+        last = chunk[nr_bytes-1];
+        done += nr_bytes;
+        // every new line closes a line, so the answer is known once there are more than max_lines of them
+        if(max_lines >= 0 && nr_newlines > max_lines) {
+            *line_count += nr_newlines;
+            return SUCCESS;
+        }
+        if((size_t)nr_bytes < chunk_size)
+            break;
+    }
+    // the last line may end with the section instead of a new line
+    *line_count += nr_newlines + (last != '\n' ? 1 : 0);
+    return SUCCESS;
+}
+
+static int find_line_sequential(int fd, off_t offset, size_t size, long line_nr, off_t * line_start, size_t * line_length, bool * found);
+static int find_line(int fd, off_t offset, size_t size, long line_nr, off_t * line_start, size_t * line_length, bool * found);
+
+int scan_find_line(int fd, off_t offset, size_t size, long line_nr, off_t * line_start, size_t * line_length, bool * found) {
+    uint64_t start = stats_clock();
+    int return_value = find_line(fd, offset, size, line_nr, line_start, line_length, found);
+    stats_add_time(STATS_TIME_SCAN, start);
+    return return_value;
+}
+
+static int find_line(int fd, off_t offset, size_t size, long line_nr, off_t * line_start, size_t * line_length, bool * found) {
+    // only the bytes really in the file are split in ranges
+    size_t parallel_size = line_nr > 1 && size >= PARALLEL_SCAN_THRESHOLD && scan_parallelism() > 1 ? size_in_file(file_size(fd), offset, size) : 0;
+    if(parallel_size >= PARALLEL_SCAN_THRESHOLD) {
+        off_t range_offset;
+        long newlines_before;
+        bool reached;
+        *found = false;
+        int return_value = skip_lines_parallel(fd, offset, parallel_size, line_nr - 1, &range_offset, &newlines_before, &reached);
+        if(return_value != SUCCESS || !reached)
+            return return_value;
+        // the line starts in that range: it is line (line_nr - newlines_before) counting from the start of the range
+        return find_line_sequential(fd, range_offset, offset + parallel_size - range_offset, line_nr - newlines_before, line_start, line_length, found);
+    }
+    return find_line_sequential(fd, offset, size, line_nr, line_start, line_length, found);
+}
+
+static int find_line_sequential(int fd, off_t offset, size_t size, long line_nr, off_t * line_start, size_t * line_length, bool * found) {
+    long nr_newlines = 0;
+    size_t done = 0;
+    bool started = line_nr == 1;
+
+    *found = false;
+    if(line_nr < 1)
+        return SUCCESS;
+    *line_start = offset;
+    while(done < size) {
+        size_t chunk_size = size - done < SECTION_CHUNK_SIZE ? size - done : SECTION_CHUNK_SIZE;
+        ssize_t nr_bytes = scan_read_fully(fd, chunk, chunk_size, offset + done);
+        if(nr_bytes < 0)
+            return ERR_READING_FILE;
+        if(nr_bytes == 0)
+            break;
+        const char * pos = chunk;
+        size_t left = nr_bytes;
+        if(!started) {
+            // look for the new line ending the previous line
+            size_t nr_found = 0;
+            const char * prev_end = find_nth_newline(pos, left, line_nr - 1 - nr_newlines, &nr_found);
+            if(prev_end == NULL) {
+                nr_newlines += nr_found;
+                done += nr_bytes;
+                if((size_t)nr_bytes < chunk_size)
+                    break;
+                continue;
+            }
+            started = true;
+            *line_start = offset + done + (prev_end - chunk) + 1;
+            left -= prev_end + 1 - pos;
+            pos = prev_end + 1;
+        }
+        // look for the new line ending the requested line
+        const char * end = find_nth_newline(pos, left, 1, NULL);
+        if(end != NULL) {
+            *line_length = offset + done + (end - chunk) - *line_start;
+            *found = true;
+            return SUCCESS;
+        }
+        done += nr_bytes;
+        if((size_t)nr_bytes < chunk_size)
+            break;
+    }
+    // the line ends with the section, unless it would be empty
+    if(started && (off_t)(offset + done) > *line_start) {
+        *line_length = offset + done - *line_start;
+        *found = true;
+    }
+    return SUCCESS;
+}
+
+static int find_lines(int fd, off_t offset, size_t size, const long * line_nrs, size_t nr_lines,
+                      off_t * line_starts, size_t * line_lengths, bool * found);
+
+int scan_find_lines(int fd, off_t offset, size_t size, const long * line_nrs, size_t nr_lines,
+                    off_t * line_starts, size_t * line_lengths, bool * found) {
+    uint64_t start = stats_clock();
+    int return_value = find_lines(fd, offset, size, line_nrs, nr_lines, line_starts, line_lengths, found);
+    stats_add_time(STATS_TIME_SCAN, start);
+    return return_value;
+}
+
+static int find_lines(int fd, off_t offset, size_t size, const long * line_nrs, size_t nr_lines,
+                      off_t * line_starts, size_t * line_lengths, bool * found) {
+    long nr_newlines = 0;
+    size_t done = 0;
+    size_t k = 0;
+    bool started = false;
+
+    for(size_t i = 0; i < nr_lines; i++)
+        found[i] = false;
+    // lines before the first one don't exist
+    while(k < nr_lines && line_nrs[k] < 1)
+        k++;
+    while(done < size && k < nr_lines) {
+        size_t chunk_size = size - done < SECTION_CHUNK_SIZE ? size - done : SECTION_CHUNK_SIZE;
+        ssize_t nr_bytes = scan_read_fully(fd, chunk, chunk_size, offset + done);
+        if(nr_bytes < 0)
+            return ERR_READING_FILE;
+        if(nr_bytes == 0)
+            break;
+        const char * pos = chunk;
+        const char * chunk_end = chunk + nr_bytes;
+        while(k < nr_lines) {
+            if(!started) {
+                // look for the new line ending the previous line, unless it was already passed
+                if(line_nrs[k] - 1 > nr_newlines) {
+                    size_t nr_found = 0;
+                    const char * prev_end = find_nth_newline(pos, chunk_end - pos, line_nrs[k] - 1 - nr_newlines, &nr_found);
+                    if(prev_end == NULL) {
+                        nr_newlines += nr_found;
+                        pos = chunk_end;
+                        break;
+                    }
+                    nr_newlines = line_nrs[k] - 1;
+                    pos = prev_end + 1;
+                }
+                started = true;
+                line_starts[k] = offset + done + (pos - chunk);
+            }
+            // look for the new line ending the requested line
+            const char * end = find_nth_newline(pos, chunk_end - pos, 1, NULL);
+            if(end == NULL) {
+                pos = chunk_end;
+                break;
+            }
+            line_lengths[k] = offset + done + (end - chunk) - line_starts[k];
+            found[k] = true;
+            nr_newlines++;
+            pos = end + 1;
+            started = false;
+            // the same line may be asked for several times
+            for(k++; k < nr_lines && line_nrs[k] == line_nrs[k-1]; k++) {
+                line_starts[k] = line_starts[k-1];
+                line_lengths[k] = line_lengths[k-1];
+                found[k] = true;
+            }
+        }
+        done += nr_bytes;
+        if((size_t)nr_bytes < chunk_size)
+            break;
+    }
+    // the last line ends with the section, unless it would be empty
+    if(k < nr_lines && started && (off_t)(offset + done) > line_starts[k]) {
+        line_lengths[k] = offset + done - line_starts[k];
+        found[k] = true;
+        for(k++; k < nr_lines && line_nrs[k] == line_nrs[k-1]; k++) {
+            line_starts[k] = line_starts[k-1];
+            line_lengths[k] = line_lengths[k-1];
+            found[k] = true;
+        }
+    }
+    return SUCCESS;
+}
+
+static int count_sections(int fd, const sect_header_t * sections, int nr_sections, long max_lines, long * line_counts);
+
+int scan_count_sections(int fd, const sect_header_t * sections, int nr_sections, long max_lines, long * line_counts) {
+    uint64_t start = stats_clock();
+    int return_value = count_sections(fd, sections, nr_sections, max_lines, line_counts);
+    stats_add_time(STATS_TIME_SCAN, start);
+    return return_value;
+}
+
+static int count_sections(int fd, const sect_header_t * sections, int nr_sections, long max_lines, long * line_counts) {
+    size_t sizes[SF_MAX_NR_SECTIONS];
+    size_t total_size = 0;
+    bool negative = false;
+    for(int i = 0; i < nr_sections; i++) {
+        if(line_counts[i] < 0 && sections[i].sect_size < 0)
+            negative = true;
+        else if(line_counts[i] < 0)
+            total_size += sections[i].sect_size;
+    }
+    if((total_size >= PARALLEL_SCAN_THRESHOLD || negative) && scan_parallelism() > 1) {
+        // the sizes of the header are only trusted as far as the end of the file, the ranges cover the bytes really there
+        off_t size = file_size(fd);
+        total_size = 0;
+        for(int i = 0; i < nr_sections; i++) {
+            sizes[i] = line_counts[i] < 0 ? size_in_file(size, sections[i].sect_offset, (size_t)sections[i].sect_size) : 0;
+            total_size += sizes[i];
+        }
+        if(total_size >= PARALLEL_SCAN_THRESHOLD) {
+            int return_value = count_lines_parallel(fd, sections, sizes, nr_sections, max_lines, line_counts);
+            if(return_value != ERR_ALLOCATING_MEMORY)
+                return return_value;
+        }
+    }
+    return count_lines_coalesced(fd, sections, nr_sections, max_lines, line_counts);
+}
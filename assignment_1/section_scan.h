@@ -0,0 +1,55 @@
+#ifndef __SECTION_SCAN_H__
+#define __SECTION_SCAN_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "../common/sf_format.h"
+
+/** Size of the reusable buffer each thread streams the sections through. */
+#define SECTION_CHUNK_SIZE (64 * 1024)
+/** Below this many bytes a scan stays on the calling thread, starting threads would cost more than they save. */
+#define PARALLEL_SCAN_THRESHOLD (16 * 1024 * 1024)
+/** Size of the ranges a large scan is split into, each one read by a single thread (a multiple of SECTION_CHUNK_SIZE). */
+#define PARALLEL_SCAN_RANGE (2 * 1024 * 1024)
+/** Small sections at most this far apart are fetched with the same read, the bytes between them being skipped. */
+#define SCAN_COALESCE_GAP (4 * 1024)
+
+/**
+ * Counts the lines of the size bytes found at offset, reading them chunk by chunk.
+ * If max_lines >= 0 the scan stops as soon as the section is known to have more than max_lines lines,
+ * in which case *line_count is only a lower bound (but still greater than max_lines).
+ * Sections of at least PARALLEL_SCAN_THRESHOLD bytes are split in ranges whose new lines are counted in parallel.
+ * Only the bytes which are really in the file count for that: a size running past its end (or a negative one,
+ * converted from a header) is cut at the end of the file first.
+ */
+int scan_count_lines(int fd, off_t offset, size_t size, long max_lines, long * line_count);
+/**
+ * Finds the line_nr-th line (counting from 1) of the size bytes found at offset, without the new line.
+ * The scan stops at the end of that line. Sets *found to false if the section has fewer lines.
+ * In a section of at least PARALLEL_SCAN_THRESHOLD bytes the lines before it are counted in parallel, a window of ranges at a time.
+ */
+int scan_find_line(int fd, off_t offset, size_t size, long line_nr, off_t * line_start, size_t * line_length, bool * found);
+/**
+ * Finds several lines of the same section in a single pass, line_nrs being sorted in ascending order.
+ * For every i, found[i] tells whether line_nrs[i] exists and, if so, where it starts and how long it is.
+ */
+int scan_find_lines(int fd, off_t offset, size_t size, const long * line_nrs, size_t nr_lines,
+                    off_t * line_starts, size_t * line_lengths, bool * found);
+/**
+ * Counts the lines of every section i whose line_counts[i] is negative, with the same max_lines meaning as scan_count_lines.
+ * If those sections hold PARALLEL_SCAN_THRESHOLD bytes or more together inside the file, the ranges of all of them are counted concurrently,
+ * otherwise they are counted on the calling thread in the order of their offsets: the sections smaller than SECTION_CHUNK_SIZE
+ * are merged with their neighbours into single reads, the larger ones are streamed, and the kernel is told about every read
+ * (posix_fadvise WILLNEED) before the first one is issued.
+ */
+int scan_count_sections(int fd, const sect_header_t * sections, int nr_sections, long max_lines, long * line_counts);
+/** Returns the number of threads a parallel scan uses: the number of online processors, at most MAX_NR_THREADS. */
+int scan_parallelism(void);
+/** Reads and decodes the header of an sf file like sf_read_header, accounting the read in the run stats. */
+int scan_read_header(int fd, const sf_rules_t * rules, sf_file_header_t * sf_header, sf_invalid_field_t * failure_src);
+/** Reads exactly size bytes at offset (less only if the file ends first). Returns the number of bytes read or -1. */
+ssize_t scan_read_fully(int fd, char * buf, size_t size, off_t offset);
+
+#endif
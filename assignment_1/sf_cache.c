@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#include "a1.h"
+#include "sf_cache.h"
+#include "run_stats.h"
+
+#define SF_CACHE_MAGIC "SFC1"
+#define SF_CACHE_INITIAL_CAPACITY 1024
+#define SF_CACHE_ENTRY_EMPTY 0u
+#define SF_CACHE_ENTRY_USED 1u
+
+typedef struct sf_cache_file_header{
+    char magic[4];
+    /** size of an entry, so a cache written by a different build is recreated instead of misread */
+    uint32_t entry_size;
+    /** number of slots, always a power of 2 */
+    uint64_t capacity;
+    uint64_t nr_entries;
+}sf_cache_file_header_t;
+
+typedef struct sf_cache_entry{
+    uint32_t state;
+    uint32_t padding;
+    sf_cache_key_t key;
+    sf_cache_record_t record;
+}sf_cache_entry_t;
+
+struct sf_cache{
+    char * path;
+    const sf_rules_t * rules;
+    int fd;
+    size_t mapping_size;
+    sf_cache_file_header_t * header;
+    sf_cache_entry_t * entries;
+    /** the walker threads share the cache */
+    pthread_mutex_t lock;
+};
+
+static size_t mapping_size_for(uint64_t capacity) {
+    return sizeof(sf_cache_file_header_t) + capacity * sizeof(sf_cache_entry_t);
+}
+
+static uint64_t hash_key(const sf_cache_key_t * key) {
+    // only the identity of the file is hashed, so a changed file lands on its old slot and replaces it
+    uint64_t h = key->ino * 0x9E3779B97F4A7C15ull ^ (key->dev + 0x632BE59BD9B4E019ull);
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ull;
+    return h ^ (h >> 29);
+}
+
+/** Maps a file of the given capacity, initializing it if it is new. */
+static int map_cache_file(sf_cache_t * cache, int fd, uint64_t capacity, bool init) {
+    size_t size = mapping_size_for(capacity);
+    if(init && ftruncate(fd, size) != 0)
+        return ERR_READING_FILE;
+    void * data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(data == MAP_FAILED)
+        return ERR_ALLOCATING_MEMORY;
+    cache->fd = fd;
+    cache->mapping_size = size;
+    cache->header = (sf_cache_file_header_t*)data;
+    cache->entries = (sf_cache_entry_t*)((char*)data + sizeof(sf_cache_file_header_t));
+    if(init) {
+        memcpy(cache->header->magic, SF_CACHE_MAGIC, 4);
+        cache->header->entry_size = sizeof(sf_cache_entry_t);
+        cache->header->capacity = capacity;
+        cache->header->nr_entries = 0;
+    }
+    return SUCCESS;
+}
+
+int sf_cache_open(sf_cache_t ** cache, const char * path, const sf_rules_t * rules) {
+    int return_value = SUCCESS;
+    sf_cache_file_header_t file_header;
+    bool init = true;
+
+    *cache = (sf_cache_t*)calloc(1, sizeof(sf_cache_t));
+    if(*cache == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    (*cache)->path = strdup(path);
+    (*cache)->rules = rules;
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0 || (*cache)->path == NULL) {
+        return_value = ERR_INVALID_PATH;
+        goto clean_up;
+    }
+    if(flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        return_value = ERR_INVALID_PATH;
+        goto clean_up;
+    }
+    // reuse the existing content if it was written by this build, start over otherwise
+    uint64_t capacity = SF_CACHE_INITIAL_CAPACITY;
+    off_t file_size = lseek(fd, 0, SEEK_END);
+    if(pread(fd, &file_header, sizeof(file_header), 0) == sizeof(file_header)
+       && memcmp(file_header.magic, SF_CACHE_MAGIC, 4) == 0
+       && file_header.entry_size == sizeof(sf_cache_entry_t)
+       && file_header.capacity > 0 && (file_header.capacity & (file_header.capacity - 1)) == 0
+       && file_size == (off_t)mapping_size_for(file_header.capacity)) {
+        capacity = file_header.capacity;
+        init = false;
+    }
+    return_value = map_cache_file(*cache, fd, capacity, init);
+    if(return_value != SUCCESS)
+        goto clean_up;
+    pthread_mutex_init(&(*cache)->lock, NULL);
+    return SUCCESS;
+
+    clean_up:
+    if(fd >= 0)
+        close(fd);
+    free((*cache)->path);
+    free(*cache);
+    *cache = NULL;
+    return return_value;
+}
+
+void sf_cache_close(sf_cache_t * cache) {
+    if(cache == NULL)
+        return;
+    munmap(cache->header, cache->mapping_size);
+    close(cache->fd);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->path);
+    free(cache);
+}
+
+void sf_cache_key_from_stat(const struct stat * inode, sf_cache_key_t * key) {
+    memset(key, 0, sizeof(sf_cache_key_t));
+    key->dev = inode->st_dev;
+    key->ino = inode->st_ino;
+    key->size = inode->st_size;
+    key->mtime_sec = inode->st_mtim.tv_sec;
+    key->mtime_nsec = inode->st_mtim.tv_nsec;
+}
+
+void sf_cache_clear_line_counts(sf_cache_record_t * record) {
+    for(int i=0;i<SF_MAX_NR_SECTIONS;i++)
+        record->line_counts[i] = -1;
+    record->capped_counts = 0;
+}
+
+/**
+ * Returns the slot holding the file, or the empty slot where it would go. Returns NULL if there is neither,
+ * which only a damaged file (no empty slot left) can cause: the probe never goes round the table more than once.
+ */
+static sf_cache_entry_t * find_slot(sf_cache_t * cache, const sf_cache_key_t * key) {
+    uint64_t mask = cache->header->capacity - 1;
+    uint64_t i = hash_key(key) & mask;
+    for(uint64_t nr_probes = 0; nr_probes < cache->header->capacity; nr_probes++, i = (i + 1) & mask) {
+        sf_cache_entry_t * entry = &cache->entries[i];
+        if(entry->state == SF_CACHE_ENTRY_EMPTY || (entry->key.dev == key->dev && entry->key.ino == key->ino))
+            return entry;
+    }
+    return NULL;
+}
+
+/** Tells if the record is one this build could have stored: its header decodes to the status and failure it holds. */
+static bool is_consistent(const sf_cache_t * cache, const sf_cache_record_t * record) {
+    sf_file_header_t decoded;
+    sf_invalid_field_t failure_src;
+    if(record->parse_status != SUCCESS && record->parse_status != ERR_INVALID_FILE_FORMAT)
+        return false;
+    int status = sf_decode_header((const char*)&record->sf_header, sizeof(sf_file_header_t), cache->rules, &decoded, &failure_src);
+    return (status == SF_SUCCESS) == (record->parse_status == SUCCESS) && (int32_t)failure_src == record->failure_src;
+}
+
+bool sf_cache_lookup(sf_cache_t * cache, const sf_cache_key_t * key, sf_cache_record_t * record) {
+    bool found = false;
+    pthread_mutex_lock(&cache->lock);
+    sf_cache_entry_t * entry = find_slot(cache, key);
+    if(entry != NULL && entry->state == SF_CACHE_ENTRY_USED && memcmp(&entry->key, key, sizeof(sf_cache_key_t)) == 0
+       && is_consistent(cache, &entry->record)) {
+        memcpy(record, &entry->record, sizeof(sf_cache_record_t));
+        found = true;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    stats_add(found ? STATS_CACHE_HITS : STATS_CACHE_MISSES, 1);
+    return found;
+}
+
+/** Moves the entries into a file twice as large, which then replaces the old one. */
+static int grow_cache(sf_cache_t * cache) {
+    char tmp_path[MAX_PATH_SIZE + 8];
+    sf_cache_t grown;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache->path);
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+        return ERR_INVALID_PATH;
+    flock(fd, LOCK_EX | LOCK_NB);
+    int return_value = map_cache_file(&grown, fd, cache->header->capacity * 2, true);
+    if(return_value != SUCCESS) {
+        close(fd);
+        unlink(tmp_path);
+        return return_value;
+    }
+    // the new table is twice as large as the old one, it always has a slot left
+    for(uint64_t i=0;i<cache->header->capacity;i++) {
+        if(cache->entries[i].state == SF_CACHE_ENTRY_USED) {
+            sf_cache_entry_t * entry = find_slot(&grown, &cache->entries[i].key);
+            if(entry->state == SF_CACHE_ENTRY_EMPTY)
+                grown.header->nr_entries++;
+            *entry = cache->entries[i];
+        }
+    }
+    if(rename(tmp_path, cache->path) != 0) {
+        munmap(grown.header, grown.mapping_size);
+        close(fd);
+        unlink(tmp_path);
+        return ERR_INVALID_PATH;
+    }
+    munmap(cache->header, cache->mapping_size);
+    close(cache->fd);
+    cache->fd = grown.fd;
+    cache->mapping_size = grown.mapping_size;
+    cache->header = grown.header;
+    cache->entries = grown.entries;
+    return SUCCESS;
+}
+
+int sf_cache_store(sf_cache_t * cache, const sf_cache_key_t * key, const sf_cache_record_t * record) {
+    int return_value = SUCCESS;
+    pthread_mutex_lock(&cache->lock);
+    // keep the table at most 3/4 full, so the probe sequences stay short
+    if((cache->header->nr_entries + 1) * 4 > cache->header->capacity * 3) {
+        return_value = grow_cache(cache);
+        if(return_value != SUCCESS)
+            goto finish;
+    }
+    sf_cache_entry_t * entry = find_slot(cache, key);
+    if(entry == NULL) {
+        // a damaged file counting fewer entries than it has: a larger table has room again
+        return_value = grow_cache(cache);
+        if(return_value != SUCCESS)
+            goto finish;
+        entry = find_slot(cache, key);
+    }
+    if(entry->state == SF_CACHE_ENTRY_EMPTY)
+        cache->header->nr_entries++;
+    entry->state = SF_CACHE_ENTRY_USED;
+    entry->key = *key;
+    entry->record = *record;
+    finish:
+    pthread_mutex_unlock(&cache->lock);
+    return return_value;
+}
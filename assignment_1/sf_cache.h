@@ -0,0 +1,51 @@
+#ifndef __SF_CACHE_H__
+#define __SF_CACHE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "../common/sf_format.h"
+
+/** Identifies one version of a file: a record is only reused while none of these change. */
+typedef struct sf_cache_key{
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+}sf_cache_key_t;
+
+/** What is remembered about a file. */
+typedef struct sf_cache_record{
+    /** SUCCESS or ERR_INVALID_FILE_FORMAT */
+    int32_t parse_status;
+    int32_t failure_src;
+    sf_file_header_t sf_header;
+    /** number of lines of each section, -1 if it was never counted */
+    int32_t line_counts[SF_MAX_NR_SECTIONS];
+    /** bit i is set if the count of section i stopped early and is only a lower bound */
+    uint32_t capped_counts;
+}sf_cache_record_t;
+
+typedef struct sf_cache sf_cache_t;
+
+/**
+ * Opens (or creates) the cache file and maps it in memory. The file is locked for the lifetime of the cache;
+ * if another process holds it, ERR_INVALID_PATH is returned and the caller works without a cache.
+ * The records are checked against the rules when they are looked up, since the file may have been damaged or edited.
+ */
+int sf_cache_open(sf_cache_t ** cache, const char * path, const sf_rules_t * rules);
+void sf_cache_close(sf_cache_t * cache);
+void sf_cache_key_from_stat(const struct stat * inode, sf_cache_key_t * key);
+/**
+ * Copies the record of the file into *record. Returns false if the file is unknown or changed since it was stored,
+ * or if decoding the cached header with the rules doesn't give the status the record holds.
+ */
+bool sf_cache_lookup(sf_cache_t * cache, const sf_cache_key_t * key, sf_cache_record_t * record);
+/** Adds or replaces the record of the file. */
+int sf_cache_store(sf_cache_t * cache, const sf_cache_key_t * key, const sf_cache_record_t * record);
+/** Resets the line counts of a record which doesn't have them yet. */
+void sf_cache_clear_line_counts(sf_cache_record_t * record);
+
+#endif
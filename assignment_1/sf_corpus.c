@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "a1.h"
+#include "../common/sf_format.h"
+
+// limits of a valid sf header, the same as the ones a1 checks
+#define MIN_VERSION 47
+#define MAX_VERSION 128
+#define MIN_NR_SECTIONS 3
+#define MAX_NR_SECTIONS 17
+// number of lines of the section which makes a file match findall
+#define FINDALL_NR_LINES 16
+// the deepest tree whose paths still fit in MAX_PATH_SIZE
+#define MAX_DEPTH 32
+
+static const int sect_types[] = {19, 10, 58, 57, 11, 53};
+static const char * extensions[] = {".sf", "", ".txt", ".dat"};
+
+/** The shape of the corpus, every option has a default so only the path is required. */
+typedef struct corpus_params{
+    char path[MAX_PATH_SIZE+1];
+    long nr_files;
+    int depth;
+    int fanout;
+    int nr_sections;
+    long section_size;
+    int line_length;
+    double match;
+    double invalid;
+    uint64_t seed;
+}corpus_params_t;
+
+/** What was written, printed at the end. */
+typedef struct corpus_totals{
+    long nr_files;
+    long nr_matching;
+    long nr_invalid;
+    long nr_dirs;
+    unsigned long long nr_bytes;
+}corpus_totals_t;
+
+/** splitmix64: the same seed always gives the same corpus, whatever the platform. */
+static uint64_t next_random(uint64_t * state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/** A number in [0, bound). */
+static long random_below(uint64_t * state, long bound) {
+    return bound <= 0 ? 0 : (long)(next_random(state) % (uint64_t)bound);
+}
+
+/** A number in [0, 1). */
+static double random_fraction(uint64_t * state) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/** Appends a line of printable characters, about line_length long (between half of it and one and a half of it). */
+static void append_line(uint64_t * state, char * buf, size_t * size, int line_length) {
+    long length = line_length / 2 + random_below(state, line_length + 1);
+    if(length < 1)
+        length = 1;
+    for(long i = 0; i < length; i++)
+        buf[(*size)++] = 'a' + random_below(state, 26);
+}
+
+/**
+ * Appends the content of a section with exactly nr_lines lines, or, if nr_lines is negative, with as many lines as
+ * it takes to fill about size bytes, never FINDALL_NR_LINES of them. The last line has no new line after it.
+ */
+static void append_section(uint64_t * state, char * buf, size_t * size, long nr_lines, long section_size, int line_length) {
+    size_t start = *size;
+    if(nr_lines < 0) {
+        nr_lines = section_size / (line_length + 1);
+        if(nr_lines < 1)
+            nr_lines = 1;
+        if(nr_lines == FINDALL_NR_LINES)
+            nr_lines++;
+    }
+    for(long i = 0; i < nr_lines; i++) {
+        if(*size > start)
+            buf[(*size)++] = '\n';
+        append_line(state, buf, size, line_length);
+    }
+}
+
+/** Largest section append_section can produce when asked for at most section_size bytes. */
+static size_t max_section_size(long section_size, int line_length) {
+    long nr_lines = section_size / (line_length + 1);
+    if(nr_lines <= FINDALL_NR_LINES)
+        nr_lines = FINDALL_NR_LINES + 1;
+    return nr_lines * (line_length / 2 + line_length + 2);
+}
+
+/** Creates the directories of a random path of the tree, at most depth levels below the root, and writes it in dir_path. */
+static int make_dir_path(uint64_t * state, const corpus_params_t * params, char * dir_path, corpus_totals_t * totals) {
+    int levels = random_below(state, params->depth + 1);
+    strcpy(dir_path, params->path);
+    for(int i = 0; i < levels; i++) {
+        size_t length = strlen(dir_path);
+        if(snprintf(dir_path + length, MAX_PATH_SIZE + 1 - length, "/d%ld", random_below(state, params->fanout)) >= (int)(MAX_PATH_SIZE + 1 - length))
+            return ERR_INVALID_PATH;
+        if(mkdir(dir_path, 0755) == 0)
+            totals->nr_dirs++;
+        else if(errno != EEXIST)
+            return ERR_INVALID_PATH;
+    }
+    return SUCCESS;
+}
+
+/**
+ * Generates the file_nr-th file in buf: a valid sf file with a section of FINDALL_NR_LINES lines, a valid one without such
+ * a section, or a file with a single wrong header field. Returns its size.
+ */
+static size_t make_file(uint64_t * state, const corpus_params_t * params, long file_nr, char * buf, corpus_totals_t * totals) {
+    sf_header_t header;
+    sect_header_t sections[MAX_NR_SECTIONS];
+    int nr_sections = params->nr_sections;
+    size_t header_size = SF_HEADER_SIZE(nr_sections);
+    size_t size = header_size;
+
+    double kind = random_fraction(state);
+    bool matching = kind < params->match;
+    bool invalid = !matching && kind < params->match + params->invalid;
+    long matching_section = matching ? random_below(state, nr_sections) : -1;
+
+    for(int i = 0; i < nr_sections; i++) {
+        memset(&sections[i], 0, sizeof(sect_header_t));
+        snprintf(sections[i].sect_name, sizeof(sections[i].sect_name), "s%ld_%d", file_nr, i);
+        sections[i].sect_type = sect_types[random_below(state, sizeof(sect_types) / sizeof(sect_types[0]))];
+        // the sizes vary around the requested one, so the files are not all alike
+        long section_size = params->section_size / 2 + random_below(state, params->section_size + 1);
+        sections[i].sect_offset = size;
+        append_section(state, buf, &size, i == matching_section ? FINDALL_NR_LINES : -1, section_size, params->line_length);
+        sections[i].sect_size = size - sections[i].sect_offset;
+    }
+
+    memcpy(header.magic, SF_MAGIC, SF_MAGIC_SIZE);
+    header.header_size = header_size;
+    header.version = MIN_VERSION + random_below(state, MAX_VERSION - MIN_VERSION + 1);
+    header.no_of_sections = nr_sections;
+    if(invalid) {
+        switch(random_below(state, 4)) {
+            case 0:
+                header.magic[0] = 'X';
+                break;
+            case 1:
+                header.version = MAX_VERSION + 1 + random_below(state, 100);
+                break;
+            case 2:
+                header.no_of_sections = MAX_NR_SECTIONS + 1;
+                break;
+            default:
+                sections[random_below(state, nr_sections)].sect_type = 1;
+                break;
+        }
+        totals->nr_invalid++;
+    }
+    if(matching)
+        totals->nr_matching++;
+    memcpy(buf, &header, sizeof(sf_header_t));
+    memcpy(buf + sizeof(sf_header_t), sections, nr_sections * sizeof(sect_header_t));
+    return size;
+}
+
+/** Writes all of size bytes, retrying short writes. */
+static int write_fully(int fd, const char * buf, size_t size) {
+    while(size > 0) {
+        ssize_t nr_bytes = write(fd, buf, size);
+        if(nr_bytes < 0 && errno == EINTR)
+            continue;
+        if(nr_bytes <= 0)
+            return ERR_WRITING_OUTPUT;
+        buf += nr_bytes;
+        size -= nr_bytes;
+    }
+    return SUCCESS;
+}
+
+static int generate(const corpus_params_t * params, corpus_totals_t * totals) {
+    int return_value = SUCCESS;
+    uint64_t state = params->seed;
+    char dir_path[MAX_PATH_SIZE+1];
+    char file_path[MAX_PATH_SIZE+1];
+    size_t buf_size = SF_HEADER_SIZE(params->nr_sections) + params->nr_sections * max_section_size(params->section_size + params->section_size / 2, params->line_length);
+    char * buf = (char*)malloc(buf_size);
+    if(buf == NULL)
+        return ERR_ALLOCATING_MEMORY;
+
+    if(mkdir(params->path, 0755) != 0 && errno != EEXIST) {
+        return_value = ERR_INVALID_PATH;
+        goto clean_up;
+    }
+    for(long i = 0; i < params->nr_files; i++) {
+        return_value = make_dir_path(&state, params, dir_path, totals);
+        if(return_value != SUCCESS)
+            goto clean_up;
+        size_t size = make_file(&state, params, i, buf, totals);
+        const char * extension = extensions[random_below(&state, sizeof(extensions) / sizeof(extensions[0]))];
+        if(snprintf(file_path, sizeof(file_path), "%s/f%ld%s", dir_path, i, extension) >= (int)sizeof(file_path)) {
+            return_value = ERR_INVALID_PATH;
+            goto clean_up;
+        }
+        int fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            return_value = ERR_INVALID_PATH;
+            goto clean_up;
+        }
+        return_value = write_fully(fd, buf, size);
+        close(fd);
+        if(return_value != SUCCESS)
+            goto clean_up;
+        totals->nr_files++;
+        totals->nr_bytes += size;
+    }
+
+    clean_up:
+    free(buf);
+    return return_value;
+}
+
+int main(int argc, char **argv){
+    int return_value = SUCCESS;
+    corpus_params_t params = {.nr_files = 1000,.depth = 3,.fanout = 4,.nr_sections = 8,.section_size = 4096,.line_length = 64,
+                              .match = 0.25,.invalid = 0.1,.seed = 1};
+    corpus_totals_t totals = {0};
+    bool path = false;
+
+    for(int i=1;i<argc;i++) {
+        char * option = argv[i];
+        char * value = strchr(option,'=');
+        if(value == NULL) {
+            return_value = ERR_INVALID_ARGUMENTS;
+            continue;
+        }
+        *value++ = '\0';
+        if(strcmp(option,"path") == 0) {
+            if(strlen(value) > MAX_PATH_SIZE / 2) {
+                return_value = ERR_INVALID_PATH;
+                goto display_error_messages;
+            }
+            strcpy(params.path,value);
+            path = true;
+        }else if(strcmp(option,"files") == 0) {
+            params.nr_files = strtol(value,NULL,10);
+        }else if(strcmp(option,"depth") == 0) {
+            params.depth = strtol(value,NULL,10);
+        }else if(strcmp(option,"fanout") == 0) {
+            params.fanout = strtol(value,NULL,10);
+        }else if(strcmp(option,"sections") == 0) {
+            params.nr_sections = strtol(value,NULL,10);
+        }else if(strcmp(option,"section_size") == 0) {
+            params.section_size = strtol(value,NULL,10);
+        }else if(strcmp(option,"line_length") == 0) {
+            params.line_length = strtol(value,NULL,10);
+        }else if(strcmp(option,"match") == 0) {
+            params.match = strtod(value,NULL);
+        }else if(strcmp(option,"invalid") == 0) {
+            params.invalid = strtod(value,NULL);
+        }else if(strcmp(option,"seed") == 0) {
+            params.seed = strtoull(value,NULL,10);
+        }else {
+            return_value = ERR_INVALID_ARGUMENTS;
+        }
+    }
+    if(!path) {
+        return_value = ERR_MISSING_PATH;
+        goto display_error_messages;
+    }
+    if(return_value != SUCCESS || params.nr_files < 0 || params.depth < 0 || params.depth > MAX_DEPTH || params.fanout < 1
+       || params.nr_sections < MIN_NR_SECTIONS || params.nr_sections > MAX_NR_SECTIONS || params.section_size < 1
+       || params.line_length < 1 || params.line_length > MAX_LINE_LENGTH || params.match < 0 || params.invalid < 0
+       || params.match + params.invalid > 1) {
+        return_value = ERR_INVALID_ARGUMENTS;
+        goto display_error_messages;
+    }
+
+    return_value = generate(&params,&totals);
+    if(return_value == SUCCESS) {
+        printf("SUCCESS\n");
+        printf("files: %ld\nmatching: %ld\ninvalid: %ld\ndirectories: %ld\nbytes: %llu\n",
+               totals.nr_files,totals.nr_matching,totals.nr_invalid,totals.nr_dirs,totals.nr_bytes);
+    }
+
+    display_error_messages:
+    if(return_value != SUCCESS) {
+        printf("ERROR\n");
+        if(return_value == ERR_MISSING_PATH || return_value == ERR_INVALID_ARGUMENTS)
+            printf(" USAGE: sf_corpus path=<dir_path> [files=<nr_files>] [depth=<max_depth>] [fanout=<subdirs_per_dir>] [sections=<nr_sections>]\n"
+                   "        [section_size=<bytes>] [line_length=<bytes>] [match=<fraction>] [invalid=<fraction>] [seed=<seed>]\n"
+                   "The order of the options is not relevant. match is the fraction of files findall lists, invalid the fraction of files with a wrong header.\n");
+        else if(return_value == ERR_INVALID_PATH)
+            printf("invalid directory path\n");
+        else if(return_value == ERR_ALLOCATING_MEMORY)
+            printf("Error allocating memory for the files.\n");
+        else
+            printf("Error writing the files.\n");
+        return 1;
+    }
+    return 0;
+}
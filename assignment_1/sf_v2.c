@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "a1.h"
+#include "sf_v2.h"
+#include "line_scan.h"
+#include "section_scan.h"
+#include "run_stats.h"
+
+static uint64_t align_up(uint64_t offset) {
+    return (offset + SF_V2_ALIGNMENT - 1) / SF_V2_ALIGNMENT * SF_V2_ALIGNMENT;
+}
+
+bool sf_v2_present(const sf_file_header_t * sf_header) {
+    int nr_sections = sf_header->header.no_of_sections;
+    return nr_sections <= SF_MAX_NR_SECTIONS && sf_header->header.header_size == SF_HEADER_SIZE(nr_sections) + SF_V2_EXT_SIZE(nr_sections);
+}
+
+int sf_v2_read_ext(int fd, const sf_file_header_t * sf_header, sf_v2_ext_t * ext) {
+    int nr_sections = sf_header->header.no_of_sections;
+    struct stat inode;
+    if(!sf_v2_present(sf_header))
+        return ERR_INVALID_FILE_FORMAT;
+    ssize_t nr_bytes = scan_read_fully(fd, (char*)ext, SF_V2_EXT_SIZE(nr_sections), SF_HEADER_SIZE(nr_sections));
+    if(nr_bytes < 0)
+        return ERR_READING_FILE;
+    if((size_t)nr_bytes != SF_V2_EXT_SIZE(nr_sections) || memcmp(ext->header.magic, SF_V2_MAGIC, 4) != 0
+       || ext->header.alignment != SF_V2_ALIGNMENT)
+        return ERR_INVALID_FILE_FORMAT;
+    // a section rewritten in place keeps its offset and size, but not the modification time of the file
+    stats_add(STATS_CALLS_STAT, 1);
+    if(fstat(fd, &inode) != 0)
+        return ERR_READING_FILE;
+    if(inode.st_size != ext->header.file_size || inode.st_mtim.tv_sec != ext->header.mtime_sec
+       || inode.st_mtim.tv_nsec != ext->header.mtime_nsec)
+        return ERR_INVALID_FILE_FORMAT;
+    for(int i = 0; i < nr_sections; i++) {
+        const sf_v2_section_info_t * info = &ext->sections[i];
+        // a section moved or resized since the conversion has lines the tables don't describe
+        if(info->sect_offset != sf_header->sections[i].sect_offset || info->sect_size != sf_header->sections[i].sect_size
+           || info->sect_size < 0 || info->nr_lines > (uint32_t)info->sect_size || info->last_line_end > (uint32_t)info->sect_size
+           || info->table_offset % sizeof(uint32_t) != 0)
+            return ERR_INVALID_FILE_FORMAT;
+    }
+    return SUCCESS;
+}
+
+int sf_v2_count_sections(int fd, const sf_file_header_t * sf_header, long * line_counts) {
+    sf_v2_ext_t ext;
+    int return_value = sf_v2_read_ext(fd, sf_header, &ext);
+    if(return_value != SUCCESS)
+        return return_value;
+    for(int i = 0; i < sf_header->header.no_of_sections; i++) {
+        if(line_counts[i] < 0)
+            line_counts[i] = ext.sections[i].nr_lines;
+    }
+    return SUCCESS;
+}
+
+int sf_v2_count_lines(int fd, const sf_file_header_t * sf_header, int section, long * line_count) {
+    sf_v2_ext_t ext;
+    int return_value = sf_v2_read_ext(fd, sf_header, &ext);
+    if(return_value != SUCCESS)
+        return return_value;
+    *line_count = ext.sections[section].nr_lines;
+    return SUCCESS;
+}
+
+int sf_v2_find_lines(int fd, const sf_file_header_t * sf_header, int section, const long * line_nrs, size_t nr_lines,
+                     off_t * line_starts, size_t * line_lengths, bool * found) {
+    sf_v2_ext_t ext;
+    int return_value = sf_v2_read_ext(fd, sf_header, &ext);
+    if(return_value != SUCCESS)
+        return return_value;
+    const sf_v2_section_info_t * info = &ext.sections[section];
+    for(size_t i = 0; i < nr_lines; i++) {
+        found[i] = false;
+        if(line_nrs[i] < 1 || (unsigned long)line_nrs[i] > info->nr_lines)
+            continue;
+        // the start of the line, and the start of the next one which tells where it ends
+        uint32_t bounds[2];
+        size_t nr_bounds = (unsigned long)line_nrs[i] < info->nr_lines ? 2 : 1;
+        off_t entry = info->table_offset + (off_t)(line_nrs[i] - 1) * sizeof(uint32_t);
+        if(scan_read_fully(fd, (char*)bounds, nr_bounds * sizeof(uint32_t), entry) != (ssize_t)(nr_bounds * sizeof(uint32_t)))
+            return ERR_INVALID_FILE_FORMAT;
+        if(nr_bounds == 2 && bounds[1] == 0)
+            return ERR_INVALID_FILE_FORMAT;
+        uint32_t end = nr_bounds == 2 ? bounds[1] - 1 : info->last_line_end;
+        if(end < bounds[0] || end > (uint32_t)info->sect_size)
+            return ERR_INVALID_FILE_FORMAT;
+        line_starts[i] = info->sect_offset + bounds[0];
+        line_lengths[i] = end - bounds[0];
+        found[i] = true;
+    }
+    return SUCCESS;
+}
+
+static int pwrite_fully(int fd, const char * buf, size_t size, off_t offset) {
+    while(size > 0) {
+        ssize_t nr_bytes = pwrite(fd, buf, size, offset);
+        if(nr_bytes < 0 && errno == EINTR)
+            continue;
+        if(nr_bytes <= 0)
+            return ERR_WRITING_OUTPUT;
+        buf += nr_bytes;
+        size -= nr_bytes;
+        offset += nr_bytes;
+    }
+    return SUCCESS;
+}
+
+static bool push_start(uint32_t ** starts, size_t * nr_starts, size_t * capacity, uint32_t start) {
+    if(*nr_starts == *capacity) {
+        size_t new_capacity = *capacity == 0 ? 1024 : *capacity * 2;
+        uint32_t * grown = (uint32_t*)realloc(*starts, new_capacity * sizeof(uint32_t));
+        if(grown == NULL)
+            return false;
+        *starts = grown;
+        *capacity = new_capacity;
+    }
+    (*starts)[(*nr_starts)++] = start;
+    return true;
+}
+
+/** Copies a section to new_offset in out_fd, collecting the start of every one of its lines on the way. */
+static int copy_section(int fd, int out_fd, const sect_header_t * section, off_t new_offset, char * chunk,
+                        uint32_t ** starts, sf_v2_section_info_t * info) {
+    size_t capacity = 0;
+    size_t nr_starts = 0;
+    size_t size = (size_t)section->sect_size;
+    size_t done = 0;
+    char last = '\n';
+
+    while(done < size) {
+        size_t chunk_size = size - done < SECTION_CHUNK_SIZE ? size - done : SECTION_CHUNK_SIZE;
+        ssize_t nr_bytes = scan_read_fully(fd, chunk, chunk_size, section->sect_offset + done);
+        if(nr_bytes < 0)
+            return ERR_READING_FILE;
+        // the file was checked to hold every section
+        if((size_t)nr_bytes < chunk_size)
+            return ERR_INVALID_FILE_FORMAT;
+        if(pwrite_fully(out_fd, chunk, nr_bytes, new_offset + done) != SUCCESS)
+            return ERR_WRITING_OUTPUT;
+        // the first line starts with the section, every other one after a new line
+        if(done == 0 && !push_start(starts, &nr_starts, &capacity, 0))
+            return ERR_ALLOCATING_MEMORY;
+        const char * pos = chunk;
+        const char * end = chunk + nr_bytes;
+        const char * newline;
+        while(pos < end && (newline = find_nth_newline(pos, end - pos, 1, NULL)) != NULL) {
+            if(!push_start(starts, &nr_starts, &capacity, done + (newline - chunk) + 1))
+                return ERR_ALLOCATING_MEMORY;
+            pos = newline + 1;
+        }
+        last = chunk[nr_bytes-1];
+        done += nr_bytes;
+    }
+    // a new line at the very end doesn't start another line
+    if(nr_starts > 0 && (*starts)[nr_starts-1] == done)
+        nr_starts--;
+    info->sect_offset = new_offset;
+    info->sect_size = size;
+    info->nr_lines = nr_starts;
+    info->last_line_end = done - (done > 0 && last == '\n' ? 1 : 0);
+    info->table_offset = 0;
+    return SUCCESS;
+}
+
+int sf_v2_convert(int fd, const sf_file_header_t * sf_header, const char * out_path) {
+    int return_value = SUCCESS;
+    int nr_sections = sf_header->header.no_of_sections;
+    size_t header_size = SF_HEADER_SIZE(nr_sections) + SF_V2_EXT_SIZE(nr_sections);
+    sf_file_header_t out_header = *sf_header;
+    sf_v2_ext_t ext;
+    uint32_t * starts[SF_MAX_NR_SECTIONS] = {NULL};
+    char header[SF_HEADER_SIZE(SF_MAX_NR_SECTIONS) + SF_V2_EXT_SIZE(SF_MAX_NR_SECTIONS)];
+    char tmp_path[MAX_PATH_SIZE + 16];
+    struct stat inode;
+    int out_fd = -1;
+    bool created = false;
+    uint64_t offset = align_up(header_size);
+    char * chunk = (char*)malloc(SECTION_CHUNK_SIZE);
+    if(chunk == NULL)
+        return ERR_ALLOCATING_MEMORY;
+
+    if(fstat(fd, &inode) != 0) {
+        return_value = ERR_READING_FILE;
+        goto clean_up;
+    }
+    for(int i = 0; i < nr_sections; i++) {
+        const sect_header_t * section = &sf_header->sections[i];
+        if(section->sect_offset < 0 || section->sect_size < 0 || (off_t)section->sect_offset + section->sect_size > inode.st_size) {
+            return_value = ERR_INVALID_FILE_FORMAT;
+            goto clean_up;
+        }
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", out_path, (int)getpid());
+    out_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(out_fd < 0) {
+        return_value = ERR_INVALID_PATH;
+        goto clean_up;
+    }
+    created = true;
+
+    // every section on a page of its own, in the same order
+    for(int i = 0; i < nr_sections; i++) {
+        if(offset + sf_header->sections[i].sect_size > INT32_MAX) {
+            return_value = ERR_INVALID_FILE_FORMAT;
+            goto clean_up;
+        }
+        return_value = copy_section(fd, out_fd, &sf_header->sections[i], offset, chunk, &starts[i], &ext.sections[i]);
+        if(return_value != SUCCESS)
+            goto clean_up;
+        out_header.sections[i].sect_offset = offset;
+        offset = align_up(offset + sf_header->sections[i].sect_size);
+    }
+    // then the line tables, one after the other
+    for(int i = 0; i < nr_sections; i++) {
+        size_t table_size = ext.sections[i].nr_lines * sizeof(uint32_t);
+        if(offset + table_size > UINT32_MAX) {
+            return_value = ERR_INVALID_FILE_FORMAT;
+            goto clean_up;
+        }
+        ext.sections[i].table_offset = offset;
+        if(table_size > 0 && pwrite_fully(out_fd, (const char*)starts[i], table_size, offset) != SUCCESS) {
+            return_value = ERR_WRITING_OUTPUT;
+            goto clean_up;
+        }
+        offset += table_size;
+    }
+
+    // the header goes last, a file cut short by an error is never taken for a converted one
+    out_header.header.header_size = header_size;
+    memcpy(ext.header.magic, SF_V2_MAGIC, 4);
+    ext.header.alignment = SF_V2_ALIGNMENT;
+    // the file gets this modification time once written, in whole seconds which every file system keeps exactly
+    struct timespec times[2] = {{.tv_sec = 0, .tv_nsec = UTIME_OMIT}, {.tv_sec = time(NULL), .tv_nsec = 0}};
+    ext.header.file_size = offset;
+    ext.header.mtime_sec = times[1].tv_sec;
+    ext.header.mtime_nsec = 0;
+    memcpy(header, &out_header.header, sizeof(sf_header_t));
+    memcpy(header + sizeof(sf_header_t), out_header.sections, nr_sections * sizeof(sect_header_t));
+    memcpy(header + SF_HEADER_SIZE(nr_sections), &ext, SF_V2_EXT_SIZE(nr_sections));
+    if(pwrite_fully(out_fd, header, header_size, 0) != SUCCESS || ftruncate(out_fd, offset) != 0 || futimens(out_fd, times) != 0) {
+        return_value = ERR_WRITING_OUTPUT;
+        goto clean_up;
+    }
+    if(close(out_fd) != 0) {
+        out_fd = -1;
+        return_value = ERR_WRITING_OUTPUT;
+        goto clean_up;
+    }
+    out_fd = -1;
+    if(rename(tmp_path, out_path) != 0)
+        return_value = ERR_INVALID_PATH;
+
+    clean_up:
+    if(out_fd >= 0)
+        close(out_fd);
+    if(return_value != SUCCESS && created)
+        unlink(tmp_path);
+    for(int i = 0; i < nr_sections; i++)
+        free(starts[i]);
+    free(chunk);
+    return return_value;
+}
@@ -0,0 +1,87 @@
+#ifndef __SF_V2_H__
+#define __SF_V2_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "../common/sf_format.h"
+
+/**
+ * SFv2 is an sf file any reader of the original format still understands: the same header, with the same fields and
+ * limits, followed by an extension block the header_size covers (the original readers never look at header_size).
+ * The sections start on page boundaries, and after the last one come the line tables: for every section the offsets
+ * (from the section start) of all its lines, as uint32. The extension block tells where each table is and how many
+ * lines the section has, so counting or finding a line costs a couple of small reads instead of a scan of the section.
+ * A header edited after the conversion no longer matches the copy of the section offsets and sizes kept in the extension,
+ * and the tables are then ignored. So are the tables of a file written to in any way since the conversion: the extension
+ * keeps the size and modification time the conversion left the file with, and any write changes the modification time.
+ * (A copy of the file which doesn't keep the modification time loses the tables the same way, it is scanned instead.)
+ */
+
+#define SF_V2_MAGIC "SFv2"
+/** Alignment of the sections and of the first line table. */
+#define SF_V2_ALIGNMENT 4096
+
+#pragma pack(push,1)
+typedef struct sf_v2_ext_header{
+    char magic[4];
+    uint32_t alignment;
+    /** size and modification time of the file when the conversion finished */
+    int64_t file_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+}sf_v2_ext_header_t;
+
+typedef struct sf_v2_section_info{
+    /** offset and size of the section when it was converted */
+    int32_t sect_offset;
+    int32_t sect_size;
+    uint32_t nr_lines;
+    /** end of the last line (without its new line, if it has one), from the section start */
+    uint32_t last_line_end;
+    /** file offset of the nr_lines line starts */
+    uint32_t table_offset;
+}sf_v2_section_info_t;
+#pragma pack(pop)
+
+/** Size of the extension block of a file having the given number of sections, it comes right after the section headers. */
+#define SF_V2_EXT_SIZE(nr_sections) (sizeof(sf_v2_ext_header_t) + (nr_sections) * sizeof(sf_v2_section_info_t))
+
+/** A decoded extension block. */
+typedef struct sf_v2_ext{
+    sf_v2_ext_header_t header;
+    sf_v2_section_info_t sections[SF_MAX_NR_SECTIONS];
+}sf_v2_ext_t;
+
+/** Tells from the decoded header alone (no read) whether the file announces an extension block. */
+bool sf_v2_present(const sf_file_header_t * sf_header);
+/**
+ * Reads the extension block of a file whose header was already decoded, with a single read (and a stat).
+ * Returns ERR_INVALID_FILE_FORMAT if the file is not an SFv2 file, its extension doesn't match the header
+ * or the file changed since it was converted.
+ */
+int sf_v2_read_ext(int fd, const sf_file_header_t * sf_header, sf_v2_ext_t * ext);
+/**
+ * Sets the line count of every section whose line_counts[i] is negative from the extension block.
+ * The counts are exact. Returns ERR_INVALID_FILE_FORMAT (leaving line_counts alone) if the file has no usable tables,
+ * the caller then scans the sections.
+ */
+int sf_v2_count_sections(int fd, const sf_file_header_t * sf_header, long * line_counts);
+/** Same as sf_v2_count_sections for the section-th section (counting from 0) only. */
+int sf_v2_count_lines(int fd, const sf_file_header_t * sf_header, int section, long * line_count);
+/**
+ * Finds lines of the section-th section (counting from 0) through its line table, like scan_find_lines
+ * (line_nrs counting from 1). Returns ERR_INVALID_FILE_FORMAT if the file has no usable tables.
+ */
+int sf_v2_find_lines(int fd, const sf_file_header_t * sf_header, int section, const long * line_nrs, size_t nr_lines,
+                     off_t * line_starts, size_t * line_lengths, bool * found);
+/**
+ * Writes the SFv2 version of the (valid, already decoded) sf file in out_path. The sections keep their names, types,
+ * sizes and order, only their offsets change. It is written under a temporary name first and then renamed, so out_path
+ * may be the converted file itself. Fails with ERR_INVALID_FILE_FORMAT if a section runs past the end of the file.
+ */
+int sf_v2_convert(int fd, const sf_file_header_t * sf_header, const char * out_path);
+
+#endif
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "a1.h"
+#include "suffix_trie.h"
+
+#define NO_NODE -1
+
+/** A node of the trie, its children being a list of siblings (the suffixes are few and short). */
+typedef struct trie_node{
+    unsigned char c;
+    /** a suffix ends here */
+    bool terminal;
+    int first_child;
+    int next_sibling;
+}trie_node_t;
+
+struct suffix_trie{
+    trie_node_t * nodes;
+    int nr_nodes;
+    int capacity;
+};
+
+int suffix_trie_init(suffix_trie_t ** trie) {
+    suffix_trie_t * new_trie = (suffix_trie_t*)malloc(sizeof(suffix_trie_t));
+    if(new_trie == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    new_trie->capacity = 64;
+    new_trie->nodes = (trie_node_t*)malloc(new_trie->capacity * sizeof(trie_node_t));
+    if(new_trie->nodes == NULL) {
+        free(new_trie);
+        return ERR_ALLOCATING_MEMORY;
+    }
+    // the root stands for the end of the name
+    new_trie->nodes[0] = (trie_node_t){.c = 0, .terminal = false, .first_child = NO_NODE, .next_sibling = NO_NODE};
+    new_trie->nr_nodes = 1;
+    *trie = new_trie;
+    return SUCCESS;
+}
+
+void suffix_trie_destroy(suffix_trie_t * trie) {
+    if(trie == NULL)
+        return;
+    free(trie->nodes);
+    free(trie);
+}
+
+static int find_child(const suffix_trie_t * trie, int node, unsigned char c) {
+    int child = trie->nodes[node].first_child;
+    while(child != NO_NODE && trie->nodes[child].c != c)
+        child = trie->nodes[child].next_sibling;
+    return child;
+}
+
+int suffix_trie_add(suffix_trie_t * trie, const char * suffix) {
+    int node = 0;
+    // the root is never terminal: an empty suffix matches no name
+    if(suffix[0] == 0)
+        return SUCCESS;
+    for(size_t i = strlen(suffix); i > 0; i--) {
+        unsigned char c = suffix[i-1];
+        int child = find_child(trie, node, c);
+        if(child == NO_NODE) {
+            if(trie->nr_nodes == trie->capacity) {
+                trie_node_t * nodes = (trie_node_t*)realloc(trie->nodes, 2 * trie->capacity * sizeof(trie_node_t));
+                if(nodes == NULL)
+                    return ERR_ALLOCATING_MEMORY;
+                trie->nodes = nodes;
+                trie->capacity *= 2;
+            }
+            child = trie->nr_nodes++;
+            trie->nodes[child] = (trie_node_t){.c = c, .terminal = false, .first_child = NO_NODE,
+                                               .next_sibling = trie->nodes[node].first_child};
+            trie->nodes[node].first_child = child;
+        }
+        node = child;
+    }
+    trie->nodes[node].terminal = true;
+    return SUCCESS;
+}
+
+bool suffix_trie_match(const suffix_trie_t * trie, const char * name, size_t length) {
+    int node = 0;
+    // the shortest matching suffix decides, the rest of the name is never read
+    while(length > 0) {
+        node = find_child(trie, node, (unsigned char)name[--length]);
+        if(node == NO_NODE)
+            return false;
+        if(trie->nodes[node].terminal)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,20 @@
+#ifndef __SUFFIX_TRIE_H__
+#define __SUFFIX_TRIE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Set of name suffixes stored as a trie of the reversed suffixes, so a name is matched against
+ * all of them at once by reading it backwards from its last character.
+ */
+typedef struct suffix_trie suffix_trie_t;
+
+int suffix_trie_init(suffix_trie_t ** trie);
+void suffix_trie_destroy(suffix_trie_t * trie);
+/** Adds a suffix. An empty one is accepted but matches no name, as name_ends_with= always did. */
+int suffix_trie_add(suffix_trie_t * trie, const char * suffix);
+/** Tells if the name (of the given length) ends with any of the suffixes. */
+bool suffix_trie_match(const suffix_trie_t * trie, const char * name, size_t length);
+
+#endif
@@ -0,0 +1,139 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "a1.h"
+#include "uring.h"
+
+/**
+ * Tells whether the kernel supports the operations the ring is used for. The probe itself came with 5.6, the first
+ * kernel having IORING_OP_OPENAT and IORING_OP_READ, so a kernel without it has neither.
+ */
+static bool supports_ops(int fd) {
+    static const int needed[] = { IORING_OP_OPENAT, IORING_OP_READ };
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe * probe = (struct io_uring_probe*)calloc(1, probe_size);
+    bool supported = probe != NULL && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+
+    for(size_t i=0;supported && i<sizeof(needed)/sizeof(needed[0]);i++) {
+        if(needed[i] > probe->last_op || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+            supported = false;
+    }
+    free(probe);
+    return supported;
+}
+
+int uring_init(uring_t * ring, unsigned entries) {
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(uring_t));
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if(ring->fd < 0)
+        return ERR_IO_URING_UNAVAILABLE;
+    // an older kernel would fail every request, the caller validates the files one by one instead
+    if(!supports_ops(ring->fd)) {
+        close(ring->fd);
+        return ERR_IO_URING_UNAVAILABLE;
+    }
+    ring->sq_entries = params.sq_entries;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    // recent kernels place both rings in a single mapping
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        if(ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if(ring->sq_ring == MAP_FAILED)
+        goto fail;
+    if(params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    }else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if(ring->cq_ring == MAP_FAILED)
+            goto fail;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if(ring->sqes == MAP_FAILED)
+        goto fail;
+
+    ring->sq_head = (unsigned*)((char*)ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned*)((char*)ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)((char*)ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)((char*)ring->sq_ring + params.sq_off.array);
+    ring->cq_head = (unsigned*)((char*)ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned*)((char*)ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)((char*)ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ring + params.cq_off.cqes);
+    return SUCCESS;
+
+    fail:
+    if(ring->sqes != NULL && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if(ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    return ERR_IO_URING_UNAVAILABLE;
+}
+
+void uring_exit(uring_t * ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+struct io_uring_sqe * uring_get_sqe(uring_t * ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    // the entries prepared since the last submit come after the published tail
+    unsigned tail = *ring->sq_tail + ring->to_submit;
+    if(tail - head >= ring->sq_entries)
+        return NULL;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe * sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+    // the kernel may only see the entry once it is filled in, so the tail is published by the submit
+    ring->to_submit++;
+    return sqe;
+}
+
+int uring_submit_and_wait(uring_t * ring, unsigned wait_nr) {
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->to_submit, __ATOMIC_RELEASE);
+    unsigned to_submit = ring->to_submit;
+    ring->to_submit = 0;
+    while(to_submit > 0 || wait_nr > 0) {
+        int ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if(ret < 0) {
+            if(errno == EINTR)
+                continue;
+            return ERR_READING_FILE;
+        }
+        to_submit -= ret;
+        // the completions may arrive over several calls
+        unsigned ready = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) - *ring->cq_head;
+        if(ready >= wait_nr)
+            wait_nr = 0;
+    }
+    return SUCCESS;
+}
+
+bool uring_pop_cqe(uring_t * ring, struct io_uring_cqe * cqe) {
+    unsigned head = *ring->cq_head;
+    if(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return false;
+    *cqe = ring->cqes[head & *ring->cq_mask];
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/** A minimal io_uring, driven straight through the system calls (liburing is not required). */
+typedef struct uring{
+    int fd;
+    unsigned sq_entries;
+    unsigned * sq_head;
+    unsigned * sq_tail;
+    unsigned * sq_mask;
+    unsigned * sq_array;
+    unsigned * cq_head;
+    unsigned * cq_tail;
+    unsigned * cq_mask;
+    struct io_uring_sqe * sqes;
+    struct io_uring_cqe * cqes;
+    void * sq_ring;
+    size_t sq_ring_size;
+    void * cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    /** prepared entries which were not submitted yet */
+    unsigned to_submit;
+}uring_t;
+
+/**
+ * Sets up a ring with the given number of entries. Fails if the kernel doesn't support (or allow) io_uring, or lacks
+ * the open and read operations (before 5.6).
+ */
+int uring_init(uring_t * ring, unsigned entries);
+void uring_exit(uring_t * ring);
+/** Returns a cleared submission entry, or NULL if the submission queue is full. */
+struct io_uring_sqe * uring_get_sqe(uring_t * ring);
+/** Submits the prepared entries and waits until at least wait_nr completions are available. */
+int uring_submit_and_wait(uring_t * ring, unsigned wait_nr);
+/** Takes the next completion, if any. */
+bool uring_pop_cqe(uring_t * ring, struct io_uring_cqe * cqe);
+
+#endif
@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "a1.h"
+#include "visited_set.h"
+
+#define INITIAL_SHARD_CAPACITY 64
+
+typedef struct visited_entry{
+    uint64_t dev;
+    uint64_t ino;
+    /** 0 marks a free slot */
+    int state;
+}visited_entry_t;
+
+typedef struct visited_shard{
+    pthread_mutex_t lock;
+    visited_entry_t * entries;
+    /** always a power of two */
+    size_t capacity;
+    size_t count;
+}visited_shard_t;
+
+struct visited_set{
+    visited_shard_t shards[VISITED_SET_SHARDS];
+};
+
+static uint64_t hash_inode(uint64_t dev, uint64_t ino) {
+    // splitmix64 finalizer: inode numbers are dense, their low bits alone would crowd the same slots
+    uint64_t x = ino ^ (dev * 0x9e3779b97f4a7c15ull);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+int visited_set_init(visited_set_t ** set) {
+    visited_set_t * new_set = (visited_set_t*)malloc(sizeof(visited_set_t));
+    if(new_set == NULL)
+        return ERR_ALLOCATING_MEMORY;
+    for(int i = 0; i < VISITED_SET_SHARDS; i++) {
+        visited_shard_t * shard = &new_set->shards[i];
+        shard->capacity = INITIAL_SHARD_CAPACITY;
+        shard->count = 0;
+        shard->entries = (visited_entry_t*)calloc(shard->capacity, sizeof(visited_entry_t));
+        if(shard->entries == NULL) {
+            for(int j = 0; j < i; j++) {
+                free(new_set->shards[j].entries);
+                pthread_mutex_destroy(&new_set->shards[j].lock);
+            }
+            free(new_set);
+            return ERR_ALLOCATING_MEMORY;
+        }
+        pthread_mutex_init(&shard->lock, NULL);
+    }
+    *set = new_set;
+    return SUCCESS;
+}
+
+void visited_set_destroy(visited_set_t * set) {
+    if(set == NULL)
+        return;
+    for(int i = 0; i < VISITED_SET_SHARDS; i++) {
+        free(set->shards[i].entries);
+        pthread_mutex_destroy(&set->shards[i].lock);
+    }
+    free(set);
+}
+
+/** Returns the slot of the inode, or the free slot where it would go. */
+static visited_entry_t * find_slot(visited_entry_t * entries, size_t capacity, uint64_t hash, uint64_t dev, uint64_t ino) {
+    // the high bits chose the shard, the low ones the slot
+    size_t slot = hash & (capacity - 1);
+    while(entries[slot].state != 0 && (entries[slot].dev != dev || entries[slot].ino != ino))
+        slot = (slot + 1) & (capacity - 1);
+    return &entries[slot];
+}
+
+static bool grow_shard(visited_shard_t * shard) {
+    size_t capacity = shard->capacity * 2;
+    visited_entry_t * entries = (visited_entry_t*)calloc(capacity, sizeof(visited_entry_t));
+    if(entries == NULL)
+        return false;
+    for(size_t i = 0; i < shard->capacity; i++) {
+        visited_entry_t * entry = &shard->entries[i];
+        if(entry->state != 0)
+            *find_slot(entries, capacity, hash_inode(entry->dev, entry->ino), entry->dev, entry->ino) = *entry;
+    }
+    free(shard->entries);
+    shard->entries = entries;
+    shard->capacity = capacity;
+    return true;
+}
+
+int visited_set_find(visited_set_t * set, dev_t dev, ino_t ino) {
+    uint64_t hash = hash_inode(dev, ino);
+    visited_shard_t * shard = &set->shards[hash >> 58];
+    pthread_mutex_lock(&shard->lock);
+    int state = find_slot(shard->entries, shard->capacity, hash, dev, ino)->state;
+    pthread_mutex_unlock(&shard->lock);
+    return state;
+}
+
+int visited_set_put(visited_set_t * set, dev_t dev, ino_t ino, int state, int * previous) {
+    uint64_t hash = hash_inode(dev, ino);
+    visited_shard_t * shard = &set->shards[hash >> 58];
+    pthread_mutex_lock(&shard->lock);
+    // keep the table at most 3/4 full, so the probes stay short
+    if((shard->count + 1) * 4 > shard->capacity * 3 && !grow_shard(shard)) {
+        pthread_mutex_unlock(&shard->lock);
+        return ERR_ALLOCATING_MEMORY;
+    }
+    visited_entry_t * entry = find_slot(shard->entries, shard->capacity, hash, dev, ino);
+    if(previous != NULL)
+        *previous = entry->state;
+    if(entry->state == 0) {
+        entry->dev = dev;
+        entry->ino = ino;
+        shard->count++;
+    }
+    entry->state = state;
+    pthread_mutex_unlock(&shard->lock);
+    return SUCCESS;
+}
@@ -0,0 +1,27 @@
+#ifndef __VISITED_SET_H__
+#define __VISITED_SET_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/** Number of independently locked parts of the set, so concurrent walkers rarely wait for each other. */
+#define VISITED_SET_SHARDS 64
+
+/**
+ * Set of inodes, identified by their (dev, ino) pair, each one stored with a small non zero state.
+ * The set is split in shards by the hash of the pair; every shard is an open addressing table with its own lock.
+ */
+typedef struct visited_set visited_set_t;
+
+/** States findall remembers for a file with several hard links, so its other names are not validated again. */
+#define SEEN_INVALID 1
+#define SEEN_VALID 2
+
+int visited_set_init(visited_set_t ** set);
+void visited_set_destroy(visited_set_t * set);
+/** Returns the state stored for the inode, 0 if it was never stored. */
+int visited_set_find(visited_set_t * set, dev_t dev, ino_t ino);
+/** Stores (or replaces) the state of the inode. If previous is not NULL it gets the state replaced, 0 if the inode is new. */
+int visited_set_put(visited_set_t * set, dev_t dev, ino_t ino, int state, int * previous);
+
+#endif
@@ -7,6 +7,8 @@
 #include <unistd.h>
 #include <sys/mman.h>
 
+#include "../common/sf_format.h"
+
 typedef enum return_status{ SUCCESS = 0,
 ERR_CREATING_PIPE,
 ERR_OPENING_PIPE,
@@ -43,23 +45,11 @@ ERR_INVALID_SF_FILE_FORMAT
 #define SH_MEM_SIZE 4989424
 #define PAGE_SIZE 3072
 
-#pragma pack(push,1)
-typedef struct s_sect_header{
-    char sect_name[19];
-    int sect_type;
-    int sect_offset;
-    int sect_size;
-}sect_header_t;
-#pragma pack(pop)
-
-#pragma pack(push,1)
-typedef struct s_sf_header{
-    char magic[4];
-    unsigned short header_size;
-    short version;
-    char no_of_sections;
-}sf_header_t;
-#pragma pack(pop)
+/* valid sect types are in {19, 10 , 58, 57, 11, 53} */
+const int VALID_SECT_TYPES[6] = {19, 10, 58, 57, 11, 53};
+/* version number in range: 47 - 128, no_of_sections in range : 5 - 19 */
+const sf_rules_t sf_rules = {.min_version = 47, .max_version = 128, .min_nr_sections = 5, .max_nr_sections = 19,
+                             .sect_types = VALID_SECT_TYPES, .nr_sect_types = 6};
 
 int read_and_handle_request();
 int handle_ping_request();
@@ -81,8 +71,8 @@ int create_and_map_shared_memory(char * name, int size);
 /** map the file for reading */
 int map_sf_file(char * file_name);
 
-bool is_valid_sf_format(sf_header_t sf_header);
-bool is_valid_section_header(sect_header_t sect_header);
+/** decode and validate the header of the mapped file, the section types are left to the requests using the sections */
+int decode_mapped_sf_header(sf_file_header_t * sf_header);
 char * select_error_message(return_status_t status);
 
 /** Size of the memory mapped file */
@@ -310,7 +300,7 @@ int handle_read_from_file_section_request(){
     unsigned int offset;
     unsigned int no_of_bytes;
     sect_header_t sect_header;
-    sf_header_t mmf_header;
+    sf_file_header_t mmf_header;
 
     status = read_number_field(fd_read, &section_nr);
     if(status != SUCCESS) goto finish;
@@ -321,28 +311,23 @@ int handle_read_from_file_section_request(){
     status = read_number_field(fd_read, &no_of_bytes);
     if(status != SUCCESS) goto finish;
 
-    memcpy(&mmf_header,mmf_data,sizeof(sf_header_t));
-
     /* check that the mapped file has a valid sf format */
-    if(!is_valid_sf_format(mmf_header)) {
-        status = ERR_INVALID_SF_FILE_FORMAT;
-        goto finish;
-    }
+    status = decode_mapped_sf_header(&mmf_header);
+    if(status != SUCCESS) goto finish;
+
     bool valid_data = true;
     /*  validate that there exists a mapping for a file and a shared memory region. */
     if(sh_mem_data == NULL || mmf_data == NULL)
         valid_data = false;
     /* validate that the section number is less than or equal than the max nr of sections */
-    if(section_nr < 1 || section_nr > mmf_header.no_of_sections)
+    if(section_nr < 1 || section_nr > mmf_header.header.no_of_sections)
         valid_data = false;
 
     if(!valid_data)
         goto evaluate;
 
-    unsigned int sect_header_start = sizeof(sf_header_t) + (section_nr-1)*sizeof(sect_header_t);
-    memcpy(&sect_header, mmf_data + sect_header_start, sizeof(sect_header_t));
-
-    if(!is_valid_section_header(sect_header)) {
+    sect_header = mmf_header.sections[section_nr-1];
+    if(!sf_is_valid_sect_type(&sf_rules, sect_header.sect_type)) {
         status = ERR_INVALID_SF_FILE_FORMAT;
         goto finish;
     }
@@ -376,7 +361,7 @@ int handle_read_from_logical_offset_request() {
     int status = SUCCESS;
     unsigned int logical_offset;
     unsigned int no_of_bytes;
-    sf_header_t mmf_header;
+    sf_file_header_t mmf_header;
     sect_header_t sect_header;
 
     status = read_number_field(fd_read, &logical_offset);
@@ -385,22 +370,18 @@ int handle_read_from_logical_offset_request() {
     status = read_number_field(fd_read, &no_of_bytes);
     if (status != SUCCESS) goto finish;
 
-    memcpy(&mmf_header, mmf_data, sizeof(sf_header_t));
-
     /* check that the mapped file has a valid sf format */
-    if (!is_valid_sf_format(mmf_header)) {
-        status = ERR_INVALID_SF_FILE_FORMAT;
-        goto finish;
-    }
+    status = decode_mapped_sf_header(&mmf_header);
+    if (status != SUCCESS) goto finish;
+
     /* compute the address in the sf file using the given logical address */
-    unsigned int sect_header_start = sizeof(sf_header_t);
     int curr_offset = 0;
     int sect_start = 0;
     int i=0;
     do{
-        /* read the next section header */
-        memcpy(&sect_header, mmf_data + sect_header_start, sizeof(sect_header_t));
-        if (!is_valid_section_header(sect_header)) {
+        /* take the next section header */
+        sect_header = mmf_header.sections[i];
+        if (!sf_is_valid_sect_type(&sf_rules, sect_header.sect_type)) {
             status = ERR_INVALID_SF_FILE_FORMAT;
             goto finish;
         }
@@ -412,9 +393,8 @@ int handle_read_from_logical_offset_request() {
         if (sect_header.sect_size % PAGE_SIZE > 0)
             curr_offset+=PAGE_SIZE;
         /* go to next section in the header of the sf file */
-        sect_header_start += sizeof(sect_header_t);
         i++;
-    }while(i < mmf_header.no_of_sections && curr_offset < logical_offset);
+    }while(i < mmf_header.header.no_of_sections && curr_offset < logical_offset);
 
     /* Check if there are less pages than the size of the logical address */
     if (curr_offset < logical_offset) {
@@ -542,31 +522,15 @@ int read_number_field(int fd, unsigned int * param){
     return SUCCESS;
 }
 
-bool is_valid_sf_format(sf_header_t sf_header) {
-    /* check magic number = MAGIC_NR */
-    char magic_ext[5];
-    memcpy(magic_ext,sf_header.magic,strlen(MAGIC_NR));
-    magic_ext[4] = '\0';
-    if(strcmp(magic_ext,MAGIC_NR) != 0)
-        return false;
-    /* check version number in range:  14 - 128 */
-    if(sf_header.version < 47 || sf_header.version > 128)
-        return false;
-    /* check no_of_sections in range : 5 - 19 */
-    if(sf_header.no_of_sections < 5 || sf_header.no_of_sections > 19)
-        return false;
-    return true;
-}
-
-bool is_valid_section_header(sect_header_t sect_header) {
-    /* check valid sect types are in {19, 10 , 58, 57, 11, 53} */
-    unsigned int VALID_SECT_TYPES[6] = {19, 10, 58, 57, 11, 53};
-    for (int i = 0; i < 6; i++) {
-        if (sect_header.sect_type == VALID_SECT_TYPES[i]) {
-            return true;
-        }
-    }
-    return false;
+int decode_mapped_sf_header(sf_file_header_t * sf_header) {
+    sf_invalid_field_t failure_src;
+    if(mmf_data == NULL)
+        return ERR_INVALID_SF_FILE_FORMAT;
+    /* the header is decoded straight from the mapping, no extra read is needed */
+    if(sf_decode_header(mmf_data, mmf_size, &sf_rules, sf_header, &failure_src) != SF_SUCCESS
+       && failure_src != SF_WRONG_SECT_TYPE)
+        return ERR_INVALID_SF_FILE_FORMAT;
+    return SUCCESS;
 }
 
 char * select_error_message(return_status_t status){
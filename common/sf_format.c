@@ -0,0 +1,63 @@
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "sf_format.h"
+
+bool sf_is_valid_sect_type(const sf_rules_t * rules, int sect_type) {
+    for(int i=0;i<rules->nr_sect_types;i++) {
+        if(rules->sect_types[i] == sect_type)
+            return true;
+    }
+    return false;
+}
+
+int sf_decode_header(const char * data, size_t size, const sf_rules_t * rules, sf_file_header_t * sf_header, sf_invalid_field_t * failure_src) {
+    int max_nr_sections = rules->max_nr_sections < SF_MAX_NR_SECTIONS ? rules->max_nr_sections : SF_MAX_NR_SECTIONS;
+    size_t header_size = SF_HEADER_SIZE(max_nr_sections);
+
+    /* copy what is available, the rest of the fields stay zero */
+    memset(sf_header, 0, sizeof(sf_file_header_t));
+    memcpy(sf_header, data, size < header_size ? size : header_size);
+
+    *failure_src = SF_VALID;
+    if(memcmp(sf_header->header.magic, SF_MAGIC, SF_MAGIC_SIZE) != 0)
+        *failure_src = SF_WRONG_MAGIC;
+    else if(sf_header->header.version < rules->min_version || sf_header->header.version > rules->max_version)
+        *failure_src = SF_WRONG_VERSION;
+    else if(sf_header->header.no_of_sections < rules->min_nr_sections || sf_header->header.no_of_sections > max_nr_sections)
+        *failure_src = SF_WRONG_SECT_NR;
+    if(*failure_src != SF_VALID)
+        return SF_ERR_INVALID_FORMAT;
+
+    for(int i=0;i<sf_header->header.no_of_sections;i++) {
+        if(!sf_is_valid_sect_type(rules, sf_header->sections[i].sect_type)) {
+            *failure_src = SF_WRONG_SECT_TYPE;
+            return SF_ERR_INVALID_FORMAT;
+        }
+    }
+    return SF_SUCCESS;
+}
+
+int sf_read_header_counted(int fd, const sf_rules_t * rules, sf_file_header_t * sf_header, sf_invalid_field_t * failure_src,
+                           int * nr_reads, ssize_t * nr_bytes_read) {
+    char buf[SF_HEADER_SIZE(SF_MAX_NR_SECTIONS)];
+    int max_nr_sections = rules->max_nr_sections < SF_MAX_NR_SECTIONS ? rules->max_nr_sections : SF_MAX_NR_SECTIONS;
+    ssize_t nr_bytes;
+
+    /* one system call for the fixed header and all the section headers */
+    do {
+        nr_bytes = pread(fd, buf, SF_HEADER_SIZE(max_nr_sections), 0);
+        if(nr_reads != NULL)
+            (*nr_reads)++;
+    } while(nr_bytes < 0 && errno == EINTR);
+    if(nr_bytes_read != NULL)
+        *nr_bytes_read = nr_bytes > 0 ? nr_bytes : 0;
+    if(nr_bytes < 0)
+        return SF_ERR_READING_FILE;
+    return sf_decode_header(buf, nr_bytes, rules, sf_header, failure_src);
+}
+
+int sf_read_header(int fd, const sf_rules_t * rules, sf_file_header_t * sf_header, sf_invalid_field_t * failure_src) {
+    return sf_read_header_counted(fd, rules, sf_header, failure_src, NULL, NULL);
+}
@@ -0,0 +1,74 @@
+#ifndef __SF_FORMAT_H__
+#define __SF_FORMAT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define SF_MAGIC "1A4P"
+#define SF_MAGIC_SIZE 4
+/** the header can't describe more sections than this in any of the assignments */
+#define SF_MAX_NR_SECTIONS 19
+
+#define SF_SUCCESS 0
+#define SF_ERR_READING_FILE -1
+#define SF_ERR_INVALID_FORMAT -2
+
+#pragma pack(push,1)
+typedef struct s_sect_header{
+    char sect_name[19];
+    int sect_type;
+    int sect_offset;
+    int sect_size;
+}sect_header_t;
+#pragma pack(pop)
+
+#pragma pack(push,1)
+typedef struct s_sf_header{
+    char magic[4];
+    unsigned short header_size;
+    short version;
+    unsigned char no_of_sections;
+}sf_header_t;
+#pragma pack(pop)
+
+/** Size of the header of a file having the given number of sections. */
+#define SF_HEADER_SIZE(nr_sections) (sizeof(sf_header_t) + (nr_sections) * sizeof(sect_header_t))
+
+/** The field which made a header invalid. */
+typedef enum sf_invalid_field{ SF_VALID = 0, SF_WRONG_MAGIC, SF_WRONG_VERSION, SF_WRONG_SECT_NR, SF_WRONG_SECT_TYPE }sf_invalid_field_t;
+
+/** The limits a valid header has to respect, they differ from one assignment to the other. */
+typedef struct sf_rules{
+    int min_version;
+    int max_version;
+    int min_nr_sections;
+    int max_nr_sections;
+    const int * sect_types;
+    int nr_sect_types;
+}sf_rules_t;
+
+/** A decoded header, together with the headers of its sections. */
+typedef struct sf_file_header{
+    sf_header_t header;
+    sect_header_t sections[SF_MAX_NR_SECTIONS];
+}sf_file_header_t;
+
+/**
+ * Decodes and validates the header found at the start of data (e.g. a mapped file).
+ * Missing bytes are treated as zeroes, so a truncated file fails the validation instead of the decoding.
+ * Returns SF_SUCCESS or SF_ERR_INVALID_FORMAT, in which case failure_src tells the invalid field. The header is decoded
+ * in full before it is validated, so with SF_WRONG_SECT_TYPE the caller can still check the sections it uses one by one.
+ */
+int sf_decode_header(const char * data, size_t size, const sf_rules_t * rules, sf_file_header_t * sf_header, sf_invalid_field_t * failure_src);
+/** Reads the header with a single pread of the largest header the rules allow, then decodes it. */
+int sf_read_header(int fd, const sf_rules_t * rules, sf_file_header_t * sf_header, sf_invalid_field_t * failure_src);
+/**
+ * Same as sf_read_header, also adding to *nr_reads the system calls made and setting *nr_bytes_read to the bytes read,
+ * for callers keeping count of their I/O (either may be NULL).
+ */
+int sf_read_header_counted(int fd, const sf_rules_t * rules, sf_file_header_t * sf_header, sf_invalid_field_t * failure_src,
+                           int * nr_reads, ssize_t * nr_bytes_read);
+bool sf_is_valid_sect_type(const sf_rules_t * rules, int sect_type);
+
+#endif